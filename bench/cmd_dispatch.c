@@ -0,0 +1,68 @@
+// Verb lookup through the perfect hash table (mftp_atoc) against a linear strcmp scan of mftp_cmd_strings - how
+// commands were resolved before - and the full mftp_client_msg_parse path.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "shared/cmd.h"
+
+#define ROUNDS 2000000
+
+static const char* lines[] = {
+    "LIST", "RETR big.bin", "STOR upload.bin", "NOOP", "USER bob", "PASS secret", "SIZE big.bin", "CHWD dir",
+    "PWDR", "SEGM 0 1048576 file.bin", "RANG 4096 4096 file.bin", "STAT", "QUIT", "feat", "XXXX",
+};
+#define LINES_COUNT (sizeof(lines) / sizeof(lines[0]))
+
+static volatile unsigned sink;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static mftp_cmd_t linear_atoc(const char* verb) {
+    for (int i = 0; i < MFTP_CMD_INVALID; i++) {
+        if (strcmp(mftp_cmd_strings[i], verb) == 0) return (mftp_cmd_t)i;
+    }
+    return MFTP_CMD_INVALID;
+}
+
+static void report(const char* name, uint64_t start, uint64_t ops) {
+    printf("%-24s %6.2f ns/op\n", name, (double)(now_ns() - start) / (double)ops);
+}
+
+int main(void) {
+    // bare upper-case verbs, so both lookups get the same input
+    char verbs[LINES_COUNT][5];
+    for (size_t i = 0; i < LINES_COUNT; i++) {
+        for (int j = 0; j < 4; j++) verbs[i][j] = (char)(lines[i][j] & ~0x20);
+        verbs[i][4] = '\0';
+    }
+
+    unsigned acc = 0;
+    uint64_t start = now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (size_t i = 0; i < LINES_COUNT; i++) acc += linear_atoc(verbs[i]);
+    }
+    report("linear strcmp scan", start, (uint64_t)ROUNDS * LINES_COUNT);
+
+    start = now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (size_t i = 0; i < LINES_COUNT; i++) acc += mftp_atoc(verbs[i]);
+    }
+    report("perfect hash (atoc)", start, (uint64_t)ROUNDS * LINES_COUNT);
+
+    mftp_client_msg_t msg;
+    start = now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (size_t i = 0; i < LINES_COUNT; i++) acc += mftp_client_msg_parse(lines[i], &msg) ? msg.cmd : 0;
+    }
+    report("full line parse", start, (uint64_t)ROUNDS * LINES_COUNT);
+
+    sink = acc;
+    return 0;
+}
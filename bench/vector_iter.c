@@ -0,0 +1,108 @@
+// Walking passwd entries stored in vector_t against the doubly linked list they used to live in (node and element
+// allocated separately for every entry, as list_insert took ownership of a malloc'd element).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "shared/vector.h"
+#include "shared/passwd.h"
+
+#define ENTRIES 1000
+#define ROUNDS 20000
+
+typedef struct node {
+    struct node* prev;
+    struct node* next;
+    void* data;
+} node_t;
+
+static volatile unsigned sink;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void report(const char* name, uint64_t start, uint64_t ops) {
+    printf("%-24s %6.2f ns/entry\n", name, (double)(now_ns() - start) / (double)ops);
+}
+
+int main(void) {
+    vector_t vector = vector_new(passwd_entry_t);
+    node_t* head = NULL;
+    node_t* tail = NULL;
+
+    for (int i = 0; i < ENTRIES; i++) {
+        passwd_entry_t entry = { .perms = (uint8_t)i, .weight = 1 };
+        snprintf(entry.username, sizeof(entry.username), "user%d", i);
+
+        if (vector_push(&vector, &entry) == NULL) return 1;
+
+        node_t* node = malloc(sizeof(node_t));
+        passwd_entry_t* data = malloc(sizeof(passwd_entry_t));
+        if (node == NULL || data == NULL) return 1;
+        *data = entry;
+        *node = (node_t) { .prev = tail, .data = data };
+        if (tail) tail->next = node;
+        else head = node;
+        tail = node;
+    }
+
+    unsigned acc = 0;
+
+    uint64_t start = now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (node_t* node = head; node != NULL; node = node->next) acc += ((passwd_entry_t*)node->data)->perms;
+    }
+    report("list iteration", start, (uint64_t)ROUNDS * ENTRIES);
+
+    start = now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        vector_iter_t iter = vector_iter(&vector);
+        passwd_entry_t* entry;
+        while ((entry = vector_next(&iter)) != NULL) acc += entry->perms;
+    }
+    report("vector iteration", start, (uint64_t)ROUNDS * ENTRIES);
+
+    // name lookup by linear scan - last entry, so every one is compared
+    const char* name = "user999";
+
+    start = now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (node_t* node = head; node != NULL; node = node->next) {
+            if (strcmp(((passwd_entry_t*)node->data)->username, name) == 0) {
+                acc++;
+                break;
+            }
+        }
+    }
+    report("list name scan", start, (uint64_t)ROUNDS * ENTRIES);
+
+    start = now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        vector_iter_t iter = vector_iter(&vector);
+        passwd_entry_t* entry;
+        while ((entry = vector_next(&iter)) != NULL) {
+            if (strcmp(entry->username, name) == 0) {
+                acc++;
+                break;
+            }
+        }
+    }
+    report("vector name scan", start, (uint64_t)ROUNDS * ENTRIES);
+
+    sink = acc;
+
+    while (head != NULL) {
+        node_t* next = head->next;
+        free(head->data);
+        free(head);
+        head = next;
+    }
+    vector_clear(&vector);
+    return 0;
+}
@@ -1,14 +1,25 @@
 #include "shared/cmd.h"
 #include "shared/utils.h"
 #include "shared/socket.h"
+#include "client-cli/fetch.h"
+#include "client-cli/put.h"
 
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <stdlib.h>
 
 int main(int argc, char* argv[]) {
+    if (argc >= 2 && strcmp(argv[1], "fetch") == 0) {
+        return fetch_main(argc - 1, argv + 1);
+    }
+    if (argc >= 2 && strcmp(argv[1], "put") == 0) {
+        return put_main(argc - 1, argv + 1);
+    }
+
     if (argc < 3) {
         printf("Usage: %s <file> <port>\n", argv[0]);
+        printf("       %s fetch <host> <port> <remote file> <local file> [streams] [user] [password]\n", argv[0]);
+        printf("       %s put <host> <port> <local file> <remote file> [streams] [user] [password]\n", argv[0]);
         return 1;
     }
 
@@ -0,0 +1,189 @@
+#include "fetch.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "shared/utils.h"
+#include "client-cli/session.h"
+
+#define FETCH_MAX_STREAMS 32
+#define FETCH_BUFFER_SIZE (256 * 1024)
+
+typedef struct {
+    session_cfg_t session;
+    const char* remote_name;
+    int out_fd;
+} fetch_opts_t;
+
+typedef struct {
+    const fetch_opts_t* opts;
+    uint64_t offset, length;
+    uint64_t received;
+    pthread_t tid;
+    bool ok;
+} fetch_segment_t;
+
+static void* segment_thread(void* arg) {
+    fetch_segment_t* seg = (fetch_segment_t*)arg;
+    const fetch_opts_t* opts = seg->opts;
+    seg->ok = false;
+
+    int cmd_fd = session_open(&opts->session);
+    if (cmd_fd < 0) return NULL;
+
+    int data_fd = -1;
+    char* buffer = NULL;
+    char reply[512], line[512];
+
+    snprintf(line, sizeof(line), "RANG %llu %llu %s", (unsigned long long)seg->offset, (unsigned long long)seg->length, opts->remote_name);
+    if (!session_command(cmd_fd, line, reply, sizeof(reply))) {
+        log_err("Segment at %llu refused: %s", (unsigned long long)seg->offset, reply);
+        goto cleanup;
+    }
+
+    data_fd = session_data_connect(&opts->session, reply);
+    if (data_fd < 0) goto cleanup;
+
+    buffer = malloc(FETCH_BUFFER_SIZE);
+    if (buffer == NULL) {
+        log_syserr("Failed to allocate memory for segment buffer");
+        goto cleanup;
+    }
+
+    while (seg->received < seg->length) {
+        ssize_t got = recv(data_fd, buffer, FETCH_BUFFER_SIZE, 0);
+        if (got == 0) break;
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            log_syserr("Failed to receive segment data");
+            goto cleanup;
+        }
+
+        // segments are disjoint - every thread writes straight into its own part of the file
+        if (pwrite(opts->out_fd, buffer, got, seg->offset + seg->received) != got) {
+            log_syserr("Failed to write segment");
+            goto cleanup;
+        }
+        seg->received += got;
+    }
+
+    if (!session_reply_read(cmd_fd, reply, sizeof(reply)) || strncmp(reply, "OK ", 3) != 0) {
+        log_err("Segment at %llu failed: %s", (unsigned long long)seg->offset, reply);
+        goto cleanup;
+    }
+
+    seg->ok = seg->received == seg->length;
+    if (!seg->ok) log_err("Segment at %llu is short (%llu of %llu bytes)", (unsigned long long)seg->offset, (unsigned long long)seg->received, (unsigned long long)seg->length);
+
+    session_command(cmd_fd, "QUIT", reply, sizeof(reply));
+
+cleanup:
+    free(buffer);
+    if (data_fd >= 0) close(data_fd);
+    close(cmd_fd);
+    return NULL;
+}
+
+int fetch_main(int argc, char* argv[]) {
+    if (argc < 5) {
+        printf("Usage: mftp-client-cli fetch <host> <port> <remote file> <local file> [streams] [user] [password]\n");
+        return 1;
+    }
+
+    fetch_opts_t opts = {
+        .session = {
+            .user = argc > 6 ? argv[6] : NULL,
+            .pass = argc > 7 ? argv[7] : NULL,
+        },
+        .remote_name = argv[3],
+        .out_fd = -1,
+    };
+
+    size_t streams = argc > 5 ? strtoul(argv[5], NULL, 10) : 4;
+    if (streams == 0 || streams > FETCH_MAX_STREAMS) {
+        log_err("Number of streams must be between 1 and %d", FETCH_MAX_STREAMS);
+        return 1;
+    }
+
+    if (!session_resolve(&opts.session, argv[1], argv[2])) return 1;
+
+    // ask for size over a control session, segments are cut from it
+    int cmd_fd = session_open(&opts.session);
+    if (cmd_fd < 0) return 1;
+
+    char reply[512], line[300];
+    snprintf(line, sizeof(line), "SIZE %s", opts.remote_name);
+    bool size_ok = session_command(cmd_fd, line, reply, sizeof(reply));
+    session_command(cmd_fd, "QUIT", line, sizeof(line));
+    close(cmd_fd);
+
+    unsigned long long size = 0;
+    if (!size_ok || sscanf(reply, "OK %*d %llu", &size) != 1) {
+        log_err("Couldn't get size of %s: %s", opts.remote_name, reply);
+        return 1;
+    }
+
+    opts.out_fd = open(argv[4], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (opts.out_fd < 0) {
+        log_syserr("Couldn't open %s", argv[4]);
+        return 1;
+    }
+
+    if (ftruncate(opts.out_fd, size) < 0) {
+        log_syserr("Couldn't resize %s", argv[4]);
+        close(opts.out_fd);
+        return 1;
+    }
+
+    // no point in splitting tiny files
+    if (size < streams * FETCH_BUFFER_SIZE) streams = size / FETCH_BUFFER_SIZE + 1;
+
+    fetch_segment_t segments[FETCH_MAX_STREAMS] = { 0 };
+    uint64_t segment_size = size / streams;
+    size_t started = 0;
+
+    for (size_t i = 0; i < streams; i++) {
+        segments[i] = (fetch_segment_t) {
+            .opts = &opts,
+            .offset = i * segment_size,
+            .length = i + 1 == streams ? size - i * segment_size : segment_size,
+        };
+        if (segments[i].length == 0) continue;
+
+        if (pthread_create(&segments[i].tid, NULL, segment_thread, &segments[i]) != 0) {
+            log_syserr("Failed to start segment thread");
+            break;
+        }
+        started++;
+    }
+
+    bool ok = started > 0 || size == 0;
+    uint64_t total = 0;
+
+    for (size_t i = 0; i < streams; i++) {
+        if (segments[i].length == 0) continue;
+        if (segments[i].tid == 0) {
+            ok = false;
+            continue;
+        }
+
+        pthread_join(segments[i].tid, NULL);
+        ok = ok && segments[i].ok;
+        total += segments[i].received;
+    }
+
+    close(opts.out_fd);
+
+    if (!ok) {
+        log_err("Fetch of %s failed", opts.remote_name);
+        return 1;
+    }
+
+    log_info("Fetched %llu bytes over %zu stream(s)", (unsigned long long)total, started);
+    return 0;
+}
@@ -0,0 +1,9 @@
+#ifndef _MFTP_CLIENT_FETCH_H_
+#define _MFTP_CLIENT_FETCH_H_
+
+// Parallel download - file is split into segments, each fetched with RANG over its own session and written in place.
+
+// argv[0] is "fetch"
+int fetch_main(int argc, char* argv[]);
+
+#endif
@@ -0,0 +1,186 @@
+#include "put.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+
+#include "shared/utils.h"
+#include "client-cli/session.h"
+
+#define PUT_MAX_STREAMS 32
+#define PUT_MIN_SEGMENT (256 * 1024)
+
+typedef struct {
+    session_cfg_t session;
+    const char* remote_name;
+    int in_fd;
+} put_opts_t;
+
+typedef struct {
+    const put_opts_t* opts;
+    uint64_t offset, length;
+    pthread_t tid;
+    bool ok;
+    bool committed;     // server reported whole file arrived with this segment
+} put_segment_t;
+
+static void* segment_thread(void* arg) {
+    put_segment_t* seg = (put_segment_t*)arg;
+    const put_opts_t* opts = seg->opts;
+    seg->ok = false;
+
+    int cmd_fd = session_open(&opts->session);
+    if (cmd_fd < 0) return NULL;
+
+    int data_fd = -1;
+    char reply[512], line[512];
+
+    snprintf(line, sizeof(line), "SEGM %llu %llu %s", (unsigned long long)seg->offset, (unsigned long long)seg->length, opts->remote_name);
+    if (!session_command(cmd_fd, line, reply, sizeof(reply))) {
+        log_err("Segment at %llu refused: %s", (unsigned long long)seg->offset, reply);
+        goto cleanup;
+    }
+
+    data_fd = session_data_connect(&opts->session, reply);
+    if (data_fd < 0) goto cleanup;
+
+    // explicit offset - segments share one descriptor
+    off_t offset = (off_t)seg->offset;
+    uint64_t left = seg->length;
+
+    while (left > 0) {
+        ssize_t sent = sendfile(data_fd, opts->in_fd, &offset, left);
+        if (sent <= 0) {
+            if (sent < 0 && errno == EINTR) continue;
+            log_syserr("Failed to send segment at %llu", (unsigned long long)seg->offset);
+            goto cleanup;
+        }
+        left -= sent;
+    }
+
+    shutdown(data_fd, SHUT_WR);
+
+    if (!session_reply_read(cmd_fd, reply, sizeof(reply)) || strncmp(reply, "OK ", 3) != 0) {
+        log_err("Segment at %llu failed: %s", (unsigned long long)seg->offset, reply);
+        goto cleanup;
+    }
+
+    seg->ok = true;
+    seg->committed = strstr(reply, "committed") != NULL;
+
+    session_command(cmd_fd, "QUIT", reply, sizeof(reply));
+
+cleanup:
+    if (data_fd >= 0) close(data_fd);
+    close(cmd_fd);
+    return NULL;
+}
+
+int put_main(int argc, char* argv[]) {
+    if (argc < 5) {
+        printf("Usage: mftp-client-cli put <host> <port> <local file> <remote file> [streams] [user] [password]\n");
+        return 1;
+    }
+
+    put_opts_t opts = {
+        .session = {
+            .user = argc > 6 ? argv[6] : NULL,
+            .pass = argc > 7 ? argv[7] : NULL,
+        },
+        .remote_name = argv[4],
+        .in_fd = -1,
+    };
+
+    size_t streams = argc > 5 ? strtoul(argv[5], NULL, 10) : 4;
+    if (streams == 0 || streams > PUT_MAX_STREAMS) {
+        log_err("Number of streams must be between 1 and %d", PUT_MAX_STREAMS);
+        return 1;
+    }
+
+    if (!session_resolve(&opts.session, argv[1], argv[2])) return 1;
+
+    opts.in_fd = open(argv[3], O_RDONLY);
+    struct stat st;
+    if (opts.in_fd < 0 || fstat(opts.in_fd, &st) < 0) {
+        log_syserr("Couldn't open %s", argv[3]);
+        if (opts.in_fd >= 0) close(opts.in_fd);
+        return 1;
+    }
+
+    uint64_t size = st.st_size;
+    if (size == 0) {
+        log_err("Nothing to upload - %s is empty", argv[3]);
+        close(opts.in_fd);
+        return 1;
+    }
+
+    int cmd_fd = session_open(&opts.session);
+    if (cmd_fd < 0) {
+        close(opts.in_fd);
+        return 1;
+    }
+
+    char reply[512], line[300];
+    snprintf(line, sizeof(line), "ALLO %llu %s", (unsigned long long)size, opts.remote_name);
+    bool allo_ok = session_command(cmd_fd, line, reply, sizeof(reply));
+    session_command(cmd_fd, "QUIT", line, sizeof(line));
+    close(cmd_fd);
+
+    if (!allo_ok) {
+        log_err("Couldn't allocate %s: %s", opts.remote_name, reply);
+        close(opts.in_fd);
+        return 1;
+    }
+
+    // no point in splitting tiny files
+    if (size < streams * PUT_MIN_SEGMENT) streams = size / PUT_MIN_SEGMENT + 1;
+
+    put_segment_t segments[PUT_MAX_STREAMS] = { 0 };
+    uint64_t segment_size = size / streams;
+    size_t started = 0;
+
+    for (size_t i = 0; i < streams; i++) {
+        segments[i] = (put_segment_t) {
+            .opts = &opts,
+            .offset = i * segment_size,
+            .length = i + 1 == streams ? size - i * segment_size : segment_size,
+        };
+        if (segments[i].length == 0) continue;
+
+        if (pthread_create(&segments[i].tid, NULL, segment_thread, &segments[i]) != 0) {
+            log_syserr("Failed to start segment thread");
+            break;
+        }
+        started++;
+    }
+
+    bool ok = started > 0, committed = false;
+
+    for (size_t i = 0; i < streams; i++) {
+        if (segments[i].length == 0) continue;
+        if (segments[i].tid == 0) {
+            ok = false;
+            continue;
+        }
+
+        pthread_join(segments[i].tid, NULL);
+        ok = ok && segments[i].ok;
+        committed = committed || segments[i].committed;
+    }
+
+    close(opts.in_fd);
+
+    if (!ok || !committed) {
+        log_err("Upload of %s failed - run again to resend missing segments", opts.remote_name);
+        return 1;
+    }
+
+    log_info("Uploaded %llu bytes over %zu stream(s)", (unsigned long long)size, started);
+    return 0;
+}
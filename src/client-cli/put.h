@@ -0,0 +1,10 @@
+#ifndef _MFTP_CLIENT_PUT_H_
+#define _MFTP_CLIENT_PUT_H_
+
+// Parallel upload - ALLO declares file size, then every segment is sent with SEGM over its own session.
+// Server commits the file once all segments have arrived.
+
+// argv[0] is "put"
+int put_main(int argc, char* argv[]);
+
+#endif
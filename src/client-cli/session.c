@@ -0,0 +1,117 @@
+#include "session.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <netdb.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "shared/utils.h"
+
+bool session_resolve(session_cfg_t* cfg, const char* host, const char* port) {
+    struct hostent* entry = gethostbyname(host);
+    if (entry == NULL || entry->h_addrtype != AF_INET) {
+        log_err("Couldn't resolve %s", host);
+        return false;
+    }
+
+    cfg->server_addr = (struct sockaddr_in) {
+        .sin_family = AF_INET,
+        .sin_port = htons(atoi(port)),
+    };
+    memcpy(&cfg->server_addr.sin_addr, entry->h_addr_list[0], sizeof(cfg->server_addr.sin_addr));
+
+    return true;
+}
+
+int session_connect(const struct sockaddr_in* addr) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        log_syserr("Failed to create socket");
+        return -1;
+    }
+
+    if (connect(fd, (const struct sockaddr*)addr, sizeof(*addr)) < 0) {
+        log_syserr("Couldn't connect to %s:%d", inet_ntoa(addr->sin_addr), ntohs(addr->sin_port));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// replies are short - byte at a time is fine
+bool session_reply_read(int fd, char* line, size_t size) {
+    size_t len = 0;
+
+    while (true) {
+        char c;
+        ssize_t got = recv(fd, &c, 1, 0);
+        if (got <= 0) {
+            if (got < 0 && errno == EINTR) continue;
+            line[len < size ? len : size - 1] = '\0';
+            return false;
+        }
+
+        if (c == '\n' && len > 0 && line[len - 1] == '\r') {
+            line[len - 1] = '\0';
+            return true;
+        }
+        if (len + 1 < size) line[len++] = c;
+    }
+}
+
+bool session_command(int fd, const char* cmd, char* reply, size_t size) {
+    char line[512];
+    int len = snprintf(line, sizeof(line), "%s\r\n", cmd);
+
+    if (send(fd, line, len, MSG_NOSIGNAL) != len || !session_reply_read(fd, reply, size)) {
+        log_syserr("Lost connection to server");
+        return false;
+    }
+
+    return strncmp(reply, "OK ", 3) == 0;
+}
+
+int session_open(const session_cfg_t* cfg) {
+    int fd = session_connect(&cfg->server_addr);
+    if (fd < 0) return -1;
+
+    char reply[512], line[300];
+
+    if (!session_reply_read(fd, reply, sizeof(reply))) {
+        log_err("Server closed connection");
+        close(fd);
+        return -1;
+    }
+
+    if (cfg->user != NULL) {
+        snprintf(line, sizeof(line), "USER %s", cfg->user);
+        if (!session_command(fd, line, reply, sizeof(reply))) goto fail;
+        snprintf(line, sizeof(line), "PASS %s", cfg->pass != NULL ? cfg->pass : "");
+        if (!session_command(fd, line, reply, sizeof(reply))) goto fail;
+    }
+
+    return fd;
+
+fail:
+    log_err("Login failed: %s", reply);
+    close(fd);
+    return -1;
+}
+
+int session_data_connect(const session_cfg_t* cfg, const char* reply) {
+    // listener is bound to any address, so connect to the server we already know
+    const char* port_str = strrchr(reply, ':');
+    if (port_str == NULL || atoi(port_str + 1) <= 0) {
+        log_err("Unexpected reply: %s", reply);
+        return -1;
+    }
+
+    struct sockaddr_in data_addr = cfg->server_addr;
+    data_addr.sin_port = htons(atoi(port_str + 1));
+
+    return session_connect(&data_addr);
+}
@@ -0,0 +1,31 @@
+#ifndef _MFTP_CLIENT_SESSION_H_
+#define _MFTP_CLIENT_SESSION_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <netinet/in.h>
+
+// Blocking command channel helpers shared by client modes.
+
+typedef struct {
+    struct sockaddr_in server_addr;
+    const char* user;   // NULL - don't log in (anonymous)
+    const char* pass;
+} session_cfg_t;
+
+// fills cfg->server_addr from host name and port string
+bool session_resolve(session_cfg_t* cfg, const char* host, const char* port);
+
+int session_connect(const struct sockaddr_in* addr);
+// connects command channel, reads welcome and logs in if credentials were given. -1 on failure.
+int session_open(const session_cfg_t* cfg);
+
+// reads one reply into line (without CRLF)
+bool session_reply_read(int fd, char* line, size_t size);
+// sends command line and reads reply - true if server answered OK
+bool session_command(int fd, const char* cmd, char* reply, size_t size);
+
+// connects to data channel announced in "OK 120 [addr:port] ..." reply. -1 on failure.
+int session_data_connect(const session_cfg_t* cfg, const char* reply);
+
+#endif
@@ -0,0 +1,101 @@
+#include "admission.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#include "shared/utils.h"
+#include "shared/cmd.h"
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+bool admission_queue_init(admission_queue_t* queue, size_t cap) {
+    *queue = (admission_queue_t) { 0 };
+    if (cap == 0) return true;
+
+    queue->entries = malloc(cap * sizeof(admission_entry_t));
+    if (queue->entries == NULL) {
+        log_syserr("Failed to allocate memory for admission queue");
+        return false;
+    }
+    queue->cap = cap;
+
+    return true;
+}
+
+void admission_queue_cleanup(admission_queue_t* queue) {
+    if (queue->timer_on) uev_timer_stop(&queue->timer);
+    queue->timer_on = false;
+
+    int fd;
+    while ((fd = admission_queue_pop(queue)) >= 0) close(fd);
+
+    free(queue->entries);
+    queue->entries = NULL;
+    queue->cap = 0;
+}
+
+bool admission_queue_push(admission_queue_t* queue, int fd, uint32_t timeout_ms) {
+    if (queue->len == queue->cap) return false;
+
+    queue->entries[(queue->head + queue->len) % queue->cap] = (admission_entry_t) {
+        .fd = fd,
+        .deadline_ns = now_ns() + (uint64_t)timeout_ms * 1000000ull,
+    };
+    queue->len++;
+
+    return true;
+}
+
+int admission_queue_pop(admission_queue_t* queue) {
+    if (queue->len == 0) return -1;
+
+    int fd = queue->entries[queue->head].fd;
+    queue->head = (queue->head + 1) % queue->cap;
+    queue->len--;
+
+    return fd;
+}
+
+int admission_queue_pop_expired(admission_queue_t* queue) {
+    // same timeout for everyone - oldest entry expires first
+    if (queue->len == 0 || queue->entries[queue->head].deadline_ns > now_ns()) return -1;
+    return admission_queue_pop(queue);
+}
+
+bool admission_slot_claim(size_t* total, size_t max) {
+    if (max == 0) {
+        __atomic_add_fetch(total, 1, __ATOMIC_RELAXED);
+        return true;
+    }
+
+    size_t current = __atomic_load_n(total, __ATOMIC_RELAXED);
+    do {
+        if (current >= max) return false;
+    } while (!__atomic_compare_exchange_n(total, &current, current + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    return true;
+}
+
+void admission_slot_release(size_t* total) {
+    __atomic_sub_fetch(total, 1, __ATOMIC_RELAXED);
+}
+
+void admission_reject(int fd, uint32_t retry_after_s) {
+    mftp_server_msg_t msg = {
+        .kind = MFTP_MSG_ERR,
+        .code = MFTP_CODE_BUSY,
+        .data = { 0 },
+    };
+    snprintf(msg.data, sizeof(msg.data), "Server busy - retry after %u s", (unsigned)retry_after_s);
+
+    // fresh connection has an empty send buffer - one short line always fits
+    mftp_server_msg_write(fd, &msg);
+    close(fd);
+}
@@ -0,0 +1,48 @@
+#ifndef _MFTP_SERVER_ADMISSION_H_
+#define _MFTP_SERVER_ADMISSION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <uev.h>
+
+// Admission control. Connections accepted while all client slots are taken wait in their reactor's queue for one to
+// free up, instead of staying in the listen backlog where they'd keep the listener readable and the loop spinning.
+// Waiting is bounded in length and time - connections that don't fit or wait too long get BUSY with a retry-after
+// hint and are closed.
+
+// how often a reactor with waiting connections checks for slots freed by other reactors and for expired waits
+#define ADMISSION_POLL_MS 100
+
+typedef struct {
+    int fd;
+    uint64_t deadline_ns;
+} admission_entry_t;
+
+typedef struct admission_queue {
+    admission_entry_t* entries; // ring buffer, oldest at head
+    size_t cap, head, len;
+    uev_t timer;                // polls while there are waiting connections
+    bool timer_on;
+} admission_queue_t;
+
+bool admission_queue_init(admission_queue_t* queue, size_t cap);
+// closes connections that are still waiting
+void admission_queue_cleanup(admission_queue_t* queue);
+
+// false if queue is full
+bool admission_queue_push(admission_queue_t* queue, int fd, uint32_t timeout_ms);
+// oldest waiting connection, -1 if there is none
+int admission_queue_pop(admission_queue_t* queue);
+// oldest waiting connection if its wait is over, -1 otherwise
+int admission_queue_pop_expired(admission_queue_t* queue);
+
+// takes one of max slots counted in *total (shared, __atomic), false if all are taken. max 0 - unlimited.
+bool admission_slot_claim(size_t* total, size_t max);
+void admission_slot_release(size_t* total);
+
+// replies BUSY with retry-after hint and closes fd
+void admission_reject(int fd, uint32_t retry_after_s);
+
+#endif
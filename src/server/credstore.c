@@ -0,0 +1,175 @@
+#include "credstore.h"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "shared/utils.h"
+
+// how long reloader sleeps between checks for readers of an old table
+#define CRED_GRACE_POLL_US 1000
+
+static passwd_t* table_load(const char* path, uint32_t generation) {
+    passwd_t* table = malloc(sizeof(passwd_t));
+    if (table == NULL) {
+        log_syserr("Failed to allocate memory for user accounts");
+        return NULL;
+    }
+
+    *table = (passwd_t) { .entries = vector_new(passwd_entry_t) };
+    if (!passwd_parse(table, path)) {
+        passwd_cleanup(table);
+        free(table);
+        return NULL;
+    }
+
+    vector_iter_t iter = vector_iter(&table->entries);
+    passwd_entry_t* entry;
+    while ((entry = vector_next(&iter)) != NULL) {
+        entry->generation = generation;
+    }
+
+    return table;
+}
+
+static void table_free(passwd_t* table) {
+    if (table == NULL) return;
+    passwd_cleanup(table);
+    free(table);
+}
+
+// returns counter reader was counted in - pass it to read_end
+static unsigned read_begin(cred_store_t* store) {
+    for (;;) {
+        unsigned epoch = __atomic_load_n(&store->epoch, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&store->readers[epoch & 1], 1, __ATOMIC_SEQ_CST);
+
+        // epoch flipped in between - reloader may have already seen this counter empty
+        if (__atomic_load_n(&store->epoch, __ATOMIC_SEQ_CST) == epoch) return epoch & 1;
+
+        __atomic_sub_fetch(&store->readers[epoch & 1], 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static void read_end(cred_store_t* store, unsigned counter) {
+    __atomic_sub_fetch(&store->readers[counter], 1, __ATOMIC_RELEASE);
+}
+
+// reloader only - publishes table and frees the one it replaced once no reader can hold it
+static void table_publish(cred_store_t* store, passwd_t* table) {
+    passwd_t* old = __atomic_exchange_n(&store->current, table, __ATOMIC_SEQ_CST);
+
+    // readers that start from now on see the new table
+    unsigned epoch = __atomic_fetch_add(&store->epoch, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&store->readers[epoch & 1], __ATOMIC_SEQ_CST) > 0) {
+        usleep(CRED_GRACE_POLL_US);
+    }
+
+    table_free(old);
+}
+
+static void* reloader_thread(void* arg) {
+    cred_store_t* store = (cred_store_t*)arg;
+
+    pthread_mutex_lock(&store->lock);
+    for (;;) {
+        while (!store->reload_pending && !store->stopping) {
+            pthread_cond_wait(&store->wake, &store->lock);
+        }
+        if (store->stopping) break;
+        store->reload_pending = false;
+        pthread_mutex_unlock(&store->lock);
+
+        log_info("Reloading user accounts from %s", store->path);
+
+        passwd_t* table = table_load(store->path, ++store->generation);
+        if (table == NULL) {
+            log_err("Failed to reload passwd file, keeping %zu user(s) loaded before", cred_store_size(store));
+        } else {
+            size_t users = table->entries.size;
+            table_publish(store, table);
+            log_info("Reloaded %zu user(s) from passwd file", users);
+        }
+
+        pthread_mutex_lock(&store->lock);
+    }
+    pthread_mutex_unlock(&store->lock);
+
+    return NULL;
+}
+
+bool cred_store_init(cred_store_t* store, const char* path, bool* loaded) {
+    *store = (cred_store_t) { 0 };
+    strncpy(store->path, path, PATH_MAX - 1);
+
+    store->current = table_load(path, store->generation);
+    *loaded = store->current != NULL;
+    if (store->current == NULL) {
+        store->current = calloc(1, sizeof(passwd_t));
+        if (store->current == NULL) {
+            log_syserr("Failed to allocate memory for user accounts");
+            return false;
+        }
+        store->current->entries = vector_new(passwd_entry_t);
+    }
+
+    pthread_mutex_init(&store->lock, NULL);
+    pthread_cond_init(&store->wake, NULL);
+
+    // signals are handled by main loop's signalfd, reloader must not receive any
+    sigset_t all_signals, old_mask;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &old_mask);
+    int err = pthread_create(&store->tid, NULL, reloader_thread, store);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+    if (err != 0) {
+        log_err("Failed to start passwd reloader: %s", strerror(err));
+        pthread_cond_destroy(&store->wake);
+        pthread_mutex_destroy(&store->lock);
+        table_free(store->current);
+        store->current = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+void cred_store_cleanup(cred_store_t* store) {
+    pthread_mutex_lock(&store->lock);
+    store->stopping = true;
+    pthread_cond_signal(&store->wake);
+    pthread_mutex_unlock(&store->lock);
+    pthread_join(store->tid, NULL);
+
+    pthread_cond_destroy(&store->wake);
+    pthread_mutex_destroy(&store->lock);
+
+    table_free(store->current);
+    store->current = NULL;
+}
+
+void cred_store_reload(cred_store_t* store) {
+    pthread_mutex_lock(&store->lock);
+    store->reload_pending = true; // reloads requested while one runs are coalesced into one more
+    pthread_cond_signal(&store->wake);
+    pthread_mutex_unlock(&store->lock);
+}
+
+bool cred_store_check(cred_store_t* store, const char* username, const char* password, passwd_entry_t* entry) {
+    unsigned counter = read_begin(store);
+
+    const passwd_entry_t* found = passwd_find(__atomic_load_n(&store->current, __ATOMIC_SEQ_CST), username, password);
+    if (found != NULL) *entry = *found;
+
+    read_end(store, counter);
+    return found != NULL;
+}
+
+size_t cred_store_size(cred_store_t* store) {
+    unsigned counter = read_begin(store);
+    size_t size = __atomic_load_n(&store->current, __ATOMIC_SEQ_CST)->entries.size;
+    read_end(store, counter);
+    return size;
+}
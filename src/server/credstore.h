@@ -0,0 +1,41 @@
+#ifndef _MFTP_SERVER_CREDSTORE_H_
+#define _MFTP_SERVER_CREDSTORE_H_
+
+#include <stddef.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "shared/passwd.h"
+
+// User accounts that can be reloaded while the server runs. The passwd file is parsed by a background thread into a
+// new table, which is then published with an atomic pointer swap - logins never wait for a reload. Readers announce
+// themselves in one of two counters picked by the current epoch. After the swap the reloader flips the epoch and
+// waits for the old epoch's counter to drain (a grace period) before freeing the old table, so no login can still
+// be looking at it. Sessions that already logged in keep their credentials as they were.
+
+typedef struct cred_store {
+    passwd_t* current;      // published table - use __atomic builtins
+    uint32_t generation;    // stamped on entries of every table loaded, reloader only
+    unsigned epoch;         // readers count themselves in readers[epoch & 1]
+    size_t readers[2];
+    char path[PATH_MAX];
+
+    pthread_t tid;          // reloader
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool reload_pending, stopping; // guarded by lock
+} cred_store_t;
+
+// parses passwd file at path and starts the reloader, false if out of memory or the thread couldn't be started.
+// *loaded is false if the file couldn't be parsed - store then has no accounts until a reload succeeds.
+bool cred_store_init(cred_store_t* store, const char* path, bool* loaded);
+void cred_store_cleanup(cred_store_t* store);
+
+// any thread - asks reloader to parse the passwd file again. Old accounts stay in use if it can't be parsed.
+void cred_store_reload(cred_store_t* store);
+// any thread - copies entry matching both username and password to *entry, false if there's none
+bool cred_store_check(cred_store_t* store, const char* username, const char* password, passwd_entry_t* entry);
+size_t cred_store_size(cred_store_t* store);
+
+#endif
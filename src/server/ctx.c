@@ -2,6 +2,12 @@
 
 #include "shared/utils.h"
 #include "shared/cmd.h"
+#include "shared/slab.h"
+#include "server/dataport.h"
+#include "server/upload.h"
+#include "server/uring.h"
+#include "server/evtransfer.h"
+#include "server/session.h"
 
 #include <assert.h>
 #include <string.h>
@@ -12,23 +18,26 @@
 #include <dirent.h>
 #include <sys/socket.h>
 
+// how often shutdown checks for transfer threads that didn't exit yet
+#define SERVER_STOP_POLL_US 1000
+
+const mftp_server_cfg_t* mftp_server_cfg(const mftp_server_ctx_t* server_ctx) {
+    return __atomic_load_n(&server_ctx->cfg, __ATOMIC_ACQUIRE);
+}
+
 void mftp_server_remove_client_data_watcher(mftp_server_ctx_t* server_ctx, uev_t* watcher) {
-    list_iter_t iter = list_iter(&server_ctx->client_data_watchers);
-    uev_t* w; int i = 0;
-
-    while ((w = list_next(&iter)) != NULL) {
-        if (w->fd == watcher->fd) {
-            uev_io_stop(w);
-            client_ctx_cleanup_full((mftp_client_ctx_t*)w->arg);
-            list_remove(&server_ctx->client_data_watchers, i);
-            free(w);
-            return;
-        }
-        i++;
-    }
+    uev_t* w = session_table_remove(&server_ctx->sessions, watcher->fd);
+    if (w == NULL) return;
+
+    uev_io_stop(w);
+    client_ctx_cleanup_full((mftp_client_ctx_t*)w->arg);
+    slab_free(w);
+    admission_slot_release(server_ctx->clients_total);
 }
 
 bool client_ctx_init(mftp_client_ctx_t* ctx, int cmd_fd, mftp_server_ctx_t* server_ctx) {
+    const mftp_server_cfg_t* cfg = mftp_server_cfg(server_ctx);
+
     /* GENERAL STATE */
 
     ctx->locked = false;
@@ -38,16 +47,39 @@ bool client_ctx_init(mftp_client_ctx_t* ctx, int cmd_fd, mftp_server_ctx_t* serv
 
     ctx->cmd_fd = cmd_fd;
     
-    ctx->cmd_buf = malloc(server_ctx->cfg.max_cmd_size);
+    ctx->cmd_buf = slab_alloc(cfg->max_cmd_size + 1);
     if (ctx->cmd_buf == NULL) {
         log_syserr("Failed to allocate memory for client command buffer");
         return false;
     }
 
-    ctx->cmd_buf_len = 0;
-    ctx->cmd_tid = 0;
+    // room for a few pipelined commands, so one recv can pick up a whole batch
+    size_t in_buf_size = (cfg->max_cmd_size + 2) * 2;
+    if (in_buf_size < CLIENT_INPUT_BUFFER_MIN) in_buf_size = CLIENT_INPUT_BUFFER_MIN;
+
+    if (!ringbuf_init(&ctx->in_buf, in_buf_size)) {
+        slab_free(ctx->cmd_buf);
+        return false;
+    }
+
+    if (!ringbuf_init(&ctx->out_buf, CLIENT_OUTPUT_BUFFER_SIZE)) {
+        ringbuf_cleanup(&ctx->in_buf);
+        slab_free(ctx->cmd_buf);
+        return false;
+    }
+
+    pthread_mutex_init(&ctx->out_lock, NULL);
 
-    ctx->cmd_watcher = NULL; // will point to some uev_t in server_ctx->client_data_watchers list
+    ctx->in_discard = false;
+    ctx->cmd_events = 0;
+    ctx->busy = false;
+    ctx->eof = false;
+    ctx->closing = false;
+    ctx->notify_next = NULL;
+    ctx->notify_events = 0;
+    ctx->notify_pending = 0;
+
+    ctx->cmd_watcher = NULL; // will point to its uev_t in server_ctx->sessions
 
     /* SERVER CONTEXT */
 
@@ -58,29 +90,60 @@ bool client_ctx_init(mftp_client_ctx_t* ctx, int cmd_fd, mftp_server_ctx_t* serv
     ctx->authenticated = true;
     ctx->creds = (passwd_entry_t) { .username = "anon", .password = "", .perms = PERM_LIST | PERM_READ | PERM_WRITE | PERM_DELETE };
 
-    if (!server_ctx->cfg.flags.allow_anonymous) ctx->authenticated = false;
+    if (!cfg->flags.allow_anonymous) ctx->authenticated = false;
+
+    ctx->login_failed = false;
+    ctx->login_delay_watcher = NULL;
+
+    rate_bucket_init(&ctx->rate_session, cfg->session_rate_limit, cfg->session_rate_burst);
 
     /* DATA CHANNEL CONTEXT */
 
     ctx->t_fd_in = ctx->t_fd_out = -1;
+    ctx->t_listen = (socket_t) { .fd = -1 };
+    ctx->t_listen_leased = false;
     ctx->t_kind = MFTP_CMD_INVALID;
     ctx->t_watcher = NULL;
     ctx->t_timeout_watcher = NULL;
+    ctx->t_upload = NULL;
+    ctx->t_uring = NULL;
+    ctx->t_event = NULL;
+    ctx->t_rate = (rate_chain_t) { 0 };
     ctx->t_active = false;
+    ctx->t_threads = 0;
+    ctx->t_slot = false;
+    ctx->t_block_mode = false;
+    ctx->t_data_fd = -1;
+    ctx->t_offset = 0;
 
     client_ctx_cleanup_transfer(ctx);
 
     return true;
 }
 
-void client_ctx_cleanup_transfer(mftp_client_ctx_t* ctx) {
-    if (ctx->locked) return;
-    ctx->locked = true;
-
+// releases everything transfer holds, no matter who holds ctx->locked
+static void transfer_teardown(mftp_client_ctx_t* ctx) {
     ctx->t_kind = MFTP_CMD_INVALID;
+    ctx->t_limit = UINT64_MAX;
+    if (ctx->t_upload) upload_release(ctx->server_ctx->uploads, ctx->t_upload);
+    ctx->t_upload = NULL;
+    ctx->t_upload_offset = 0;
+
+    // ring stops touching ctx and its descriptors before they're closed
+    if (ctx->t_uring) uring_transfer_detach(ctx->t_uring);
+    ctx->t_uring = NULL;
+    if (ctx->t_event) evtransfer_stop(ctx->t_event);
+    ctx->t_event = NULL;
+
+    if (ctx->t_rate.flow) fair_flow_leave(ctx->t_rate.flow);
+    ctx->t_rate = (rate_chain_t) { 0 };
+
+    if (ctx->t_slot) admission_slot_release(ctx->server_ctx->transfers_total);
+    ctx->t_slot = false;
     
-    if (ctx->t_fd_in >= 0) close(ctx->t_fd_in);
-    if (ctx->t_fd_out >= 0) close(ctx->t_fd_out);
+    // persistent data connection stays open for next transfer
+    if (ctx->t_fd_in >= 0 && ctx->t_fd_in != ctx->t_data_fd) close(ctx->t_fd_in);
+    if (ctx->t_fd_out >= 0 && ctx->t_fd_out != ctx->t_data_fd) close(ctx->t_fd_out);
     
     ctx->t_fd_in = ctx->t_fd_out = -1;
     
@@ -89,23 +152,71 @@ void client_ctx_cleanup_transfer(mftp_client_ctx_t* ctx) {
     
     if (ctx->t_watcher) {
         uev_io_stop(ctx->t_watcher);
-        free(ctx->t_watcher);
+        slab_free(ctx->t_watcher);
     }
     ctx->t_watcher = NULL;
     if (ctx->t_timeout_watcher) {
         uev_timer_stop(ctx->t_timeout_watcher);
-        free(ctx->t_timeout_watcher);
+        slab_free(ctx->t_timeout_watcher);
     }
     ctx->t_timeout_watcher = NULL;
 
+    if (ctx->t_listen.fd >= 0) {
+        if (ctx->t_listen_leased) {
+            data_port_release(ctx->server_ctx->data_ports, &ctx->t_listen);
+        } else {
+            socket_cleanup(&ctx->t_listen);
+        }
+    }
+    ctx->t_listen = (socket_t) { .fd = -1 };
+    ctx->t_listen_leased = false;
+    ctx->t_arm_pending = false;
+}
+
+void client_ctx_cleanup_transfer(mftp_client_ctx_t* ctx) {
+    if (ctx->locked) return;
+    ctx->locked = true;
+
+    transfer_teardown(ctx);
+
     ctx->locked = false;
 }
 
+void client_ctx_drop_data_conn(mftp_client_ctx_t* ctx) {
+    if (ctx->t_data_fd < 0) return;
+
+    // transfer thread may still be blocked on it
+    shutdown(ctx->t_data_fd, SHUT_RDWR);
+    close(ctx->t_data_fd);
+
+    if (ctx->t_fd_in == ctx->t_data_fd) ctx->t_fd_in = -1;
+    if (ctx->t_fd_out == ctx->t_data_fd) ctx->t_fd_out = -1;
+    ctx->t_data_fd = -1;
+}
+
 void client_ctx_cleanup_full(mftp_client_ctx_t* ctx) {
     if (!ctx || ctx->locked) return;
     ctx->locked = true;
 
-    client_ctx_cleanup_transfer(ctx);
+    // lease, slot, upload reference and watchers must not outlive the session
+    client_ctx_drop_data_conn(ctx);
+    transfer_teardown(ctx);
+
+    if (ctx->login_delay_watcher) {
+        uev_timer_stop(ctx->login_delay_watcher);
+        slab_free(ctx->login_delay_watcher);
+    }
+
+    // reactor must not see this ctx again
+    mftp_server_ctx_t* server_ctx = ctx->server_ctx;
+    pthread_mutex_lock(&server_ctx->notify_lock);
+    for (mftp_client_ctx_t** link = &server_ctx->notify_head; *link != NULL; link = &(*link)->notify_next) {
+        if (*link == ctx) {
+            *link = ctx->notify_next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&server_ctx->notify_lock);
 
     if (ctx->cmd_fd >= 0) {
         shutdown(ctx->cmd_fd, SHUT_RDWR);
@@ -113,21 +224,86 @@ void client_ctx_cleanup_full(mftp_client_ctx_t* ctx) {
     }
 
     if (ctx->cmd_buf) {
-        free(ctx->cmd_buf);
+        slab_free(ctx->cmd_buf);
+    }
+
+    ringbuf_cleanup(&ctx->in_buf);
+    ringbuf_cleanup(&ctx->out_buf);
+    pthread_mutex_destroy(&ctx->out_lock);
+    rate_bucket_cleanup(&ctx->rate_session);
+
+    slab_free(ctx);
+}
+
+void client_ctx_notify(mftp_client_ctx_t* ctx, int events) {
+    mftp_server_ctx_t* server_ctx = ctx->server_ctx;
+
+    pthread_mutex_lock(&server_ctx->notify_lock);
+    if (ctx->notify_events == 0) {
+        ctx->notify_next = server_ctx->notify_head;
+        server_ctx->notify_head = ctx;
+    }
+    ctx->notify_events |= events;
+    if (events & CLIENT_NOTIFY_THREAD_EXIT) ctx->t_threads--;
+    pthread_mutex_unlock(&server_ctx->notify_lock);
+
+    uev_event_post(&server_ctx->notify_watcher);
+}
+
+void client_ctx_stop_transfer_thread(mftp_client_ctx_t* ctx) {
+    ctx->t_active = false;
+
+    // unblocks it - descriptors are closed by cleanup once it exits, loop can't tell if it still uses them
+    if (ctx->t_fd_in >= 0) shutdown(ctx->t_fd_in, SHUT_RDWR);
+    if (ctx->t_fd_out >= 0) shutdown(ctx->t_fd_out, SHUT_RDWR);
+}
+
+int client_ctx_transfer_threads(mftp_client_ctx_t* ctx) {
+    pthread_mutex_lock(&ctx->server_ctx->notify_lock);
+    int threads = ctx->t_threads;
+    pthread_mutex_unlock(&ctx->server_ctx->notify_lock);
+    return threads;
+}
+
+bool client_ctx_reply(mftp_client_ctx_t* ctx, const mftp_server_msg_t* msg) {
+    char buf[512];
+    int len = mftp_server_msg_format(buf, sizeof(buf), msg);
+    if (len < 0) {
+        log_syserr("Failed to format server message");
+        return false;
+    }
+
+    pthread_mutex_lock(&ctx->out_lock);
+    bool queued = ringbuf_write(&ctx->out_buf, buf, len);
+    pthread_mutex_unlock(&ctx->out_lock);
+
+    if (!queued) {
+        // client stopped reading replies long ago - don't buffer forever
+        log_warn("[CLIENT %d] Reply queue full - disconnecting", ctx->cmd_fd);
+        ctx->closing = true;
+        return false;
     }
 
-    free(ctx);
+    return true;
 }
 
 void mftp_server_cleanup_full(mftp_server_ctx_t* server_ctx) {
-    list_iter_t iter = list_iter(&server_ctx->client_data_watchers);
-    uev_t* w;
+    // detached transfer threads may still use their sessions - make them all give up, then wait until each reported
+    // CLIENT_NOTIFY_THREAD_EXIT. They only post to the loop on their way out, it doesn't have to run meanwhile.
+    for (size_t i = 0; i < server_ctx->sessions.count; i++) {
+        mftp_client_ctx_t* ctx = (mftp_client_ctx_t*)session_table_at(&server_ctx->sessions, i)->arg;
+        if (client_ctx_transfer_threads(ctx) > 0) client_ctx_stop_transfer_thread(ctx);
+    }
+    for (size_t i = 0; i < server_ctx->sessions.count; i++) {
+        mftp_client_ctx_t* ctx = (mftp_client_ctx_t*)session_table_at(&server_ctx->sessions, i)->arg;
+        while (client_ctx_transfer_threads(ctx) > 0) usleep(SERVER_STOP_POLL_US);
+    }
 
-    while ((w = list_next(&iter)) != NULL) {
-        mftp_server_remove_client_data_watcher(server_ctx, w);
+    while (server_ctx->sessions.count > 0) {
+        mftp_server_remove_client_data_watcher(server_ctx, session_table_at(&server_ctx->sessions, server_ctx->sessions.count - 1));
     }
 
-    list_clear(&server_ctx->client_data_watchers);
+    session_table_cleanup(&server_ctx->sessions);
 
     if (server_ctx->fd >= 0) {
         shutdown(server_ctx->fd, SHUT_RDWR);
@@ -4,41 +4,125 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <pthread.h>
+#include <limits.h>
+#include <sys/types.h>
 
 #include <uev.h>
 
-#include "shared/list.h"
 #include "shared/passwd.h"
+#include "shared/ringbuf.h"
+#include "shared/cmd.h"
+#include "shared/socket.h"
+#include "server/ratelimit.h"
+#include "server/admission.h"
+#include "server/session.h"
+#include "server/credstore.h"
 
 typedef struct {
     struct {
         uint32_t allow_anonymous: 1;
+        uint32_t event_transfers: 1; // data channels without a thread of their own run on client's loop
+        uint32_t fair_share: 1;      // users with transfers in progress split bandwidth by their weights
     } flags;
     uint16_t port;
     const char *root_dir;
     uint16_t max_clients;
+    uint32_t max_transfers; // open data channels across all sessions, 0 - unlimited
+    uint32_t admission_queue_size; // connections waiting for a client slot, per reactor
+    uint32_t admission_timeout_ms; // how long they wait before they're turned away
+    uint32_t busy_retry_after; // seconds - hint sent with BUSY replies
+    uint32_t accept_budget; // connections accepted per listener wakeup
     size_t max_cmd_size;
     uint32_t timeout_ms;
+    uint16_t workers;
+    uint32_t work_queue_size;
+    uint16_t reactors; // 0 - one per online CPU
+    uint16_t pasv_port_min, pasv_port_max; // pre-bound data channel ports, 0 - ephemeral port per transfer
+    uint16_t uring_rings; // io_uring transfer threads (data copied through ring buffers), 0 - zero-copy paths
+    uint64_t rate_limit, rate_burst; // bytes per second across all transfers (0 - unlimited) and its burst
+    uint64_t session_rate_limit, session_rate_burst; // same, for every session on its own
 } mftp_server_cfg_t;
 
+struct worker_pool;
+struct data_port_pool;
+struct upload_registry;
+struct upload;
+struct uring_engine;
+struct uring_xfer;
+struct evtransfer;
+struct mftp_client_ctx;
+
+// One per reactor thread - everything here, except for the shared pointers, is owned by that reactor's loop.
 typedef struct {
+    int id;
     uev_ctx_t* loop;
-    mftp_server_cfg_t cfg;
-    int fd;
-    passwd_t creds;
-    list_t client_data_watchers;
+    const mftp_server_cfg_t* cfg; // snapshot in effect, swapped by reload - read with mftp_server_cfg()
+    int fd; // this reactor's SO_REUSEPORT listener
+    cred_store_t* creds;         // user accounts, shared - reloaded on SIGHUP
+    session_table_t sessions;    // command watchers of this reactor's clients, by fd
+    struct worker_pool* workers; // runs command handlers off the event loop, shared
+    size_t* clients_total;       // connected clients across all reactors, shared - use __atomic builtins
+    size_t* transfers_total;     // data channels open across all reactors, shared - use __atomic builtins
+    admission_queue_t admission; // connections waiting for a client slot
+
+    struct {
+        size_t wakeups, accepted;
+        size_t budget_spent;    // wakeups that ran out of accept budget
+        uint32_t queue_peak;    // longest accept queue seen (sampled when budget ran out)
+    } accept_stats;
+    struct data_port_pool* data_ports; // shared, NULL if no passive port range is configured
+    struct upload_registry* uploads; // segmented uploads in progress, shared
+    struct uring_engine* uring;  // shared, NULL if transfers run on their own threads
+    rate_bucket_t* rate_global;  // shared, NULL if there is no global rate limit
+    rate_user_registry_t* rate_users; // per-user buckets, shared
+    fair_sched_t* fair;          // shared, NULL if fair share scheduling is off
+
+    // clients with something for this loop to do (see CLIENT_NOTIFY_*) - pushed by other threads, drained by notify_watcher
+    uev_t notify_watcher;
+    pthread_mutex_t notify_lock;
+    struct mftp_client_ctx* notify_head;
 } mftp_server_ctx_t;
 
+// any thread - config snapshots are immutable and stay valid until shutdown, so it can be kept for as long as needed
+const mftp_server_cfg_t* mftp_server_cfg(const mftp_server_ctx_t* server_ctx);
 void mftp_server_remove_client_data_watcher(mftp_server_ctx_t* server_ctx, uev_t* watcher);
+// frees all sessions once their transfer threads are gone - stops them first and waits for them
 void mftp_server_cleanup_full(mftp_server_ctx_t* server_ctx);
 
-typedef struct {
+// smallest command channel input buffer
+#define CLIENT_INPUT_BUFFER_MIN 4096
+// queued replies - client that lets this fill up is disconnected
+#define CLIENT_OUTPUT_BUFFER_SIZE (16 * 1024)
+// stop running client's commands while this many reply bytes wait for it to read
+#define CLIENT_OUTPUT_HIGH_WATERMARK (8 * 1024)
+// failed login is answered this late - slows down password guessing without holding a worker
+#define CLIENT_LOGIN_DELAY_MS 1000
+
+enum {
+    CLIENT_NOTIFY_DONE = 1,     // offloaded command handler returned
+    CLIENT_NOTIFY_FLUSH = 2,    // replies were queued outside of the loop
+    CLIENT_NOTIFY_TRANSFER = 4, // io_uring transfer finished - result waits in t_uring
+    CLIENT_NOTIFY_THREAD_EXIT = 8, // transfer thread finished - result waits in t_thread_ok, thread won't touch ctx anymore
+};
+
+typedef struct mftp_client_ctx {
     // command channel context:
     int cmd_fd;
-    char* cmd_buf;  // always cfg.max_cmd_size bytes long
-    size_t cmd_buf_len;
-    pthread_t cmd_tid;
+    ringbuf_t in_buf;   // raw bytes received on command channel, may hold several pipelined commands
+    bool in_discard;    // skipping rest of an overlong line
+    char* cmd_buf;      // cfg->max_cmd_size + 1 bytes - current command line, NUL terminated
     uev_t* cmd_watcher;
+    int cmd_events;     // UEV_READ/UEV_WRITE currently requested on cmd_watcher, 0 if stopped
+    bool busy;          // command handed to worker pool - following commands wait until it's done
+    bool eof;           // peer closed its side - disconnect once buffered commands are done
+    bool closing;       // disconnect requested (QUIT, reply overflow)
+
+    ringbuf_t out_buf;  // formatted replies not yet written, flushed with writev by the loop
+    pthread_mutex_t out_lock;
+
+    struct mftp_client_ctx* notify_next; // link in server_ctx->notify_head
+    int notify_events;  // CLIENT_NOTIFY_* pending, guarded by server_ctx->notify_lock
+    int notify_pending; // notify_events being handled by the loop right now
 
     // server context:
     mftp_server_ctx_t *server_ctx;
@@ -46,22 +130,53 @@ typedef struct {
     // authentication:
     bool authenticated;
     passwd_entry_t creds;
+    bool login_failed;          // PASS handler rejected credentials - loop answers once CLIENT_LOGIN_DELAY_MS pass
+    uev_t* login_delay_watcher; // one-shot timer holding that answer back, client stays busy meanwhile
+
+    rate_bucket_t rate_session; // only used if cfg->session_rate_limit is set
 
     // transfer channel context:
-    int t_kind;  // transfer kind - MFTP_CMD_RETR, MFTP_CMD_STOR or MFTP_CMD_LIST
+    int t_kind;  // transfer kind - MFTP_CMD_RETR, MFTP_CMD_STOR, MFTP_CMD_SEGM or MFTP_CMD_LIST
     int t_fd_in, t_fd_out;
+    socket_t t_listen;      // passive listener waiting for data connection
+    bool t_listen_leased;   // t_listen belongs to server_ctx->data_ports
+    bool t_arm_pending;     // t_listen is ready, but its watchers still have to be started on client's loop
     bool t_active;
+    bool t_slot;            // holds one of cfg->max_transfers
+    bool t_block_mode;      // MODE BLOCK - transfers are framed and data connection outlives them
+    int t_data_fd;          // data connection kept open in block mode, -1 if none
+    off_t t_offset;         // set by REST - where next RETR/STOR starts in the file
+    uint64_t t_limit;       // bytes RETR/RANG sends at most (SEGM receives exactly), UINT64_MAX - up to end of file
+    struct upload* t_upload;    // SEGM - upload the segment belongs to (holds a reference)
+    uint64_t t_upload_offset;   // SEGM - where in the file the segment starts
     pthread_t t_tid;
+    int t_threads;          // transfer threads still using ctx, guarded by server_ctx->notify_lock
+    bool t_thread_ok;       // transfer thread's result, set before it reports CLIENT_NOTIFY_THREAD_EXIT
+    struct uring_xfer* t_uring; // transfer runs on an io_uring thread instead of t_tid
+    struct evtransfer* t_event; // transfer runs on client's loop instead of t_tid
+    rate_chain_t t_rate;        // buckets paying for transfer's file data, empty - not shaped
     uev_t* t_watcher;
     uev_t* t_timeout_watcher;
 
     // general state:
-    char cwd[PATH_MAX]; // relative to server_ctx->cfg.root_dir
+    char cwd[PATH_MAX]; // relative to server_ctx->cfg->root_dir
     bool locked; // some process is already using this context (it may be cleaned up) - abort whatever you want to do.
 } mftp_client_ctx_t;
 
 bool client_ctx_init(mftp_client_ctx_t* ctx, int cmd_fd, mftp_server_ctx_t* server_ctx);
 void client_ctx_cleanup_transfer(mftp_client_ctx_t* ctx);
+// closes block mode data connection - after failed/aborted transfer its framing can't be trusted
+void client_ctx_drop_data_conn(mftp_client_ctx_t* ctx);
 void client_ctx_cleanup_full(mftp_client_ctx_t* ctx);
+// any thread - wakes ctx's reactor to handle CLIENT_NOTIFY_* events
+void client_ctx_notify(mftp_client_ctx_t* ctx, int events);
+// client's loop - makes running transfer thread give up. Once it reports CLIENT_NOTIFY_THREAD_EXIT, the loop cleans up
+// the transfer and replies that it was aborted.
+void client_ctx_stop_transfer_thread(mftp_client_ctx_t* ctx);
+// transfer threads that didn't report CLIENT_NOTIFY_THREAD_EXIT yet - ctx can't be freed while there are any
+int client_ctx_transfer_threads(mftp_client_ctx_t* ctx);
+// any thread - queues reply on command channel. It's written once ctx's reactor flushes it - threads other than
+// the reactor's own should follow up with client_ctx_notify(ctx, CLIENT_NOTIFY_FLUSH) unless a DONE notification follows.
+bool client_ctx_reply(mftp_client_ctx_t* ctx, const mftp_server_msg_t* msg);
 
 #endif
@@ -0,0 +1,103 @@
+#include "dataport.h"
+
+#include <stdlib.h>
+
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "shared/utils.h"
+
+// backlog of pooled listeners - only the leasing client is expected to connect
+#define DATA_PORT_BACKLOG 4
+
+bool data_port_pool_init(data_port_pool_t* pool, uint16_t min_port, uint16_t max_port) {
+    *pool = (data_port_pool_t) { 0 };
+
+    if (min_port == 0 || max_port < min_port) {
+        log_err("Invalid passive port range %d-%d", min_port, max_port);
+        return false;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+
+    pool->count = (size_t)max_port - min_port + 1;
+    pool->min_port = min_port;
+    pool->ports = calloc(pool->count, sizeof(data_port_t));
+    if (pool->ports == NULL) {
+        log_syserr("Failed to allocate memory for data port pool");
+        pthread_mutex_destroy(&pool->lock);
+        return false;
+    }
+
+    for (size_t i = 0; i < pool->count; i++) {
+        data_port_t* port = &pool->ports[i];
+
+        if (!socket_bind_tcp(&port->socket, INADDR_ANY, (uint16_t)(min_port + i))) {
+            log_err("Failed to bind passive port %zu", min_port + i);
+            pool->count = i;
+            data_port_pool_cleanup(pool);
+            return false;
+        }
+
+        // non-blocking so release can drain backlog and a raced accept never stalls the loop
+        if (!socket_set_nonblocking(&port->socket, true) || listen(port->socket.fd, DATA_PORT_BACKLOG) < 0) {
+            log_syserr("Failed to listen on passive port %zu", min_port + i);
+            socket_cleanup(&port->socket);
+            pool->count = i;
+            data_port_pool_cleanup(pool);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void data_port_pool_cleanup(data_port_pool_t* pool) {
+    if (pool->ports == NULL) return;
+
+    for (size_t i = 0; i < pool->count; i++) {
+        socket_cleanup(&pool->ports[i].socket);
+    }
+
+    free(pool->ports);
+    pool->ports = NULL;
+    pool->count = 0;
+
+    pthread_mutex_destroy(&pool->lock);
+}
+
+bool data_port_lease(data_port_pool_t* pool, socket_t* out_socket) {
+    pthread_mutex_lock(&pool->lock);
+
+    for (size_t n = 0; n < pool->count; n++) {
+        size_t i = (pool->next + n) % pool->count;
+        if (pool->ports[i].leased) continue;
+
+        pool->ports[i].leased = true;
+        pool->next = (i + 1) % pool->count;
+        *out_socket = pool->ports[i].socket;
+
+        pthread_mutex_unlock(&pool->lock);
+        return true;
+    }
+
+    pool->exhausted++;
+    pthread_mutex_unlock(&pool->lock);
+    return false;
+}
+
+void data_port_release(data_port_pool_t* pool, const socket_t* socket) {
+    size_t i = socket->hport - pool->min_port;
+    if (socket->hport < pool->min_port || i >= pool->count) return;
+
+    // stale connection left in backlog would otherwise be handed to next session
+    int stale_fd;
+    while ((stale_fd = accept(socket->fd, NULL, NULL)) >= 0) {
+        close(stale_fd);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->ports[i].leased = false;
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,37 @@
+#ifndef _MFTP_SERVER_DATAPORT_H_
+#define _MFTP_SERVER_DATAPORT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "shared/socket.h"
+
+// Passive data port range. Listeners are bound once at startup and leased to one session at a time,
+// so opening data channel costs no socket/bind/listen syscalls and firewall rules can name exact ports.
+
+typedef struct {
+    socket_t socket;
+    bool leased;
+} data_port_t;
+
+typedef struct data_port_pool {
+    data_port_t* ports;     // ports[i] listens on min_port + i
+    size_t count;
+    uint16_t min_port;
+    size_t next;            // where next lease starts searching - spreads reuse over whole range
+
+    pthread_mutex_t lock;
+    size_t exhausted;       // leases refused because every port was taken
+} data_port_pool_t;
+
+bool data_port_pool_init(data_port_pool_t* pool, uint16_t min_port, uint16_t max_port);
+void data_port_pool_cleanup(data_port_pool_t* pool);
+
+// hands out a listening socket, false if all ports are leased
+bool data_port_lease(data_port_pool_t* pool, socket_t* out_socket);
+// returns socket to pool, dropping any connections still waiting in its backlog
+void data_port_release(data_port_pool_t* pool, const socket_t* socket);
+
+#endif
@@ -0,0 +1,375 @@
+#include "evtransfer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <arpa/inet.h>
+
+#include "shared/utils.h"
+#include "shared/socket.h"
+#include "server/handlers.h"
+#include "server/transfer.h"
+
+#define BLOCK_HEADER_SIZE 4
+// room kept for one more listing line
+#define LIST_LINE_MAX 512
+
+typedef struct evtransfer {
+    mftp_client_ctx_t* ctx;
+    uev_t watcher;
+    bool watching;
+    uev_t throttle;     // rate limited - watcher is stopped until this fires
+    bool throttle_on;
+
+    bool sending;       // RETR/RANG/LIST, otherwise STOR/SEGM
+    bool zero_copy;     // stream mode RETR - sendfile(2) straight from file
+    bool exact;         // receive has to fill `left` exactly (SEGM)
+    int file_fd, sock_fd;   // ctx's descriptors, closed by its cleanup
+    DIR* dir;           // LIST - over own dup of ctx->t_fd_in
+
+    char* buf;          // EVTRANSFER_BUFFER_SIZE bytes
+    size_t len, off;    // sending - bytes staged in buf and how many of them went out
+    bool last;          // staged bytes end the transfer
+    uint64_t left;      // bytes still to move, UINT64_MAX - until EOF
+
+    unsigned char header[BLOCK_HEADER_SIZE];
+    size_t header_have;
+    uint64_t block_left;
+} evtransfer_t;
+
+static size_t budget_take(size_t budget, size_t moved) {
+    return moved < budget ? budget - moved : 0;
+}
+
+static bool write_all(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        buf += written;
+        len -= written;
+    }
+    return true;
+}
+
+// replies and cleans up - ev is freed once this returns
+static void evtransfer_finish(evtransfer_t* ev, bool ok) {
+    transfer_complete(ev->ctx, ok);
+}
+
+static void throttle_callback(uev_t* w, void* arg, int events) {
+    evtransfer_t* ev = (evtransfer_t*)arg;
+
+    if (events & UEV_ERROR) {
+        log_err("Error on transfer throttle timer");
+        evtransfer_finish(ev, false);
+        return;
+    }
+
+    uev_io_start(&ev->watcher);
+}
+
+// bandwidth for up to want bytes of file data. 0 - rate limit or fair share holds it back, watcher sleeps
+// until it may go on.
+static size_t shape_take(evtransfer_t* ev, size_t want) {
+    if (rate_chain_empty(&ev->ctx->t_rate)) return want;
+
+    uint64_t wait_ns;
+    size_t granted = rate_chain_take(&ev->ctx->t_rate, want, &wait_ns);
+    if (granted > 0) return granted;
+
+    int wait_ms = (int)(wait_ns / 1000000) + 1;
+    uev_io_stop(&ev->watcher);
+
+    if (ev->throttle_on) {
+        uev_timer_set(&ev->throttle, wait_ms, 0);
+    } else if (uev_timer_init(ev->ctx->server_ctx->loop, &ev->throttle, throttle_callback, ev, wait_ms, 0) == 0) {
+        ev->throttle_on = true;
+    } else {
+        log_syserr("Failed to start transfer throttle timer");
+        uev_io_start(&ev->watcher); // go on unshaped rather than stall
+    }
+
+    return 0;
+}
+
+static void shape_refund(evtransfer_t* ev, size_t granted, ssize_t used) {
+    if (used < 0) used = 0;
+    if ((size_t)used < granted) rate_chain_refund(&ev->ctx->t_rate, granted - used);
+}
+
+// stages next piece of data in buf (at most allowed bytes of file) - framed as one block in block mode, end marker
+// once there's nothing left
+static bool send_fill(evtransfer_t* ev, size_t allowed) {
+    size_t header = ev->ctx->t_block_mode ? BLOCK_HEADER_SIZE : 0;
+    size_t len = 0;
+
+    if (ev->dir != NULL) {
+        struct dirent* entry;
+        while (header + len + LIST_LINE_MAX <= EVTRANSFER_BUFFER_SIZE && (entry = readdir(ev->dir)) != NULL) {
+            len += transfer_format_entry(ev->buf + header + len, EVTRANSFER_BUFFER_SIZE - header - len, entry);
+        }
+    } else if (ev->left > 0) {
+        size_t want = EVTRANSFER_BUFFER_SIZE - header;
+        if (ev->left < want) want = ev->left;
+        if (allowed < want) want = allowed;
+
+        ssize_t got;
+        while ((got = read(ev->file_fd, ev->buf + header, want)) < 0 && errno == EINTR);
+        shape_refund(ev, want, got);
+        if (got < 0) {
+            log_syserr("Failed to read from file");
+            return false;
+        }
+
+        len = got;
+        ev->left -= got;
+    }
+
+    if (header > 0) {
+        uint32_t block_len = htonl((uint32_t)len);
+        memcpy(ev->buf, &block_len, sizeof(block_len));
+    }
+
+    ev->len = header + len;
+    ev->off = 0;
+    ev->last = len == 0;
+    return true;
+}
+
+static void send_callback(uev_t* w, void* arg, int events) {
+    evtransfer_t* ev = (evtransfer_t*)arg;
+
+    if (events & UEV_ERROR) {
+        log_err("Error on data channel");
+        evtransfer_finish(ev, false);
+        return;
+    }
+
+    size_t budget = EVTRANSFER_EVENT_BUDGET;
+
+    while (budget > 0) {
+        if (ev->off < ev->len) {
+            ssize_t sent = send(ev->sock_fd, ev->buf + ev->off, ev->len - ev->off, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (sent < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+                log_syserr("Failed to send data");
+                evtransfer_finish(ev, false);
+                return;
+            }
+
+            ev->off += sent;
+            budget = budget_take(budget, sent);
+            continue;
+        }
+
+        if (ev->last) {
+            evtransfer_finish(ev, true);
+            return;
+        }
+
+        if (ev->zero_copy) {
+            if (ev->left == 0) {
+                evtransfer_finish(ev, true);
+                return;
+            }
+
+            size_t want = ev->left < budget ? ev->left : budget;
+            if ((want = shape_take(ev, want)) == 0) return;
+
+            ssize_t sent = sendfile(ev->sock_fd, ev->file_fd, NULL, want);
+            shape_refund(ev, want, sent);
+            if (sent < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+                if (errno == EINVAL || errno == ENOSYS) {
+                    // fd types don't allow zero-copy - stage through buffer instead
+                    ev->zero_copy = false;
+                    continue;
+                }
+                log_syserr("Failed to send file");
+                evtransfer_finish(ev, false);
+                return;
+            }
+
+            if (sent == 0) {
+                evtransfer_finish(ev, true); // end of file
+                return;
+            }
+
+            ev->left -= sent;
+            budget = budget_take(budget, sent);
+            continue;
+        }
+
+        size_t allowed = EVTRANSFER_BUFFER_SIZE;
+        if (ev->dir == NULL && ev->left > 0 && (allowed = shape_take(ev, allowed)) == 0) return;
+
+        if (!send_fill(ev, allowed)) {
+            evtransfer_finish(ev, false);
+            return;
+        }
+    }
+}
+
+static void recv_callback(uev_t* w, void* arg, int events) {
+    evtransfer_t* ev = (evtransfer_t*)arg;
+    bool block_mode = ev->ctx->t_block_mode;
+
+    if (events & UEV_ERROR) {
+        log_err("Error on data channel");
+        evtransfer_finish(ev, false);
+        return;
+    }
+
+    size_t budget = EVTRANSFER_EVENT_BUDGET;
+
+    while (budget > 0) {
+        if (block_mode && ev->header_have < BLOCK_HEADER_SIZE) {
+            // exact size - bytes after end marker belong to the next transfer
+            ssize_t got = recv(ev->sock_fd, ev->header + ev->header_have, BLOCK_HEADER_SIZE - ev->header_have, MSG_DONTWAIT);
+            if (got < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+                log_syserr("Failed to read from data channel");
+                evtransfer_finish(ev, false);
+                return;
+            }
+            if (got == 0) {
+                log_err("Data channel closed inside block transfer");
+                evtransfer_finish(ev, false);
+                return;
+            }
+
+            ev->header_have += got;
+            if (ev->header_have < BLOCK_HEADER_SIZE) continue;
+
+            uint32_t len;
+            memcpy(&len, ev->header, sizeof(len));
+            ev->block_left = ntohl(len);
+
+            if (ev->block_left == 0) {
+                if (ev->exact && ev->left > 0) log_err("End of transfer before end of segment");
+                evtransfer_finish(ev, !(ev->exact && ev->left > 0));
+                return;
+            }
+            if (ev->block_left > ev->left) {
+                log_err("Block goes past end of segment");
+                evtransfer_finish(ev, false);
+                return;
+            }
+            continue;
+        }
+
+        uint64_t want = block_mode ? ev->block_left : ev->left;
+        if (want == 0) {
+            evtransfer_finish(ev, true); // stream mode segment is complete
+            return;
+        }
+        if (want > EVTRANSFER_BUFFER_SIZE) want = EVTRANSFER_BUFFER_SIZE;
+        if ((want = shape_take(ev, want)) == 0) return;
+
+        ssize_t got = recv(ev->sock_fd, ev->buf, want, MSG_DONTWAIT);
+        shape_refund(ev, want, got);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            log_syserr("Failed to read from data channel");
+            evtransfer_finish(ev, false);
+            return;
+        }
+        if (got == 0) {
+            bool ok = !block_mode && !(ev->exact && ev->left > 0);
+            if (!ok) log_err("Data channel closed before end of transfer");
+            evtransfer_finish(ev, ok);
+            return;
+        }
+
+        if (!write_all(ev->file_fd, ev->buf, got)) {
+            log_syserr("Failed to write to file");
+            evtransfer_finish(ev, false);
+            return;
+        }
+
+        ev->left -= got;
+        if (block_mode) {
+            ev->block_left -= got;
+            if (ev->block_left == 0) ev->header_have = 0;
+        }
+        budget = budget_take(budget, got);
+    }
+}
+
+bool evtransfer_start(mftp_client_ctx_t* ctx) {
+    evtransfer_t* ev = calloc(1, sizeof(evtransfer_t));
+    if (ev == NULL) return false;
+
+    ev->ctx = ctx;
+    ev->file_fd = ev->sock_fd = -1;
+    ev->left = ctx->t_limit;
+
+    switch (ctx->t_kind) {
+    case MFTP_CMD_LIST: {
+        // closedir() closes its descriptor - ctx's one is closed by cleanup
+        int dir_fd = dup(ctx->t_fd_in);
+        ev->dir = dir_fd >= 0 ? fdopendir(dir_fd) : NULL;
+        if (ev->dir == NULL) {
+            log_syserr("Failed to open directory for listing");
+            if (dir_fd >= 0) close(dir_fd);
+            free(ev);
+            return false;
+        }
+        ev->sending = true;
+        ev->sock_fd = ctx->t_fd_out;
+    } break;
+    case MFTP_CMD_RETR:
+        ev->sending = true;
+        ev->zero_copy = !ctx->t_block_mode;
+        ev->file_fd = ctx->t_fd_in;
+        ev->sock_fd = ctx->t_fd_out;
+        break;
+    case MFTP_CMD_STOR:
+    case MFTP_CMD_SEGM:
+        ev->exact = ctx->t_limit != UINT64_MAX;
+        ev->file_fd = ctx->t_fd_out;
+        ev->sock_fd = ctx->t_fd_in;
+        break;
+    default:
+        free(ev);
+        return false;
+    }
+
+    ev->buf = malloc(EVTRANSFER_BUFFER_SIZE);
+    if (ev->buf == NULL || !socket_set_nonblocking(&(socket_t) { .fd = ev->sock_fd }, true)) {
+        evtransfer_stop(ev);
+        return false;
+    }
+
+    if (uev_io_init(ctx->server_ctx->loop, &ev->watcher, ev->sending ? send_callback : recv_callback, ev, ev->sock_fd, ev->sending ? UEV_WRITE : UEV_READ) < 0) {
+        log_syserr("Failed to watch data channel");
+        evtransfer_stop(ev);
+        return false;
+    }
+    ev->watching = true;
+
+    ctx->t_active = true;
+    ctx->t_event = ev;
+    return true;
+}
+
+void evtransfer_stop(evtransfer_t* ev) {
+    if (ev->watching) uev_io_stop(&ev->watcher);
+    if (ev->throttle_on) uev_timer_stop(&ev->throttle);
+    if (ev->dir != NULL) closedir(ev->dir);
+    free(ev->buf);
+    free(ev);
+}
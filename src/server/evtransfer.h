@@ -0,0 +1,26 @@
+#ifndef _MFTP_SERVER_EVTRANSFER_H_
+#define _MFTP_SERVER_EVTRANSFER_H_
+
+#include <stdbool.h>
+
+#include "server/ctx.h"
+
+// Event-driven transfers - data socket is made non-blocking and gets a watcher on the client's own loop. Every
+// readiness event moves at most EVTRANSFER_EVENT_BUDGET bytes, so one big transfer can't starve the loop's other
+// clients. Rate limited transfers stop their watcher and sleep on a timer until the buckets refill. No thread is
+// involved - abort and disconnect just stop the watcher.
+
+// bytes moved per readiness event before yielding back to the loop
+#define EVTRANSFER_EVENT_BUDGET (1 << 20)
+// staging buffer for block framing, listings and received data
+#define EVTRANSFER_BUFFER_SIZE (256 * 1024)
+
+struct evtransfer;
+
+// client's loop - starts data channel prepared in ctx (t_kind, t_fd_in, t_fd_out, t_limit). False if it couldn't be
+// set up - caller runs the transfer on a thread instead.
+bool evtransfer_start(mftp_client_ctx_t* ctx);
+// client's loop - stops watcher and frees transfer state, ctx's descriptors are left to the caller
+void evtransfer_stop(struct evtransfer* ev);
+
+#endif
@@ -0,0 +1,156 @@
+#include "fairshare.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shared/utils.h"
+
+#define NS_PER_SEC 1000000000ull
+#define FAIR_SAMPLE_NS NS_PER_SEC
+
+void fair_sched_init(fair_sched_t* sched) {
+    sched->head = NULL;
+    pthread_mutex_init(&sched->lock, NULL);
+}
+
+void fair_sched_cleanup(fair_sched_t* sched) {
+    fair_flow_t* flow = sched->head;
+    while (flow != NULL) {
+        fair_flow_t* next = flow->next;
+        free(flow);
+        flow = next;
+    }
+    sched->head = NULL;
+
+    pthread_mutex_destroy(&sched->lock);
+}
+
+fair_flow_t* fair_flow_join(fair_sched_t* sched, const passwd_entry_t* creds) {
+    pthread_mutex_lock(&sched->lock);
+
+    fair_flow_t* flow;
+    for (flow = sched->head; flow != NULL; flow = flow->next) {
+        if (strcmp(flow->username, creds->username) == 0) break;
+    }
+
+    if (flow == NULL) {
+        flow = calloc(1, sizeof(fair_flow_t));
+        if (flow == NULL) {
+            log_syserr("Failed to allocate memory for fair share flow");
+            pthread_mutex_unlock(&sched->lock);
+            return NULL;
+        }
+
+        strcpy(flow->username, creds->username);
+        flow->sched = sched;
+        flow->next = sched->head;
+        sched->head = flow;
+    }
+
+    if (creds->generation >= flow->generation) {
+        flow->generation = creds->generation;
+        flow->weight = creds->weight > 0 ? creds->weight : FAIR_DEFAULT_WEIGHT;
+        if (flow->weight > FAIR_MAX_WEIGHT) flow->weight = FAIR_MAX_WEIGHT;
+    }
+    flow->active++;
+
+    pthread_mutex_unlock(&sched->lock);
+    return flow;
+}
+
+void fair_flow_leave(fair_flow_t* flow) {
+    pthread_mutex_lock(&flow->sched->lock);
+    flow->active--;
+    pthread_mutex_unlock(&flow->sched->lock);
+}
+
+// lock must be held
+static bool flow_busy(const fair_flow_t* flow, uint64_t now) {
+    return flow->active > 0 && flow->last_ns != 0 && now - flow->last_ns <= FAIR_IDLE_NS;
+}
+
+bool fair_flow_ready(fair_flow_t* flow, uint64_t now_ns, uint64_t* wait_ns) {
+    fair_sched_t* sched = flow->sched;
+    bool ready = true;
+
+    pthread_mutex_lock(&sched->lock);
+
+    // slowest of the other flows that are moving data
+    uint64_t floor = UINT64_MAX;
+    for (fair_flow_t* other = sched->head; other != NULL; other = other->next) {
+        if (other == flow || !flow_busy(other, now_ns)) continue;
+        if (other->vtime < floor) floor = other->vtime;
+    }
+
+    if (floor != UINT64_MAX) {
+        // time spent idle doesn't earn credit
+        if (!flow_busy(flow, now_ns) && flow->vtime + FAIR_WINDOW < floor) flow->vtime = floor - FAIR_WINDOW;
+
+        if (flow->vtime > floor + FAIR_WINDOW) {
+            ready = false;
+            *wait_ns = FAIR_RETRY_NS;
+        }
+    }
+
+    pthread_mutex_unlock(&sched->lock);
+    return ready;
+}
+
+void fair_flow_charge(fair_flow_t* flow, size_t bytes, uint64_t now_ns) {
+    pthread_mutex_lock(&flow->sched->lock);
+
+    flow->vtime += bytes / flow->weight;
+    flow->bytes += bytes;
+    flow->last_ns = now_ns;
+
+    if (flow->sample_ns == 0) flow->sample_ns = now_ns;
+    flow->sample_bytes += bytes;
+    if (now_ns - flow->sample_ns >= FAIR_SAMPLE_NS) {
+        flow->rate = (uint64_t)((unsigned __int128)flow->sample_bytes * NS_PER_SEC / (now_ns - flow->sample_ns));
+        flow->sample_bytes = 0;
+        flow->sample_ns = now_ns;
+    }
+
+    pthread_mutex_unlock(&flow->sched->lock);
+}
+
+void fair_flow_refund(fair_flow_t* flow, size_t unused) {
+    pthread_mutex_lock(&flow->sched->lock);
+
+    uint64_t vunused = unused / flow->weight;
+    flow->vtime = flow->vtime > vunused ? flow->vtime - vunused : 0;
+    flow->bytes = flow->bytes > unused ? flow->bytes - unused : 0;
+    flow->sample_bytes = flow->sample_bytes > unused ? flow->sample_bytes - unused : 0;
+
+    pthread_mutex_unlock(&flow->sched->lock);
+}
+
+void fair_sched_status(fair_sched_t* sched, char* buf, size_t size, uint64_t now_ns) {
+    size_t len = 0;
+    buf[0] = '\0';
+
+    pthread_mutex_lock(&sched->lock);
+
+    uint64_t weights = 0;
+    for (fair_flow_t* flow = sched->head; flow != NULL; flow = flow->next) {
+        if (flow->active > 0) weights += flow->weight;
+    }
+
+    for (fair_flow_t* flow = sched->head; flow != NULL && len < size; flow = flow->next) {
+        if (flow->active == 0) continue;
+
+        // rate of a flow that stopped moving data is stale
+        uint64_t rate = now_ns - flow->sample_ns <= 2 * FAIR_SAMPLE_NS ? flow->rate : 0;
+
+        int n = snprintf(buf + len, size - len, "%s%s weight=%" PRIu32 " transfers=%zu share=%" PRIu64 "%% rate=%" PRIu64,
+            len > 0 ? "; " : "", flow->username, flow->weight, flow->active, flow->weight * 100 / weights, rate);
+        if (n < 0) break;
+        len += (size_t)n;
+    }
+
+    pthread_mutex_unlock(&sched->lock);
+
+    if (len == 0) snprintf(buf, size, "No transfers in progress");
+}
@@ -0,0 +1,63 @@
+#ifndef _MFTP_SERVER_FAIRSHARE_H_
+#define _MFTP_SERVER_FAIRSHARE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "shared/passwd.h"
+
+// Weighted fair sharing of transfer bandwidth between users. Every user is a flow with a weight (from their passwd
+// entry) and a virtual clock that advances by bytes / weight for all data their transfers move. A flow more than
+// FAIR_WINDOW ahead of the slowest busy flow waits for it to catch up - busy users split bandwidth by their weights,
+// no matter how many parallel transfers each of them runs. Flows that stopped moving data (idle, or held back by
+// their own network) stop holding others back after FAIR_IDLE_NS. Anonymous sessions share one flow.
+
+#define FAIR_DEFAULT_WEIGHT 1
+#define FAIR_MAX_WEIGHT 1000
+// how far (in bytes at weight 1) a flow may run ahead of the slowest one
+#define FAIR_WINDOW (4 * 1024 * 1024)
+#define FAIR_IDLE_NS (50 * 1000000ull)
+// how long a flow that's too far ahead sleeps before asking again
+#define FAIR_RETRY_NS (2 * 1000000ull)
+
+struct fair_sched;
+
+typedef struct fair_flow {
+    char username[PASSWD_STRING_SIZE];
+    uint32_t weight;
+    uint32_t generation;    // of passwd entry weight came from
+    uint64_t vtime;         // bytes moved / weight
+    uint64_t last_ns;       // last time data was moved
+    size_t active;          // transfers in progress
+    uint64_t bytes;         // total moved
+    uint64_t rate;          // bytes per second over last sample period
+    uint64_t sample_bytes, sample_ns;
+    struct fair_sched* sched;
+    struct fair_flow* next;
+} fair_flow_t;
+
+typedef struct fair_sched {
+    fair_flow_t* head;      // flows live as long as the scheduler
+    pthread_mutex_t lock;
+} fair_sched_t;
+
+void fair_sched_init(fair_sched_t* sched);
+void fair_sched_cleanup(fair_sched_t* sched);
+
+// flow of user from creds with one more transfer in progress, NULL if out of memory. Weight is taken from creds
+// unless flow already has one from a newer passwd reload.
+fair_flow_t* fair_flow_join(fair_sched_t* sched, const passwd_entry_t* creds);
+void fair_flow_leave(fair_flow_t* flow);
+
+// true if flow may move data now, otherwise *wait_ns says when to ask again
+bool fair_flow_ready(fair_flow_t* flow, uint64_t now_ns, uint64_t* wait_ns);
+void fair_flow_charge(fair_flow_t* flow, size_t bytes, uint64_t now_ns);
+// takes back part of a charge that wasn't used
+void fair_flow_refund(fair_flow_t* flow, size_t unused);
+
+// one line summary of busy flows - user, weight, transfers, fair share and measured rate
+void fair_sched_status(fair_sched_t* sched, char* buf, size_t size, uint64_t now_ns);
+
+#endif
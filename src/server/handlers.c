@@ -2,97 +2,189 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <assert.h>
 
 #include <dirent.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
-#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 
 #include "shared/socket.h"
 #include "shared/utils.h"
+#include "shared/slab.h"
+#include "server/transfer.h"
+#include "server/dataport.h"
+#include "server/upload.h"
+#include "server/uring.h"
+#include "server/evtransfer.h"
+#include "server/ratelimit.h"
+
+void transfer_complete(mftp_client_ctx_t* ctx, bool ok) {
+    if (!ctx->t_active) {
+        // transfer thread stopped by ABOR (or disconnect - then nobody reads the reply)
+        client_ctx_drop_data_conn(ctx);
+        client_ctx_cleanup_transfer(ctx);
 
+        mftp_server_msg_t msg = {
+            .kind = MFTP_MSG_OK,
+            .code = MFTP_CODE_TRANSFER_ABORTED,
+            .data = "Transfer aborted",
+        };
+        client_ctx_reply(ctx, &msg);
+        client_ctx_notify(ctx, CLIENT_NOTIFY_FLUSH);
+        return;
+    }
+
+    upload_status_t status = UPLOAD_INCOMPLETE;
+    if (ok && ctx->t_kind == MFTP_CMD_SEGM) status = upload_segment_done(ctx->server_ctx->uploads, ctx->t_upload, ctx->t_upload_offset, ctx->t_limit);
+
+    mftp_server_msg_t msg = {
+        .kind = MFTP_MSG_OK,
+        .code = MFTP_CODE_CLOSING_DATA_CHANNEL,
+        .data = "Transfer complete",
+    };
+
+    if (!ok) {
+        msg = (mftp_server_msg_t) {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_DATA_CHANNEL_ERROR,
+            .data = "Transfer failed",
+        };
+
+        // peer can't tell where the broken transfer ended - next one needs a fresh connection
+        client_ctx_drop_data_conn(ctx);
+    } else if (ctx->t_kind == MFTP_CMD_SEGM) {
+        switch (status) {
+        case UPLOAD_COMMITTED:
+            strcpy(msg.data, "Transfer complete - upload committed");
+            break;
+        case UPLOAD_INCOMPLETE:
+            snprintf(msg.data, sizeof(msg.data), "Transfer complete - %llu of %llu bytes received",
+                (unsigned long long)upload_received(ctx->server_ctx->uploads, ctx->t_upload), (unsigned long long)ctx->t_upload->size);
+            break;
+        case UPLOAD_FAILED:
+            msg = (mftp_server_msg_t) {
+                .kind = MFTP_MSG_ERR,
+                .code = MFTP_CODE_FS_ACTION_FAILURE,
+                .data = "Failed to commit upload",
+            };
+            break;
+        }
+    }
+
+    // clean up first - command following the reply may already start next transfer
+    client_ctx_cleanup_transfer(ctx);
+
+    client_ctx_reply(ctx, &msg);
+    client_ctx_notify(ctx, CLIENT_NOTIFY_FLUSH);
+}
+
+// only moves data - the loop owns everything else in ctx and completes the transfer once the thread reports back
 void* transfer_thread(void* arg) {
     mftp_client_ctx_t* ctx = (mftp_client_ctx_t*)arg;
-    ctx->t_active = true;
 
     char buffer[512] = { 0 };
+    bool ok = true;
 
     switch (ctx->t_kind) {
     case MFTP_CMD_LIST: {
-        DIR* cwd = fdopendir(ctx->t_fd_in);
+        // closedir() closes its descriptor - ctx's one is closed by cleanup
+        int dir_fd = dup(ctx->t_fd_in);
+        DIR* cwd = dir_fd >= 0 ? fdopendir(dir_fd) : NULL;
+        if (cwd == NULL) {
+            log_syserr("Failed to open directory for listing");
+            if (dir_fd >= 0) close(dir_fd);
+            ok = false;
+            break;
+        }
         struct dirent* entry;
 
         while ((entry = readdir(cwd)) != NULL && ctx->t_active) {
-            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+            size_t len = transfer_format_entry(buffer, sizeof(buffer), entry);
+            if (len == 0) continue;
 
-            char* entry_type;
-            switch (entry->d_type) {
-            case DT_DIR:
-                entry_type = "DIRECTORY";
-                break;
-            case DT_REG:
-                entry_type = "FILE";
-                break;
-            default:
-                entry_type = "OTHER";
+            if (!transfer_send_data(ctx, buffer, len)) {
+                ok = false;
                 break;
             }
-
-            sprintf(buffer, "%s\t%s\r\n", entry_type, entry->d_name);
-            write(ctx->t_fd_out, buffer, strlen(buffer));
         }
 
         closedir(cwd);
+
+        if (ok && ctx->t_active) ok = transfer_finish(ctx);
     } break;
-    // A little bit of code duplication, but I think it's fine the way it is - easier to read and modify if needed.
     case MFTP_CMD_RETR: {
-        FILE* file = fdopen(ctx->t_fd_in, "rb");
-
-        while (ctx->t_active) {
-            size_t bytes_read = fread(buffer, 1, sizeof(buffer), file);
-            if (bytes_read == 0) break;
-            send(ctx->t_fd_out, buffer, bytes_read, 0);
-        }
-
-        fclose(file);
+        ok = transfer_send_file(ctx);
     } break;
-    case MFTP_CMD_STOR: {
-        FILE* file = fdopen(ctx->t_fd_out, "wb");
-
-        while (ctx->t_active) {
-            ssize_t bytes_read = recv(ctx->t_fd_in, buffer, sizeof(buffer), 0);
-            if (bytes_read == 0) break;
-            if (bytes_read < 0) {
-                log_syserr("Failed to read from file");
-                break;
-            }
-            fwrite(buffer, 1, bytes_read, file);
-        }
-
-        fclose(file);
+    case MFTP_CMD_STOR:
+    case MFTP_CMD_SEGM: {
+        ok = transfer_recv_file(ctx);
     } break;
     default:
         assert(false);
         break;
     }
 
-    if (!ctx->t_active) return NULL; // transfer aborted forcefully
-
-    mftp_server_msg_t msg = {
-        .kind = MFTP_MSG_OK,
-        .code = MFTP_CODE_CLOSING_DATA_CHANNEL,
-        .data = "Transfer complete",
-    };
-     mftp_server_msg_write(ctx->cmd_fd, &msg);
+    ctx->t_thread_ok = ok;
 
-    client_ctx_cleanup_transfer(ctx);
+    // last touch - loop completes the transfer and may free ctx right after
+    client_ctx_notify(ctx, CLIENT_NOTIFY_THREAD_EXIT);
     return NULL;
 }
 
+// hands data connection to an io_uring ring, client's loop or a new transfer thread
+static void data_channel_start(mftp_client_ctx_t* ctx, int data_fd) {
+    switch (ctx->t_kind) {
+        case MFTP_CMD_LIST:
+        case MFTP_CMD_RETR:
+            ctx->t_fd_out = data_fd;
+            break;
+        case MFTP_CMD_STOR:
+        case MFTP_CMD_SEGM:
+            ctx->t_fd_in = data_fd;
+            break;
+        default:
+            assert(false);
+            break;
+    }
+
+    // file data pays for bandwidth - session's own bucket first, it's the one most likely to run dry
+    ctx->t_rate = (rate_chain_t) { 0 };
+    if (ctx->t_kind != MFTP_CMD_LIST) {
+        mftp_server_ctx_t* server_ctx = ctx->server_ctx;
+        if (ctx->rate_session.rate > 0) rate_chain_add(&ctx->t_rate, &ctx->rate_session);
+        if (ctx->creds.rate_limit > 0) rate_chain_add(&ctx->t_rate, rate_user_bucket(server_ctx->rate_users, &ctx->creds));
+        rate_chain_add(&ctx->t_rate, server_ctx->rate_global);
+        if (server_ctx->fair) ctx->t_rate.flow = fair_flow_join(server_ctx->fair, &ctx->creds);
+    }
+
+    // directory listing is formatted entry by entry - not worth a ring
+    if (ctx->t_kind != MFTP_CMD_LIST && ctx->server_ctx->uring && uring_transfer_start(ctx->server_ctx->uring, ctx)) return;
+    if (mftp_server_cfg(ctx->server_ctx)->flags.event_transfers && evtransfer_start(ctx)) return;
+
+    // set before the thread runs - ABOR right after accept must find it
+    ctx->t_active = true;
+    pthread_mutex_lock(&ctx->server_ctx->notify_lock);
+    ctx->t_threads++;
+    pthread_mutex_unlock(&ctx->server_ctx->notify_lock);
+
+    int err = pthread_create(&ctx->t_tid, NULL, transfer_thread, ctx);
+    if (err != 0) {
+        log_err("Failed to start transfer thread: %s", strerror(err));
+        pthread_mutex_lock(&ctx->server_ctx->notify_lock);
+        ctx->t_threads--;
+        pthread_mutex_unlock(&ctx->server_ctx->notify_lock);
+
+        transfer_complete(ctx, false);
+        return;
+    }
+    pthread_detach(ctx->t_tid);
+}
+
 void data_accept_callback(uev_t* w, void* arg, int events) {
     if (events & UEV_ERROR) {
         log_err("Error on client socket");
@@ -100,37 +192,28 @@ void data_accept_callback(uev_t* w, void* arg, int events) {
     }
 
     mftp_client_ctx_t* client_ctx = (mftp_client_ctx_t*)arg;
-    mftp_server_ctx_t* server_ctx = client_ctx->server_ctx;
 
     if (client_ctx->locked) return;
-    client_ctx->locked = true;
-    uev_timer_stop(client_ctx->t_timeout_watcher);
-    uev_io_stop(client_ctx->t_watcher);
 
-    int* data_fd_ptr;
-    switch (client_ctx->t_kind) {
-        case MFTP_CMD_LIST:
-        case MFTP_CMD_RETR:
-            data_fd_ptr = &client_ctx->t_fd_out;
-            break;
-        case MFTP_CMD_STOR:
-            data_fd_ptr = &client_ctx->t_fd_in;
-            break;
-        default:
-            assert(false);
-            break;
+    int data_fd = accept(w->fd, NULL, NULL);
+    if (data_fd < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) log_syserr("Failed to accept data connection");
+        return;
     }
-    *data_fd_ptr = accept(w->fd, NULL, NULL);
-    if (*data_fd_ptr < 0) {
-        log_syserr("Failed to accept data connection"); // should not happen - READ was triggered, but no connection can be accepted.
-        client_ctx->locked = false;
+
+    // listener may be a shared, predictable port - only the client that asked for the transfer gets it
+    if (!socket_same_peer(data_fd, client_ctx->cmd_fd)) {
+        log_warn("[CLIENT %d] Rejected data connection from foreign address", client_ctx->cmd_fd);
+        close(data_fd);
         return;
     }
 
-    pthread_create(&client_ctx->t_tid, NULL, transfer_thread, client_ctx);
-    pthread_detach(client_ctx->t_tid);
+    uev_timer_stop(client_ctx->t_timeout_watcher);
+    uev_io_stop(client_ctx->t_watcher);
 
-    client_ctx->locked = false;
+    // not locked - transfer that fails to start is cleaned up right away
+    if (client_ctx->t_block_mode) client_ctx->t_data_fd = data_fd;
+    data_channel_start(client_ctx, data_fd);
 
     return;
 }
@@ -154,22 +237,170 @@ void data_timeout_callback(uev_t* w, void* arg, int events) {
         .data = "Timeout",
     };
 
-    mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+    client_ctx_reply(client_ctx, &msg);
+    client_ctx_notify(client_ctx, CLIENT_NOTIFY_FLUSH);
 
     client_ctx->locked = false;
 
     client_ctx_cleanup_transfer(client_ctx);
 }
 
+void data_channel_arm(mftp_client_ctx_t* ctx) {
+    ctx->t_arm_pending = false;
+
+    if (ctx->t_listen.fd < 0) {
+        // block mode, connection from previous transfer is reused - nothing to wait for
+        data_channel_start(ctx, ctx->t_data_fd);
+        return;
+    }
+
+    uev_t* watcher = slab_alloc(sizeof(uev_t));
+    uev_t* timeout_watcher = slab_alloc(sizeof(uev_t));
+    if (watcher == NULL || timeout_watcher == NULL) {
+        log_syserr("Failed to allocate memory for data channel watchers");
+        slab_free(watcher);
+        slab_free(timeout_watcher);
+
+        mftp_server_msg_t msg = {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_DATA_CHANNEL_ERROR,
+            .data = "Failed to open data channel",
+        };
+        client_ctx_reply(ctx, &msg);
+        client_ctx_cleanup_transfer(ctx);
+        return;
+    }
+
+    ctx->t_watcher = watcher;
+    uev_io_init(ctx->server_ctx->loop, ctx->t_watcher, data_accept_callback, ctx, ctx->t_listen.fd, UEV_READ);
+    ctx->t_timeout_watcher = timeout_watcher;
+    uev_timer_init(ctx->server_ctx->loop, ctx->t_timeout_watcher, data_timeout_callback, ctx, (int)mftp_server_cfg(ctx->server_ctx)->timeout_ms, 0);
+}
+
+// Moves file position to REST offset (file stays open for transfer thread through a dup). Replies on failure.
+static bool transfer_seek(mftp_client_ctx_t* client_ctx, FILE* file, off_t offset) {
+    if (offset == 0) return true;
+
+    struct stat file_stat;
+    if (fstat(fileno(file), &file_stat) < 0) {
+        log_syserr("Failed to stat file");
+        mftp_server_msg_t msg = {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_FS_READ_FAILURE,
+            .data = "Failed to stat file",
+        };
+        client_ctx_reply(client_ctx, &msg);
+        return false;
+    }
+
+    if (offset > file_stat.st_size) {
+        mftp_server_msg_t msg = {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_INVALID_ARGUMENT,
+            .data = { 0 },
+        };
+        sprintf(msg.data, "Offset past end of file (%ld bytes)", (long)file_stat.st_size);
+        client_ctx_reply(client_ctx, &msg);
+        return false;
+    }
+
+    if (lseek(fileno(file), offset, SEEK_SET) < 0) {
+        log_syserr("Failed to seek file");
+        mftp_server_msg_t msg = {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_FS_READ_FAILURE,
+            .data = "Failed to seek file",
+        };
+        client_ctx_reply(client_ctx, &msg);
+        return false;
+    }
+
+    return true;
+}
+
+// Gets a passive listener (leased from port pool, or fresh ephemeral one) and announces it to client.
+// Runs on worker thread - watchers are started later by data_channel_arm.
+static bool data_channel_open(mftp_client_ctx_t* client_ctx) {
+    mftp_server_ctx_t* server_ctx = client_ctx->server_ctx;
+
+    if (!admission_slot_claim(server_ctx->transfers_total, mftp_server_cfg(server_ctx)->max_transfers)) {
+        mftp_server_msg_t msg = {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_BUSY,
+            .data = { 0 },
+        };
+        snprintf(msg.data, sizeof(msg.data), "Too many transfers - retry after %u s", (unsigned)mftp_server_cfg(server_ctx)->busy_retry_after);
+        client_ctx_reply(client_ctx, &msg);
+        return false;
+    }
+    client_ctx->t_slot = true;
+
+    if (client_ctx->t_data_fd >= 0) {
+        // idle block mode connection must have nothing to read - EOF or stray bytes mean it's unusable
+        char probe;
+        if (recv(client_ctx->t_data_fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            mftp_server_msg_t msg = {
+                .kind = MFTP_MSG_OK,
+                .code = MFTP_CODE_OPENING_DATA_CHANNEL,
+                .data = "Reusing data channel",
+            };
+            client_ctx_reply(client_ctx, &msg);
+
+            client_ctx->t_arm_pending = true;
+            return true;
+        }
+
+        client_ctx_drop_data_conn(client_ctx);
+    }
+
+    if (server_ctx->data_ports != NULL) {
+        if (!data_port_lease(server_ctx->data_ports, &client_ctx->t_listen)) {
+            mftp_server_msg_t msg = {
+                .kind = MFTP_MSG_ERR,
+                .code = MFTP_CODE_BUSY,
+                .data = "No free data port - try again",
+            };
+            client_ctx_reply(client_ctx, &msg);
+            goto release_slot;
+        }
+        client_ctx->t_listen_leased = true;
+    } else if (!socket_bind_tcp(&client_ctx->t_listen, INADDR_ANY, 0) || listen(client_ctx->t_listen.fd, 1) < 0) {
+        if (client_ctx->t_listen.fd >= 0) socket_cleanup(&client_ctx->t_listen);
+
+        mftp_server_msg_t msg = {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_DATA_CHANNEL_ERROR,
+            .data = "Failed to open data channel",
+        };
+        client_ctx_reply(client_ctx, &msg);
+        goto release_slot;
+    }
+
+    mftp_server_msg_t msg = {
+        .kind = MFTP_MSG_OK,
+        .code = MFTP_CODE_OPENING_DATA_CHANNEL,
+        .data = { 0 },
+    };
+
+    sprintf(msg.data, "[%s:%d] Opening data channel", inet_ntoa((struct in_addr){ .s_addr = client_ctx->t_listen.haddr }), client_ctx->t_listen.hport);
+    client_ctx_reply(client_ctx, &msg);
+
+    client_ctx->t_arm_pending = true;
+    return true;
+
+release_slot:
+    admission_slot_release(server_ctx->transfers_total);
+    client_ctx->t_slot = false;
+    return false;
+}
+
 void mftp_handle_noop(command_handler_arg_t* arg) {
     mftp_server_msg_t msg = {
         .kind = MFTP_MSG_OK,
         .code = MFTP_CODE_READY,
         .data = "Ready",
     };
-    mftp_server_msg_write(arg->client_ctx->cmd_fd, &msg);
-
-    free(arg);
+    client_ctx_reply(arg->client_ctx, &msg);
 }
 
 void mftp_handle_quit(command_handler_arg_t* arg) {
@@ -178,11 +409,9 @@ void mftp_handle_quit(command_handler_arg_t* arg) {
         .code = MFTP_CODE_SERVICE_CLOSING,
         .data = "Goodbye",
     };
-    mftp_server_msg_write(arg->client_ctx->cmd_fd, &msg);
-
-    mftp_server_remove_client_data_watcher(arg->client_ctx->server_ctx, arg->client_ctx->cmd_watcher);
+    client_ctx_reply(arg->client_ctx, &msg);
 
-    free(arg);
+    arg->client_ctx->closing = true; // loop disconnects once this handler returns
 }
 
 void mftp_handle_feat(command_handler_arg_t* arg) {
@@ -192,16 +421,14 @@ void mftp_handle_feat(command_handler_arg_t* arg) {
         .data = { 0 },
     };
 
-    for (int i = 0; i < command_table_size - 1; i++) {
+    for (size_t i = 0; i < command_table_size; i++) {
+        if (command_table[i].handler == NULL) continue;
+
+        if (msg.data[0] != '\0') strcat(msg.data, ",");
         strcat(msg.data, mftp_ctoa(command_table[i].cmd));
-        strcat(msg.data, ",");
     }
 
-    strcat(msg.data, mftp_ctoa(command_table[command_table_size - 1].cmd));
-
-    mftp_server_msg_write(arg->client_ctx->cmd_fd, &msg);
-
-    free(arg);
+    client_ctx_reply(arg->client_ctx, &msg);
 }
 
 void mftp_handle_user(command_handler_arg_t* arg) {
@@ -216,7 +443,7 @@ void mftp_handle_user(command_handler_arg_t* arg) {
             .code = MFTP_CODE_EXPECTED_ARGUMENT,
             .data = "Username not provided",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     } else if (arg_len > sizeof(client_ctx->creds.username) - 1) {
         mftp_server_msg_t msg = {
@@ -224,7 +451,7 @@ void mftp_handle_user(command_handler_arg_t* arg) {
             .code = MFTP_CODE_INVALID_ARGUMENT,
             .data = "Username too long",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     }
 
@@ -232,6 +459,9 @@ void mftp_handle_user(command_handler_arg_t* arg) {
     client_ctx->authenticated = false;
     memset(client_ctx->creds.username, 0, sizeof(client_ctx->creds.username));
     memset(client_ctx->creds.password, 0, sizeof(client_ctx->creds.password));
+    client_ctx->creds.rate_limit = client_ctx->creds.rate_burst = 0;
+    client_ctx->creds.weight = 0;
+    client_ctx->creds.generation = 0;
 
     // copy new username
     strncpy(client_ctx->creds.username, cmd.data, strlen(cmd.data));
@@ -241,10 +471,10 @@ void mftp_handle_user(command_handler_arg_t* arg) {
         .code = MFTP_CODE_PROVIDE_PASSWORD,
         .data = "Username OK, provide password",
     };
-    mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+    client_ctx_reply(client_ctx, &msg);
 
 cleanup:
-    free(arg);
+    return;
 }
 
 void mftp_handle_pass(command_handler_arg_t* arg) {
@@ -260,7 +490,7 @@ void mftp_handle_pass(command_handler_arg_t* arg) {
     //         .code = MFTP_CODE_EXPECTED_ARGUMENT,
     //         .data = "Password not provided",
     //     };
-    //     mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+    //     client_ctx_reply(client_ctx, &msg);
     //     goto cleanup;
     // } else 
     if (arg_len > sizeof(client_ctx->creds.password) - 1) {
@@ -269,7 +499,7 @@ void mftp_handle_pass(command_handler_arg_t* arg) {
             .code = MFTP_CODE_INVALID_ARGUMENT,
             .data = "Password too long",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     } else if (client_ctx->authenticated) {
         mftp_server_msg_t msg = {
@@ -277,7 +507,7 @@ void mftp_handle_pass(command_handler_arg_t* arg) {
             .code = MFTP_CODE_UNEXPECTED_COMMAND,
             .data = "Already logged in",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     }
 
@@ -285,10 +515,13 @@ void mftp_handle_pass(command_handler_arg_t* arg) {
 
     bool creds_ok = false;
 
-    struct timeval start_tv, end_tv;
-    gettimeofday(&start_tv, NULL);
-
-    client_ctx->creds.perms = passwd_check(&server_ctx->creds, client_ctx->creds.username, client_ctx->creds.password);
+    passwd_entry_t entry;
+    bool found = cred_store_check(server_ctx->creds, client_ctx->creds.username, client_ctx->creds.password, &entry);
+    client_ctx->creds.perms = found ? entry.perms : 0;
+    client_ctx->creds.rate_limit = found ? entry.rate_limit : 0;
+    client_ctx->creds.rate_burst = found ? entry.rate_burst : 0;
+    client_ctx->creds.weight = found ? entry.weight : 0;
+    client_ctx->creds.generation = found ? entry.generation : 0; // lets user's shared bucket and flow pick up reloaded limits
     if (client_ctx->creds.perms != 0) {
         creds_ok = true;
     }
@@ -304,7 +537,7 @@ void mftp_handle_pass(command_handler_arg_t* arg) {
             .data = "Logged in as ",
         };
         strcat(msg.data, client_ctx->creds.username);
-    } else if (server_ctx->cfg.flags.allow_anonymous && strcmp(client_ctx->creds.username, "anon") == 0) {
+    } else if (mftp_server_cfg(server_ctx)->flags.allow_anonymous && strcmp(client_ctx->creds.username, "anon") == 0) {
         client_ctx->authenticated = true;
         client_ctx->creds.perms = PERM_LIST | PERM_READ;
 
@@ -314,24 +547,15 @@ void mftp_handle_pass(command_handler_arg_t* arg) {
             .data = "Logged in anonymously",
         };
     } else {
-        msg = (mftp_server_msg_t) {
-            .kind = MFTP_MSG_ERR,
-            .code = MFTP_CODE_FORBIDDEN,
-            .data = "Invalid credentials",
-        };
-
-        // prevent timing attacks
-        // Does this even make sense? Ping over the network shouldn't be consistent enough to measure time differences...
-        gettimeofday(&end_tv, NULL);
-        if (end_tv.tv_sec - start_tv.tv_sec < 1) {
-            usleep(1000000 - (end_tv.tv_usec - start_tv.tv_usec));
-        }
+        // loop answers later - a sleep here would hold a worker for every password guess
+        client_ctx->login_failed = true;
+        goto cleanup;
     }
 
-    mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+    client_ctx_reply(client_ctx, &msg);
 
 cleanup:
-    free(arg);
+    return;
 }
 
 void mftp_handle_wami(command_handler_arg_t* arg) {
@@ -353,10 +577,38 @@ void mftp_handle_wami(command_handler_arg_t* arg) {
         sprintf(msg.data, "%s %s", client_ctx->creds.username, perm_to_str(client_ctx->creds.perms));
     }
 
-    mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+    client_ctx_reply(client_ctx, &msg);
 
 cleanup:
-    free(arg);
+    return;
+}
+
+void mftp_handle_stat(command_handler_arg_t* arg) {
+    mftp_client_ctx_t* client_ctx = arg->client_ctx;
+    mftp_server_msg_t msg;
+
+    if (!client_ctx->authenticated) {
+        msg = (mftp_server_msg_t){
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_NOT_LOGGED_IN,
+            .data = "Not logged in",
+        };
+    } else if (client_ctx->server_ctx->fair == NULL) {
+        msg = (mftp_server_msg_t){
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_GENERAL_FAILURE,
+            .data = "Fair share scheduling is disabled",
+        };
+    } else {
+        msg = (mftp_server_msg_t){
+            .kind = MFTP_MSG_OK,
+            .code = MFTP_CODE_GENERAL_SUCCESS,
+            .data = { 0 },
+        };
+        fair_sched_status(client_ctx->server_ctx->fair, msg.data, sizeof(msg.data), rate_now_ns());
+    }
+
+    client_ctx_reply(client_ctx, &msg);
 }
 
 void mftp_handle_list(command_handler_arg_t* arg) {
@@ -368,22 +620,22 @@ void mftp_handle_list(command_handler_arg_t* arg) {
             .code = MFTP_CODE_FORBIDDEN,
             .data = "Permission denied",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     }
 
-    if (client_ctx->t_active) {
+    if (client_ctx->t_active || client_ctx->t_kind != MFTP_CMD_INVALID) {
         mftp_server_msg_t msg = {
             .kind = MFTP_MSG_ERR,
             .code = MFTP_CODE_BUSY,
             .data = "Transfer in progress",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     }
 
     char cwd_full[512] = { 0 };
-    sprintf(cwd_full, "%s%s", client_ctx->server_ctx->cfg.root_dir, client_ctx->cwd + 1); // + 1 to skip '/'
+    sprintf(cwd_full, "%s%s", mftp_server_cfg(client_ctx->server_ctx)->root_dir, client_ctx->cwd + 1); // + 1 to skip '/'
 
     DIR* cwd = opendir(cwd_full);
     if (cwd == NULL) {
@@ -392,76 +644,61 @@ void mftp_handle_list(command_handler_arg_t* arg) {
             .code = MFTP_CODE_FS_READ_FAILURE,
             .data = "Failed to open directory",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     }
 
-    socket_t data_ch_socket = { 0 };
-    socket_bind_tcp(&data_ch_socket, INADDR_ANY, 0);
-
-    mftp_server_msg_t msg = {
-        .kind = MFTP_MSG_OK,
-        .code = MFTP_CODE_OPENING_DATA_CHANNEL,
-        .data = { 0 },
-    };
-
-    sprintf(msg.data, "[%s:%d] Opening data channel", inet_ntoa((struct in_addr){ .s_addr = data_ch_socket.haddr }), data_ch_socket.hport);
-    mftp_server_msg_write(client_ctx->cmd_fd, &msg);
-
-    listen(data_ch_socket.fd, 1);
+    if (!data_channel_open(client_ctx)) {
+        closedir(cwd);
+        goto cleanup;
+    }
 
     client_ctx->t_fd_in = dup(dirfd(cwd)); // I love posix streams :3
     client_ctx->t_kind = MFTP_CMD_LIST;
 
     closedir(cwd); // not closing this here will leak internal os resources
 
-    client_ctx->t_watcher = malloc(sizeof(uev_t));
-    uev_io_init(client_ctx->server_ctx->loop, client_ctx->t_watcher, data_accept_callback, client_ctx, data_ch_socket.fd, UEV_READ);
-    client_ctx->t_timeout_watcher = malloc(sizeof(uev_t));
-    uev_timer_init(client_ctx->server_ctx->loop, client_ctx->t_timeout_watcher, data_timeout_callback, client_ctx, (int)client_ctx->server_ctx->cfg.timeout_ms, 0);
-
 cleanup:
-    free(arg);
+    return;
 }
 
-void mftp_handle_retr(command_handler_arg_t* arg) {
-    mftp_client_ctx_t* client_ctx = arg->client_ctx;
-    mftp_client_msg_t cmd = arg->cmd;
-
+// common part of RETR and RANG - sends at most limit bytes of file starting at offset
+static void retr_start(mftp_client_ctx_t* client_ctx, const char* file_name, off_t offset, uint64_t limit) {
     if (~client_ctx->creds.perms & PERM_READ) {
         mftp_server_msg_t msg = {
             .kind = MFTP_MSG_ERR,
             .code = MFTP_CODE_FORBIDDEN,
             .data = "Permission denied",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     }
 
-    if (client_ctx->t_active) {
+    if (client_ctx->t_active || client_ctx->t_kind != MFTP_CMD_INVALID) {
         mftp_server_msg_t msg = {
             .kind = MFTP_MSG_ERR,
             .code = MFTP_CODE_BUSY,
             .data = "Transfer in progress",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     }
 
-    if (strlen(cmd.data) == 0) {
+    if (strlen(file_name) == 0) {
         mftp_server_msg_t msg = {
             .kind = MFTP_MSG_ERR,
             .code = MFTP_CODE_EXPECTED_ARGUMENT,
             .data = "Filename not provided",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     }
 
     char file_path_full[PATH_MAX] = { 0 };
 
-    sprintf(file_path_full, "%.*s%.*s/", (int)strlen(client_ctx->server_ctx->cfg.root_dir), client_ctx->server_ctx->cfg.root_dir, (int)strlen(client_ctx->cwd), client_ctx->cwd);
-    strcat(file_path_full, cmd.data);
+    const char* root_dir = mftp_server_cfg(client_ctx->server_ctx)->root_dir;
+    sprintf(file_path_full, "%.*s%.*s/", (int)strlen(root_dir), root_dir, (int)strlen(client_ctx->cwd), client_ctx->cwd);
+    strcat(file_path_full, file_name);
     path_normalize(file_path_full);
 
     FILE* file = fopen(file_path_full, "rb");
@@ -471,59 +708,100 @@ void mftp_handle_retr(command_handler_arg_t* arg) {
             .code = MFTP_CODE_FS_READ_FAILURE,
             .data = "Failed to open file",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     }
 
-    socket_t data_ch_socket = { 0 };
-    socket_bind_tcp(&data_ch_socket, INADDR_ANY, 0);
-
-    mftp_server_msg_t msg = {
-        .kind = MFTP_MSG_OK,
-        .code = MFTP_CODE_OPENING_DATA_CHANNEL,
-        .data = { 0 },
-    };
-
-    sprintf(msg.data, "[%s:%d] Opening data channel", inet_ntoa((struct in_addr){ .s_addr = data_ch_socket.haddr }), data_ch_socket.hport);
-    mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+    if (!transfer_seek(client_ctx, file, offset)) {
+        fclose(file);
+        goto cleanup;
+    }
 
-    listen(data_ch_socket.fd, 1);
+    if (!data_channel_open(client_ctx)) {
+        fclose(file);
+        goto cleanup;
+    }
 
     client_ctx->t_fd_in = dup(fileno(file));
     client_ctx->t_kind = MFTP_CMD_RETR;
+    client_ctx->t_limit = limit;
 
     fclose(file);
 
-    client_ctx->t_watcher = malloc(sizeof(uev_t));
-    uev_io_init(client_ctx->server_ctx->loop, client_ctx->t_watcher, data_accept_callback, client_ctx, data_ch_socket.fd, UEV_READ);
-    client_ctx->t_timeout_watcher = malloc(sizeof(uev_t));
-    uev_timer_init(client_ctx->server_ctx->loop, client_ctx->t_timeout_watcher, data_timeout_callback, client_ctx, (int)client_ctx->server_ctx->cfg.timeout_ms, 0);
-
 cleanup:
-    free(arg);
+    return;
+}
+
+void mftp_handle_retr(command_handler_arg_t* arg) {
+    mftp_client_ctx_t* client_ctx = arg->client_ctx;
+
+    // REST applies to this command only, whatever its outcome
+    off_t offset = client_ctx->t_offset;
+    client_ctx->t_offset = 0;
+
+    retr_start(client_ctx, arg->cmd.data, offset, UINT64_MAX);
+}
+
+// parses leading "<number> " of str, returns pointer past the space or NULL
+static const char* parse_number(const char* str, uint64_t* out) {
+    if (*str < '0' || *str > '9') return NULL;
+
+    char* end;
+    errno = 0;
+    unsigned long long value = strtoull(str, &end, 10);
+    if (errno != 0 || *end != ' ' || value > INT64_MAX) return NULL;
+
+    *out = value;
+    return end + 1;
+}
+
+// RANG <offset> <length> <filename> - several sessions can fetch disjoint parts of one file in parallel
+void mftp_handle_rang(command_handler_arg_t* arg) {
+    mftp_client_ctx_t* client_ctx = arg->client_ctx;
+
+    client_ctx->t_offset = 0; // RANG has its own offset
+
+    uint64_t offset = 0, length = 0;
+    const char* file_name = parse_number(arg->cmd.data, &offset);
+    if (file_name != NULL) file_name = parse_number(file_name, &length);
+
+    if (file_name == NULL || length == 0) {
+        mftp_server_msg_t msg = {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_INVALID_ARGUMENT,
+            .data = "Usage: RANG <offset> <length> <filename>",
+        };
+        client_ctx_reply(client_ctx, &msg);
+        return;
+    }
+
+    retr_start(client_ctx, file_name, (off_t)offset, length);
 }
 
 void mftp_handle_stor(command_handler_arg_t* arg) {
     mftp_client_ctx_t* client_ctx = arg->client_ctx;
     mftp_client_msg_t cmd = arg->cmd;
 
+    off_t offset = client_ctx->t_offset;
+    client_ctx->t_offset = 0;
+
     if (~client_ctx->creds.perms & PERM_WRITE) {
         mftp_server_msg_t msg = {
             .kind = MFTP_MSG_ERR,
             .code = MFTP_CODE_FORBIDDEN,
             .data = "Permission denied",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     }
 
-    if (client_ctx->t_active) {
+    if (client_ctx->t_active || client_ctx->t_kind != MFTP_CMD_INVALID) {
         mftp_server_msg_t msg = {
             .kind = MFTP_MSG_ERR,
             .code = MFTP_CODE_BUSY,
             .data = "Transfer in progress",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     }
 
@@ -533,53 +811,227 @@ void mftp_handle_stor(command_handler_arg_t* arg) {
             .code = MFTP_CODE_EXPECTED_ARGUMENT,
             .data = "Filename not provided",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     }
 
     char file_path_full[PATH_MAX] = { 0 };
 
-    sprintf(file_path_full, "%.*s%.*s/", (int)strlen(client_ctx->server_ctx->cfg.root_dir), client_ctx->server_ctx->cfg.root_dir, (int)strlen(client_ctx->cwd), client_ctx->cwd);
+    const char* root_dir = mftp_server_cfg(client_ctx->server_ctx)->root_dir;
+    sprintf(file_path_full, "%.*s%.*s/", (int)strlen(root_dir), root_dir, (int)strlen(client_ctx->cwd), client_ctx->cwd);
     strcat(file_path_full, cmd.data);
     path_normalize(file_path_full);
 
-    FILE* file = fopen(file_path_full, "wb");
+    // resumed upload keeps what's already there
+    FILE* file = fopen(file_path_full, offset > 0 ? "r+b" : "wb");
     if (file == NULL) {
         mftp_server_msg_t msg = {
             .kind = MFTP_MSG_ERR,
             .code = MFTP_CODE_FS_WRITE_FAILURE,
             .data = "Failed to open file",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
+        goto cleanup;
+    }
+
+    if (!transfer_seek(client_ctx, file, offset)) {
+        fclose(file);
+        goto cleanup;
+    }
+
+    // anything past the offset is what the interrupted upload didn't finish - it's sent again
+    if (offset > 0 && ftruncate(fileno(file), offset) < 0) {
+        log_syserr("Failed to truncate file");
+        mftp_server_msg_t msg = {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_FS_WRITE_FAILURE,
+            .data = "Failed to truncate file",
+        };
+        client_ctx_reply(client_ctx, &msg);
+        fclose(file);
+        goto cleanup;
+    }
+
+    if (!data_channel_open(client_ctx)) {
+        fclose(file);
         goto cleanup;
     }
 
-    socket_t data_ch_socket = { 0 };
-    socket_bind_tcp(&data_ch_socket, INADDR_ANY, 0);
+    client_ctx->t_fd_out = dup(fileno(file));
+    client_ctx->t_kind = MFTP_CMD_STOR;
+
+    fclose(file);
+
+cleanup:
+    return;
+}
+
+// ALLO <size> <filename> - preallocates file for segmented upload. Segments may come from any session.
+void mftp_handle_allo(command_handler_arg_t* arg) {
+    mftp_client_ctx_t* client_ctx = arg->client_ctx;
+
+    if (~client_ctx->creds.perms & PERM_WRITE) {
+        mftp_server_msg_t msg = {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_FORBIDDEN,
+            .data = "Permission denied",
+        };
+        client_ctx_reply(client_ctx, &msg);
+        goto cleanup;
+    }
+
+    uint64_t size = 0;
+    const char* file_name = parse_number(arg->cmd.data, &size);
+
+    if (file_name == NULL || strlen(file_name) == 0) {
+        mftp_server_msg_t msg = {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_INVALID_ARGUMENT,
+            .data = "Usage: ALLO <size> <filename>",
+        };
+        client_ctx_reply(client_ctx, &msg);
+        goto cleanup;
+    }
+
+    char file_path_full[PATH_MAX] = { 0 };
+
+    const char* root_dir = mftp_server_cfg(client_ctx->server_ctx)->root_dir;
+    sprintf(file_path_full, "%.*s%.*s/", (int)strlen(root_dir), root_dir, (int)strlen(client_ctx->cwd), client_ctx->cwd);
+    strcat(file_path_full, file_name);
+    path_normalize(file_path_full);
+
+    upload_t* upload = upload_begin(client_ctx->server_ctx->uploads, file_path_full, size);
+    if (upload == NULL) {
+        mftp_server_msg_t msg = {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_FS_WRITE_FAILURE,
+            .data = "Failed to allocate file",
+        };
+        if (errno == EEXIST) {
+            msg.code = MFTP_CODE_BUSY;
+            strcpy(msg.data, "Upload of this file with different size in progress");
+        } else {
+            log_syserr("Failed to allocate %s", file_path_full);
+        }
+        client_ctx_reply(client_ctx, &msg);
+        goto cleanup;
+    }
+
+    uint64_t received = upload_received(client_ctx->server_ctx->uploads, upload);
+    upload_release(client_ctx->server_ctx->uploads, upload); // registry keeps it until it's committed
 
     mftp_server_msg_t msg = {
         .kind = MFTP_MSG_OK,
-        .code = MFTP_CODE_OPENING_DATA_CHANNEL,
+        .code = MFTP_CODE_GENERAL_SUCCESS,
         .data = { 0 },
     };
+    sprintf(msg.data, "Allocated %llu bytes (%llu received) - send segments with SEGM", (unsigned long long)size, (unsigned long long)received);
+    client_ctx_reply(client_ctx, &msg);
 
-    sprintf(msg.data, "[%s:%d] Opening data channel", inet_ntoa((struct in_addr){ .s_addr = data_ch_socket.haddr }), data_ch_socket.hport);
-    mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+cleanup:
+    return;
+}
 
-    listen(data_ch_socket.fd, 1);
+// SEGM <offset> <length> <filename> - receives one range of upload declared with ALLO
+void mftp_handle_segm(command_handler_arg_t* arg) {
+    mftp_client_ctx_t* client_ctx = arg->client_ctx;
+    mftp_server_ctx_t* server_ctx = client_ctx->server_ctx;
 
-    client_ctx->t_fd_out = dup(fileno(file));
-    client_ctx->t_kind = MFTP_CMD_STOR;
+    client_ctx->t_offset = 0; // SEGM has its own offset
 
-    fclose(file);
+    if (~client_ctx->creds.perms & PERM_WRITE) {
+        mftp_server_msg_t msg = {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_FORBIDDEN,
+            .data = "Permission denied",
+        };
+        client_ctx_reply(client_ctx, &msg);
+        goto cleanup;
+    }
+
+    if (client_ctx->t_active || client_ctx->t_kind != MFTP_CMD_INVALID) {
+        mftp_server_msg_t msg = {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_BUSY,
+            .data = "Transfer in progress",
+        };
+        client_ctx_reply(client_ctx, &msg);
+        goto cleanup;
+    }
+
+    uint64_t offset = 0, length = 0;
+    const char* file_name = parse_number(arg->cmd.data, &offset);
+    if (file_name != NULL) file_name = parse_number(file_name, &length);
+
+    if (file_name == NULL || length == 0 || strlen(file_name) == 0) {
+        mftp_server_msg_t msg = {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_INVALID_ARGUMENT,
+            .data = "Usage: SEGM <offset> <length> <filename>",
+        };
+        client_ctx_reply(client_ctx, &msg);
+        goto cleanup;
+    }
+
+    char file_path_full[PATH_MAX] = { 0 };
+
+    const char* root_dir = mftp_server_cfg(server_ctx)->root_dir;
+    sprintf(file_path_full, "%.*s%.*s/", (int)strlen(root_dir), root_dir, (int)strlen(client_ctx->cwd), client_ctx->cwd);
+    strcat(file_path_full, file_name);
+    path_normalize(file_path_full);
+
+    upload_t* upload = upload_acquire(server_ctx->uploads, file_path_full);
+    if (upload == NULL) {
+        mftp_server_msg_t msg = {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_UNEXPECTED_COMMAND,
+            .data = "No upload allocated for this file - send ALLO first",
+        };
+        client_ctx_reply(client_ctx, &msg);
+        goto cleanup;
+    }
+
+    if (offset > upload->size || length > upload->size - offset) {
+        mftp_server_msg_t msg = {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_INVALID_ARGUMENT,
+            .data = { 0 },
+        };
+        sprintf(msg.data, "Segment goes past end of file (%llu bytes)", (unsigned long long)upload->size);
+        client_ctx_reply(client_ctx, &msg);
+        upload_release(server_ctx->uploads, upload);
+        goto cleanup;
+    }
+
+    // own descriptor - file position is per segment, so parallel segments don't disturb each other
+    int fd = open(upload->part_path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0 || lseek(fd, (off_t)offset, SEEK_SET) < 0) {
+        log_syserr("Failed to open %s", upload->part_path);
+        mftp_server_msg_t msg = {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_FS_WRITE_FAILURE,
+            .data = "Failed to open file",
+        };
+        client_ctx_reply(client_ctx, &msg);
+        if (fd >= 0) close(fd);
+        upload_release(server_ctx->uploads, upload);
+        goto cleanup;
+    }
+
+    if (!data_channel_open(client_ctx)) {
+        close(fd);
+        upload_release(server_ctx->uploads, upload);
+        goto cleanup;
+    }
 
-    client_ctx->t_watcher = malloc(sizeof(uev_t));
-    uev_io_init(client_ctx->server_ctx->loop, client_ctx->t_watcher, data_accept_callback, client_ctx, data_ch_socket.fd, UEV_READ);
-    client_ctx->t_timeout_watcher = malloc(sizeof(uev_t));
-    uev_timer_init(client_ctx->server_ctx->loop, client_ctx->t_timeout_watcher, data_timeout_callback, client_ctx, (int)client_ctx->server_ctx->cfg.timeout_ms, 0);
+    client_ctx->t_fd_out = fd;
+    client_ctx->t_kind = MFTP_CMD_SEGM;
+    client_ctx->t_limit = length;
+    client_ctx->t_upload = upload;
+    client_ctx->t_upload_offset = offset;
 
 cleanup:
-    free(arg);
+    return;
 }
 
 void mftp_handle_pwdr(command_handler_arg_t* arg) {
@@ -592,9 +1044,7 @@ void mftp_handle_pwdr(command_handler_arg_t* arg) {
     };
 
     strcat(msg.data, client_ctx->cwd);
-    mftp_server_msg_write(client_ctx->cmd_fd, &msg);
-
-    free(arg);
+    client_ctx_reply(client_ctx, &msg);
 }
 
 void mftp_handle_chwd(command_handler_arg_t* arg) {
@@ -607,12 +1057,12 @@ void mftp_handle_chwd(command_handler_arg_t* arg) {
             .code = MFTP_CODE_EXPECTED_ARGUMENT,
             .data = "Path not provided",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     }
 
     char root_realpath[PATH_MAX] = { 0 }, full_realpath[PATH_MAX] = { 0 }, new_cwd[PATH_MAX] = { 0 };
-    realpath(client_ctx->server_ctx->cfg.root_dir, root_realpath);
+    realpath(mftp_server_cfg(client_ctx->server_ctx)->root_dir, root_realpath);
 
     if (!path_join(new_cwd, client_ctx->cwd, cmd.data)) {
         mftp_server_msg_t msg = {
@@ -620,7 +1070,7 @@ void mftp_handle_chwd(command_handler_arg_t* arg) {
             .code = MFTP_CODE_GENERAL_FAILURE,
             .data = "Path too long",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     }
 
@@ -630,7 +1080,7 @@ void mftp_handle_chwd(command_handler_arg_t* arg) {
             .code = MFTP_CODE_GENERAL_FAILURE,
             .data = "Path too long",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     }
     
@@ -644,7 +1094,7 @@ void mftp_handle_chwd(command_handler_arg_t* arg) {
             .code = MFTP_CODE_FS_READ_FAILURE,
             .data = "Path does not exist",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     } else if (access(full_realpath, R_OK) == -1) {
         log_syserr("Failed to access path"); // shouldn't happen :)
@@ -653,7 +1103,7 @@ void mftp_handle_chwd(command_handler_arg_t* arg) {
             .code = MFTP_CODE_FORBIDDEN,
             .data = "Permission denied",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     }
 
@@ -667,10 +1117,10 @@ void mftp_handle_chwd(command_handler_arg_t* arg) {
     };
     strcat(msg.data, client_ctx->cwd);
 
-    mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+    client_ctx_reply(client_ctx, &msg);
 
 cleanup:
-    free(arg);
+    return;
 }
 
 void mftp_handle_dele(command_handler_arg_t* arg) {
@@ -683,7 +1133,7 @@ void mftp_handle_dele(command_handler_arg_t* arg) {
             .code = MFTP_CODE_FORBIDDEN,
             .data = "Permission denied",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     }
 
@@ -693,12 +1143,13 @@ void mftp_handle_dele(command_handler_arg_t* arg) {
             .code = MFTP_CODE_EXPECTED_ARGUMENT,
             .data = "Filename not provided",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     }
 
     char file_path_full[PATH_MAX] = { 0 };
-    sprintf(file_path_full, "%.*s%.*s/", (int)strlen(client_ctx->server_ctx->cfg.root_dir), client_ctx->server_ctx->cfg.root_dir, (int)strlen(client_ctx->cwd), client_ctx->cwd);
+    const char* root_dir = mftp_server_cfg(client_ctx->server_ctx)->root_dir;
+    sprintf(file_path_full, "%.*s%.*s/", (int)strlen(root_dir), root_dir, (int)strlen(client_ctx->cwd), client_ctx->cwd);
     strcat(file_path_full, cmd.data);
 
     if (remove(file_path_full) == -1) {
@@ -707,7 +1158,7 @@ void mftp_handle_dele(command_handler_arg_t* arg) {
             .code = MFTP_CODE_FS_WRITE_FAILURE,
             .data = "Failed to delete file",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     }
 
@@ -716,10 +1167,10 @@ void mftp_handle_dele(command_handler_arg_t* arg) {
         .code = MFTP_CODE_FS_ACTION_SUCCESS,
         .data = "File deleted",
     };
-    mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+    client_ctx_reply(client_ctx, &msg);
 
 cleanup:
-    free(arg);
+    return;
 }
 
 void mftp_handle_size(command_handler_arg_t* arg) {
@@ -732,7 +1183,7 @@ void mftp_handle_size(command_handler_arg_t* arg) {
             .code = MFTP_CODE_FORBIDDEN,
             .data = "Permission denied",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     }
 
@@ -742,12 +1193,13 @@ void mftp_handle_size(command_handler_arg_t* arg) {
             .code = MFTP_CODE_EXPECTED_ARGUMENT,
             .data = "Filename not provided",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     }
 
     char file_path_full[PATH_MAX] = { 0 };
-    sprintf(file_path_full, "%.*s%.*s/", (int)strlen(client_ctx->server_ctx->cfg.root_dir), client_ctx->server_ctx->cfg.root_dir, (int)strlen(client_ctx->cwd), client_ctx->cwd);
+    const char* root_dir = mftp_server_cfg(client_ctx->server_ctx)->root_dir;
+    sprintf(file_path_full, "%.*s%.*s/", (int)strlen(root_dir), root_dir, (int)strlen(client_ctx->cwd), client_ctx->cwd);
     strcat(file_path_full, cmd.data);
     path_normalize(file_path_full);
 
@@ -758,7 +1210,7 @@ void mftp_handle_size(command_handler_arg_t* arg) {
             .code = MFTP_CODE_FS_READ_FAILURE,
             .data = "Failed to stat file",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
         goto cleanup;
     }
 
@@ -769,10 +1221,10 @@ void mftp_handle_size(command_handler_arg_t* arg) {
     };
     sprintf(msg.data, "%ld", file_stat.st_size);
 
-    mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+    client_ctx_reply(client_ctx, &msg);
 
 cleanup:
-    free(arg);
+    return;
 }
 
 // TODO: As for now, ABOR will cause server to complain - there will be reading errors (from file or socket) - no data is leaked, but logs will be dirty with meaningless errors.
@@ -785,10 +1237,17 @@ void mftp_handle_abor(command_handler_arg_t* arg) {
             .code = MFTP_CODE_GENERAL_FAILURE,
             .data = "No transfer in progress",
         };
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+        client_ctx_reply(client_ctx, &msg);
+        goto cleanup;
+    }
+
+    if (client_ctx->t_uring == NULL && client_ctx->t_event == NULL) {
+        // loop tears the transfer down and replies once the thread notices and reports back
+        client_ctx_stop_transfer_thread(client_ctx);
         goto cleanup;
     }
 
+    client_ctx_drop_data_conn(client_ctx); // block framing is broken mid-transfer
     client_ctx_cleanup_transfer(client_ctx);
 
     mftp_server_msg_t msg = {
@@ -796,28 +1255,128 @@ void mftp_handle_abor(command_handler_arg_t* arg) {
         .code = MFTP_CODE_TRANSFER_ABORTED,
         .data = "Transfer aborted",
     };
-    mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+    client_ctx_reply(client_ctx, &msg);
 
 cleanup:
-    free(arg);
+    return;
+}
+
+void mftp_handle_rest(command_handler_arg_t* arg) {
+    mftp_client_msg_t cmd = arg->cmd;
+    mftp_client_ctx_t* client_ctx = arg->client_ctx;
+
+    if (strlen(cmd.data) == 0) {
+        mftp_server_msg_t msg = {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_EXPECTED_ARGUMENT,
+            .data = "Offset not provided",
+        };
+        client_ctx_reply(client_ctx, &msg);
+        goto cleanup;
+    }
+
+    char* end;
+    errno = 0;
+    long long offset = strtoll(cmd.data, &end, 10);
+
+    if (*end != '\0' || errno != 0 || offset < 0 || cmd.data[0] == '-' || cmd.data[0] == '+') {
+        mftp_server_msg_t msg = {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_INVALID_ARGUMENT,
+            .data = "Offset must be a non-negative number",
+        };
+        client_ctx_reply(client_ctx, &msg);
+        goto cleanup;
+    }
+
+    client_ctx->t_offset = (off_t)offset;
+
+    mftp_server_msg_t msg = {
+        .kind = MFTP_MSG_OK,
+        .code = MFTP_CODE_GENERAL_SUCCESS,
+        .data = { 0 },
+    };
+    sprintf(msg.data, "Restarting at %lld - send RETR or STOR", offset);
+    client_ctx_reply(client_ctx, &msg);
+
+cleanup:
+    return;
+}
+
+void mftp_handle_mode(command_handler_arg_t* arg) {
+    mftp_client_msg_t cmd = arg->cmd;
+    mftp_client_ctx_t* client_ctx = arg->client_ctx;
+
+    if (strlen(cmd.data) == 0) {
+        mftp_server_msg_t msg = {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_EXPECTED_ARGUMENT,
+            .data = "Mode not provided",
+        };
+        client_ctx_reply(client_ctx, &msg);
+        goto cleanup;
+    }
+
+    if (client_ctx->t_active || client_ctx->t_kind != MFTP_CMD_INVALID) {
+        mftp_server_msg_t msg = {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_BUSY,
+            .data = "Transfer in progress",
+        };
+        client_ctx_reply(client_ctx, &msg);
+        goto cleanup;
+    }
+
+    mftp_server_msg_t msg = {
+        .kind = MFTP_MSG_OK,
+        .code = MFTP_CODE_GENERAL_SUCCESS,
+        .data = { 0 },
+    };
+
+    if (strcasecmp(cmd.data, "BLOCK") == 0) {
+        client_ctx->t_block_mode = true;
+        strcat(msg.data, "Block mode - data channel stays open between transfers");
+    } else if (strcasecmp(cmd.data, "STREAM") == 0) {
+        client_ctx->t_block_mode = false;
+        client_ctx_drop_data_conn(client_ctx);
+        strcat(msg.data, "Stream mode");
+    } else {
+        msg = (mftp_server_msg_t) {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_INVALID_ARGUMENT,
+            .data = "Unknown mode - use STREAM or BLOCK",
+        };
+    }
+
+    client_ctx_reply(client_ctx, &msg);
+
+cleanup:
+    return;
 }
 
 // "extern"ed in handlers.h:
 
-const command_handler_t command_table[] = {
-    { MFTP_CMD_NOOP, mftp_handle_noop },
-    { MFTP_CMD_QUIT, mftp_handle_quit },
-    { MFTP_CMD_FEAT, mftp_handle_feat },
-    { MFTP_CMD_USER, mftp_handle_user },
-    { MFTP_CMD_PASS, mftp_handle_pass },
-    { MFTP_CMD_WAMI, mftp_handle_wami },
-    { MFTP_CMD_LIST, mftp_handle_list },
-    { MFTP_CMD_RETR, mftp_handle_retr },
-    { MFTP_CMD_STOR, mftp_handle_stor },
-    { MFTP_CMD_PWDR, mftp_handle_pwdr },
-    { MFTP_CMD_CHWD, mftp_handle_chwd },
-    { MFTP_CMD_DELE, mftp_handle_dele },
-    { MFTP_CMD_SIZE, mftp_handle_size },
-    { MFTP_CMD_ABOR, mftp_handle_abor },
+// indexed by mftp_cmd_t - commands without handler are not implemented
+const command_handler_t command_table[MFTP_CMD_INVALID] = {
+    [MFTP_CMD_NOOP] = { MFTP_CMD_NOOP, mftp_handle_noop, MFTP_EXEC_INLINE },
+    [MFTP_CMD_QUIT] = { MFTP_CMD_QUIT, mftp_handle_quit, MFTP_EXEC_INLINE },
+    [MFTP_CMD_FEAT] = { MFTP_CMD_FEAT, mftp_handle_feat, MFTP_EXEC_INLINE },
+    [MFTP_CMD_USER] = { MFTP_CMD_USER, mftp_handle_user, MFTP_EXEC_INLINE },
+    [MFTP_CMD_PASS] = { MFTP_CMD_PASS, mftp_handle_pass, MFTP_EXEC_WORKER },  // failed login is answered late by the loop
+    [MFTP_CMD_WAMI] = { MFTP_CMD_WAMI, mftp_handle_wami, MFTP_EXEC_INLINE },
+    [MFTP_CMD_LIST] = { MFTP_CMD_LIST, mftp_handle_list, MFTP_EXEC_WORKER },
+    [MFTP_CMD_RETR] = { MFTP_CMD_RETR, mftp_handle_retr, MFTP_EXEC_WORKER },
+    [MFTP_CMD_STOR] = { MFTP_CMD_STOR, mftp_handle_stor, MFTP_EXEC_WORKER },
+    [MFTP_CMD_PWDR] = { MFTP_CMD_PWDR, mftp_handle_pwdr, MFTP_EXEC_INLINE },
+    [MFTP_CMD_CHWD] = { MFTP_CMD_CHWD, mftp_handle_chwd, MFTP_EXEC_WORKER },
+    [MFTP_CMD_DELE] = { MFTP_CMD_DELE, mftp_handle_dele, MFTP_EXEC_WORKER },
+    [MFTP_CMD_SIZE] = { MFTP_CMD_SIZE, mftp_handle_size, MFTP_EXEC_INLINE },  // single stat()
+    [MFTP_CMD_ABOR] = { MFTP_CMD_ABOR, mftp_handle_abor, MFTP_EXEC_INLINE },  // stops watchers of client's loop
+    [MFTP_CMD_MODE] = { MFTP_CMD_MODE, mftp_handle_mode, MFTP_EXEC_INLINE },
+    [MFTP_CMD_REST] = { MFTP_CMD_REST, mftp_handle_rest, MFTP_EXEC_INLINE },
+    [MFTP_CMD_RANG] = { MFTP_CMD_RANG, mftp_handle_rang, MFTP_EXEC_WORKER },
+    [MFTP_CMD_ALLO] = { MFTP_CMD_ALLO, mftp_handle_allo, MFTP_EXEC_WORKER },  // preallocates file
+    [MFTP_CMD_SEGM] = { MFTP_CMD_SEGM, mftp_handle_segm, MFTP_EXEC_WORKER },
+    [MFTP_CMD_STAT] = { MFTP_CMD_STAT, mftp_handle_stat, MFTP_EXEC_INLINE },
 };
 const size_t command_table_size = sizeof(command_table) / sizeof(command_table[0]);
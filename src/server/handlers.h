@@ -11,12 +11,24 @@ typedef struct {
 
 typedef void (*command_handler_fn)(command_handler_arg_t*);
 
+// where handler runs
+typedef enum {
+    MFTP_EXEC_INLINE,   // cheap and non-blocking - answered directly on the event loop
+    MFTP_EXEC_WORKER,   // may block (filesystem, sleeps) - offloaded to the worker pool
+} command_exec_t;
+
 typedef struct {
     mftp_cmd_t cmd;
     command_handler_fn handler;
+    command_exec_t exec;
 } command_handler_t;
 
-extern const command_handler_t command_table[];
+extern const command_handler_t command_table[MFTP_CMD_INVALID];
+
+// starts watchers for data channel prepared by LIST/RETR/STOR handler (ctx->t_arm_pending). Client's loop only.
+void data_channel_arm(mftp_client_ctx_t* ctx);
+// replies with transfer's result and cleans it up - client's loop only, whichever engine moved the data
+void transfer_complete(mftp_client_ctx_t* ctx, bool ok);
 extern const size_t command_table_size;
 
 #endif
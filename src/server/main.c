@@ -1,10 +1,14 @@
+#define _GNU_SOURCE // accept4(2)
+
 #include <stdio.h>
 #include <signal.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdlib.h>
 
 #include <unistd.h>
 #include <netinet/in.h>
+#include <sys/uio.h>
 
 #include <uev.h>
 
@@ -13,102 +17,90 @@
 #include "shared/cmd.h"
 #include "shared/ini.h"
 #include "shared/passwd.h"
-#include "shared/list.h"
+#include "shared/vector.h"
+#include "shared/slab.h"
 #include "server/ctx.h"
 #include "server/handlers.h"
-
-void term_callback(uev_t *w, void *arg, int events) {
-    puts("");
-    log_warn("%s (signo %d). Shutting down...", strsignal(w->siginfo.ssi_signo), w->siginfo.ssi_signo);
-
+#include "server/workers.h"
+#include "server/dataport.h"
+#include "server/upload.h"
+#include "server/uring.h"
+#include "server/ratelimit.h"
+#include "server/admission.h"
+#include "server/credstore.h"
+
+struct mftp_server;
+
+typedef struct {
+    mftp_server_ctx_t server_ctx;
+    uev_ctx_t loop;
+    uev_t accept_watcher;
+    uev_t stop_watcher;     // posted by main thread on shutdown
+    uev_t reload_watcher;   // posted by main thread once server->cfg was reloaded
+    pthread_t tid;
+    struct mftp_server* server;
+} reactor_t;
+
+typedef struct mftp_server {
+    reactor_t* reactors;    // reactors[0] runs on the main thread
+    size_t reactors_count;
+    worker_pool_t* workers;
+    cred_store_t* creds;
+
+    // latest config snapshot - published by main thread on reload, reactors switch their server_ctx to it when told to.
+    // Snapshots are never modified and never freed before shutdown - threads may still read older ones.
+    const mftp_server_cfg_t* cfg; // use __atomic builtins
+    vector_t cfg_snapshots;     // mftp_server_cfg_t* - every snapshot published by reload, main thread only
+    rate_bucket_t* rate_global; // shared, handed to reactors while cfg->rate_limit is set
+    fair_sched_t* fair;         // shared, handed to reactors while cfg->flags.fair_share is set
+} mftp_server_t;
+
+void reactor_stop_callback(uev_t *w, void *arg, int events) {
     mftp_server_ctx_t *server_ctx = (mftp_server_ctx_t *)arg;
     mftp_server_cleanup_full(server_ctx);
 
     uev_exit(w->ctx);
 }
 
-void client_data_callback(uev_t *w, void *arg, int events) {
-    if (events & UEV_ERROR) {
-        log_err("Error on client socket");
-        return;
-    }
-
-    mftp_client_ctx_t *client_ctx = (mftp_client_ctx_t *)arg;
-
-    /* Read raw data from client */
-
-    char buffer[512] = { 0 };
-
-    while (w->active) {
-        ssize_t bytes_read = recv(client_ctx->cmd_fd, buffer, sizeof(buffer), 0);
-
-        if (bytes_read == 0) {
-            goto disconnect;
-        } else if (bytes_read < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                // wait for more data
-                break;
-            }
-
-            log_syserr("Failed to read from client socket");
-            goto disconnect;
-        }
-
-        char* c = buffer;
-        char* j = buffer + 1;
-
-        for (size_t i = 0; i < bytes_read - 1; ++i, ++c, ++j) {
-            if (*c != '\r' || *j != '\n') {
-                continue;
-            }
-            *c = '\0';
-
-            size_t msg_len = c - buffer;
-
-            if (msg_len == 0) {
-                // empty message
-                break;
-            }
-
-            if (msg_len + client_ctx->cmd_buf_len > client_ctx->server_ctx->cfg.max_cmd_size) {
-                mftp_server_msg_t msg = {
-                    .kind = MFTP_MSG_ERR,
-                    .code = MFTP_CODE_GENERAL_FAILURE,
-                    .data = "Command too long - try again",
-                };
+void term_callback(uev_t *w, void *arg, int events) {
+    puts("");
+    log_warn("%s (signo %d). Shutting down...", strsignal(w->siginfo.ssi_signo), w->siginfo.ssi_signo);
 
-                mftp_server_msg_write(client_ctx->cmd_fd, &msg);
-                memset(client_ctx->cmd_buf, 0, client_ctx->cmd_buf_len);
-                client_ctx->cmd_buf_len = 0;
-                break;
-            }
+    mftp_server_t *server = (mftp_server_t *)arg;
 
-            memcpy(client_ctx->cmd_buf + client_ctx->cmd_buf_len, buffer, msg_len);
-            client_ctx->cmd_buf_len += msg_len;
-            client_ctx->cmd_buf[client_ctx->cmd_buf_len] = '\0';
+    // handlers may still reference client contexts - let them finish first
+    worker_pool_stats_t stats = worker_pool_stats(server->workers);
+    log_info("Worker pool: %zu commands run, peak queue %zu/%zu, %zu rejected",
+        stats.submitted, stats.peak_queued, stats.queue_size, stats.rejected);
+    worker_pool_cleanup(server->workers);
 
-            goto process;
-            // }
-        }
+    // every reactor cleans up its own clients on its own thread
+    for (size_t i = 1; i < server->reactors_count; i++) {
+        uev_event_post(&server->reactors[i].stop_watcher);
+    }
+    for (size_t i = 1; i < server->reactors_count; i++) {
+        pthread_join(server->reactors[i].tid, NULL);
     }
 
-    // no full message yet
-    return;
+    mftp_server_cleanup_full(&server->reactors[0].server_ctx);
+
+    uev_exit(w->ctx);
+}
 
-process:
+void client_execute_command(mftp_client_ctx_t *client_ctx, const char *line) {
     /* Parse and handle command */
     mftp_client_msg_t cmd = { 0 };
-    if (!mftp_client_msg_parse(client_ctx->cmd_buf, &cmd)) {
+    if (!mftp_client_msg_parse(line, &cmd)) {
         mftp_server_msg_t msg = {
             .kind = MFTP_MSG_ERR,
             .code = MFTP_CODE_INVALID_COMMAND,
             .data = "Invalid command",
         };
 
-        log_trace("[CLIENT %d] Invalid command: %s", client_ctx->cmd_fd, client_ctx->cmd_buf);
+        log_trace("[CLIENT %d] Invalid command: %s", client_ctx->cmd_fd, line);
 
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
-        goto reset_buffer;
+        client_ctx_reply(client_ctx, &msg);
+        return;
     }
 
     /* Filter out unauthenticated clients */
@@ -120,94 +112,363 @@ process:
             .data = "Not logged in",
         };
 
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
-        goto reset_buffer;
+        client_ctx_reply(client_ctx, &msg);
+        return;
     }
 
     log_trace("[CLIENT %d] %s %s", client_ctx->cmd_fd, mftp_ctoa(cmd.cmd), cmd.cmd == MFTP_CMD_PASS ? "********" : cmd.data);
 
-    /* Find and execute command handler */
+    /* Execute command handler */
+
+    const command_handler_t *entry = &command_table[cmd.cmd];
+
+    if (entry->handler == NULL) {
+        mftp_server_msg_t msg = {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_NOT_IMPLEMENTED,
+            .data = "Command not implemented",
+        };
 
-    bool cmd_implemented = false;
+        client_ctx_reply(client_ctx, &msg);
+        return;
+    }
 
-    for (size_t i = 0; i < command_table_size; i++) {
-        if (command_table[i].cmd != cmd.cmd) continue;
+    command_handler_arg_t handler_arg = {
+        .client_ctx = client_ctx,
+        .cmd = cmd,
+    };
 
-        cmd_implemented = true;
+    if (entry->exec == MFTP_EXEC_INLINE) {
+        entry->handler(&handler_arg);
+    } else if (worker_pool_submit(client_ctx->server_ctx->workers, entry->handler, &handler_arg)) {
+        client_ctx->busy = true;
+    } else {
+        log_warn("[CLIENT %d] Worker pool saturated - rejecting %s", client_ctx->cmd_fd, mftp_ctoa(cmd.cmd));
 
-        command_handler_arg_t* handler_arg = malloc(sizeof(command_handler_arg_t));
-        if (handler_arg == NULL) {
-            log_syserr("Failed to allocate memory for command handler argument");
+        mftp_server_msg_t msg = {
+            .kind = MFTP_MSG_ERR,
+            .code = MFTP_CODE_BUSY,
+            .data = "Server busy - try again",
+        };
+
+        client_ctx_reply(client_ctx, &msg);
+    }
+}
+
+// Runs complete commands waiting in client's input buffer, in order. Stops early when a command
+// is handed to the worker pool (the rest waits for client_notify_callback) or too many replies are queued.
+void client_process_input(mftp_client_ctx_t *client_ctx) {
+    ringbuf_t *in_buf = &client_ctx->in_buf;
+    size_t max_cmd_size = mftp_server_cfg(client_ctx->server_ctx)->max_cmd_size;
+
+    while (!client_ctx->busy && !client_ctx->closing && client_ctx->out_buf.len < CLIENT_OUTPUT_HIGH_WATERMARK) {
+        ssize_t line_len = ringbuf_find(in_buf, "\r\n", 2);
+
+        if (line_len < 0) {
+            if (in_buf->len == in_buf->cap) {
+                // buffer full and still no terminator - drop everything up to next CRLF
+                if (!client_ctx->in_discard) {
+                    mftp_server_msg_t msg = {
+                        .kind = MFTP_MSG_ERR,
+                        .code = MFTP_CODE_GENERAL_FAILURE,
+                        .data = "Command too long - try again",
+                    };
+
+                    client_ctx_reply(client_ctx, &msg);
+                }
+
+                client_ctx->in_discard = true;
+                ringbuf_discard(in_buf, in_buf->len - 1); // keep last byte - it may be a '\r'
+            }
             return;
         }
 
-        handler_arg->client_ctx = client_ctx;
-        handler_arg->cmd = cmd;
+        if (client_ctx->in_discard) {
+            client_ctx->in_discard = false;
+            ringbuf_discard(in_buf, line_len + 2);
+            continue;
+        }
+
+        if ((size_t)line_len > max_cmd_size) {
+            mftp_server_msg_t msg = {
+                .kind = MFTP_MSG_ERR,
+                .code = MFTP_CODE_GENERAL_FAILURE,
+                .data = "Command too long - try again",
+            };
+
+            client_ctx_reply(client_ctx, &msg);
+            ringbuf_discard(in_buf, line_len + 2);
+            continue;
+        }
 
-        pthread_create(&client_ctx->cmd_tid, NULL, (pthread_fn)command_table[i].handler, handler_arg);
-        pthread_detach(client_ctx->cmd_tid);    // we won't join anything by hand - cleanup is up to the thread.
+        ringbuf_read(in_buf, client_ctx->cmd_buf, line_len);
+        ringbuf_discard(in_buf, 2);
+        client_ctx->cmd_buf[line_len] = '\0';
 
-        break;
+        if (line_len == 0) continue; // empty message
+
+        client_execute_command(client_ctx, client_ctx->cmd_buf);
     }
+}
 
-    if (!cmd_implemented) {
-        mftp_server_msg_t msg = {
-            .kind = MFTP_MSG_ERR,
-            .code = MFTP_CODE_NOT_IMPLEMENTED,
-            .data = "Command not implemented",
-        };
+static void admission_poll(mftp_server_ctx_t *server_ctx);
 
-        mftp_server_msg_write(client_ctx->cmd_fd, &msg);
+void client_disconnect(mftp_client_ctx_t *client_ctx) {
+    if (client_ctx->busy) {
+        // worker still uses client_ctx - finish once it reports back
+        client_ctx->closing = true;
+        uev_io_stop(client_ctx->cmd_watcher);
+        client_ctx->cmd_events = 0;
+        return;
     }
 
-reset_buffer:
-    client_ctx->cmd_buf_len = 0;
-    return;
+    if (client_ctx_transfer_threads(client_ctx) > 0) {
+        // transfer thread still uses client_ctx - stop it and finish once it exits
+        client_ctx->closing = true;
+        uev_io_stop(client_ctx->cmd_watcher);
+        client_ctx->cmd_events = 0;
+
+        client_ctx_stop_transfer_thread(client_ctx);
+        return;
+    }
 
-disconnect:
     log_info("Client %d disconnected", client_ctx->cmd_fd);
-    mftp_server_remove_client_data_watcher(client_ctx->server_ctx, w);
-    client_ctx_cleanup_full(client_ctx);
+
+    mftp_server_ctx_t *server_ctx = client_ctx->server_ctx;
+    mftp_server_remove_client_data_watcher(server_ctx, client_ctx->cmd_watcher); // frees client_ctx
+
+    // freed slot goes to a waiting connection
+    if (server_ctx->admission.len > 0) admission_poll(server_ctx);
 }
 
-void server_accept_callback(uev_t *w, void *arg, int events) {
+// Writes queued replies with as few writev calls as the socket allows. Returns false if connection is broken.
+bool client_flush(mftp_client_ctx_t *client_ctx) {
+    bool ok = true;
+
+    pthread_mutex_lock(&client_ctx->out_lock);
+
+    while (client_ctx->out_buf.len > 0) {
+        struct iovec iov[2];
+        int iov_count = ringbuf_iov(&client_ctx->out_buf, iov);
+
+        ssize_t written = writev(client_ctx->cmd_fd, iov, iov_count);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_syserr("Failed to write to client socket");
+                ok = false;
+            }
+            break;
+        }
+
+        ringbuf_discard(&client_ctx->out_buf, written);
+    }
+
+    pthread_mutex_unlock(&client_ctx->out_lock);
+    return ok;
+}
+
+// Reads only while nothing blocks command execution, waits for writability while replies are queued.
+void client_update_watcher(mftp_client_ctx_t *client_ctx) {
+    pthread_mutex_lock(&client_ctx->out_lock);
+    size_t out_len = client_ctx->out_buf.len;
+    pthread_mutex_unlock(&client_ctx->out_lock);
+
+    int events = 0;
+    if (!client_ctx->busy && out_len < CLIENT_OUTPUT_HIGH_WATERMARK) events |= UEV_READ;
+    if (out_len > 0) events |= UEV_WRITE;
+
+    if (events == client_ctx->cmd_events) return;
+
+    if (events == 0) {
+        uev_io_stop(client_ctx->cmd_watcher);
+    } else {
+        uev_io_set(client_ctx->cmd_watcher, client_ctx->cmd_fd, events);
+    }
+
+    client_ctx->cmd_events = events;
+}
+
+// Runs whatever can be run now and decides what happens with the connection. client_ctx may be freed after this returns.
+void client_pump(mftp_client_ctx_t *client_ctx) {
+    // flush first - it may bring reply queue below high watermark, letting more commands run
+    if (!client_flush(client_ctx)) {
+        client_disconnect(client_ctx);
+        return;
+    }
+
+    client_process_input(client_ctx);
+
+    // one writev for every reply produced by this batch
+    if (!client_flush(client_ctx)) {
+        client_disconnect(client_ctx);
+        return;
+    }
+
+    if (!client_ctx->busy && (client_ctx->closing || client_ctx->eof)) {
+        client_disconnect(client_ctx);
+        return;
+    }
+
+    client_update_watcher(client_ctx);
+}
+
+static void client_login_failed(mftp_client_ctx_t *client_ctx) {
+    mftp_server_msg_t msg = {
+        .kind = MFTP_MSG_ERR,
+        .code = MFTP_CODE_FORBIDDEN,
+        .data = "Invalid credentials",
+    };
+    client_ctx_reply(client_ctx, &msg);
+
+    client_ctx->busy = false;
+}
+
+void client_login_delay_callback(uev_t *w, void *arg, int events) {
+    mftp_client_ctx_t *client_ctx = (mftp_client_ctx_t *)arg;
+
+    uev_timer_stop(w);
+    slab_free(w);
+    client_ctx->login_delay_watcher = NULL;
+
+    client_login_failed(client_ctx);
+    client_pump(client_ctx);
+}
+
+// failed PASS - answer waits on client's loop, commands after it wait too (client stays busy)
+static void client_login_delay(mftp_client_ctx_t *client_ctx) {
+    client_ctx->login_failed = false;
+
+    uev_t *watcher = slab_alloc(sizeof(uev_t));
+    if (watcher == NULL) {
+        log_syserr("Failed to allocate memory for login delay timer");
+        client_login_failed(client_ctx);
+        return;
+    }
+
+    client_ctx->login_delay_watcher = watcher;
+    uev_timer_init(client_ctx->server_ctx->loop, watcher, client_login_delay_callback, client_ctx, CLIENT_LOGIN_DELAY_MS, 0);
+}
+
+void client_notify_callback(uev_t *w, void *arg, int events) {
     if (events & UEV_ERROR) {
-        log_err("Error on server socket");
+        log_err("Error on client notification event");
         return;
     }
 
     mftp_server_ctx_t *server_ctx = (mftp_server_ctx_t *)arg;
-    if (server_ctx->client_data_watchers.size >= server_ctx->cfg.max_clients) {
-        log_warn("Max clients reached - rejecting connection");
-        return;
+
+    pthread_mutex_lock(&server_ctx->notify_lock);
+    mftp_client_ctx_t *client_ctx = server_ctx->notify_head;
+    server_ctx->notify_head = NULL;
+
+    // take pending events while still holding the lock, so new notifications queue the client again
+    for (mftp_client_ctx_t *c = client_ctx; c != NULL; c = c->notify_next) {
+        c->notify_pending = c->notify_events;
+        c->notify_events = 0;
     }
+    pthread_mutex_unlock(&server_ctx->notify_lock);
+
+    while (client_ctx != NULL) {
+        mftp_client_ctx_t *next = client_ctx->notify_next;
+        client_ctx->notify_next = NULL;
+
+        bool transfer_ok;
+        if ((client_ctx->notify_pending & CLIENT_NOTIFY_TRANSFER) && client_ctx->t_uring && uring_transfer_finished(client_ctx->t_uring, &transfer_ok)) {
+            transfer_complete(client_ctx, transfer_ok);
+        }
+        if (client_ctx->notify_pending & CLIENT_NOTIFY_THREAD_EXIT) transfer_complete(client_ctx, client_ctx->t_thread_ok);
+
+        if ((client_ctx->notify_pending & CLIENT_NOTIFY_DONE) && client_ctx->login_failed) {
+            client_login_delay(client_ctx);
+        } else if (client_ctx->notify_pending & CLIENT_NOTIFY_DONE) {
+            client_ctx->busy = false;
+            if (client_ctx->t_arm_pending) data_channel_arm(client_ctx);
+        }
 
-    int client_cmd_fd = accept(server_ctx->fd, NULL, NULL);
-    if (client_cmd_fd < 0) {
-        log_syserr("Failed to accept client connection");
+        client_pump(client_ctx);
+
+        client_ctx = next;
+    }
+}
+
+void client_data_callback(uev_t *w, void *arg, int events) {
+    mftp_client_ctx_t *client_ctx = (mftp_client_ctx_t *)arg;
+
+    if (events & UEV_ERROR) {
+        log_err("Error on client socket");
+        client_disconnect(client_ctx);
         return;
     }
 
-    mftp_client_ctx_t* client_ctx = malloc(sizeof(mftp_client_ctx_t));
+    /* Read raw data from client */
+
+    while (events & UEV_READ) {
+        size_t avail;
+        char *tail = ringbuf_tail(&client_ctx->in_buf, &avail);
+        if (avail == 0) break; // buffer full - run what we have first
+
+        ssize_t bytes_read = recv(client_ctx->cmd_fd, tail, avail, 0);
+
+        if (bytes_read == 0) {
+            client_ctx->eof = true;
+            break;
+        } else if (bytes_read < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // wait for more data
+                break;
+            }
+
+            log_syserr("Failed to read from client socket");
+            client_disconnect(client_ctx);
+            return;
+        }
+
+        ringbuf_commit(&client_ctx->in_buf, bytes_read);
+    }
+
+    client_pump(client_ctx);
+}
+
+// sets up session for connection that got a client slot - releases the slot if that fails
+static void client_admit(mftp_server_ctx_t *server_ctx, int client_cmd_fd) {
+    mftp_client_ctx_t* client_ctx = slab_alloc(sizeof(mftp_client_ctx_t));
     if (client_ctx == NULL) {
         log_syserr("Failed to allocate memory for client context");
         close(client_cmd_fd);
+        admission_slot_release(server_ctx->clients_total);
         return;
     }
 
     if (!client_ctx_init(client_ctx, client_cmd_fd, server_ctx)) {
         log_err("Failed to initialize client context");
-        free(client_ctx);
+        slab_free(client_ctx);
         close(client_cmd_fd);
+        admission_slot_release(server_ctx->clients_total);
         return;
     }
 
-    uev_t* client_data_watcher = malloc(sizeof(uev_t));
+    uev_t* client_data_watcher = slab_alloc(sizeof(uev_t));
+    if (client_data_watcher == NULL) {
+        log_syserr("Failed to allocate memory for client watcher");
+        client_ctx_cleanup_full(client_ctx); // closes client_cmd_fd
+        admission_slot_release(server_ctx->clients_total);
+        return;
+    }
 
-    uev_io_init(w->ctx, client_data_watcher, client_data_callback, client_ctx, client_cmd_fd, UEV_READ);
-    list_insert(&server_ctx->client_data_watchers, client_data_watcher, LIST_BACK);
+    uev_io_init(server_ctx->loop, client_data_watcher, client_data_callback, client_ctx, client_cmd_fd, UEV_READ);
+    if (!session_table_insert(&server_ctx->sessions, client_data_watcher)) {
+        log_err("Failed to register client session");
+        uev_io_stop(client_data_watcher);
+        slab_free(client_data_watcher);
+        client_ctx_cleanup_full(client_ctx);
+        admission_slot_release(server_ctx->clients_total);
+        return;
+    }
 
     client_ctx->cmd_watcher = client_data_watcher;
+    client_ctx->cmd_events = UEV_READ;
 
     mftp_server_msg_t msg = {
         .kind = MFTP_MSG_OK,
@@ -215,51 +476,353 @@ void server_accept_callback(uev_t *w, void *arg, int events) {
         .data = "Welcome to MFTP server v0.1.69",
     };
 
-    if (!server_ctx->cfg.flags.allow_anonymous) {
+    if (!mftp_server_cfg(server_ctx)->flags.allow_anonymous) {
         strcat(msg.data, "\nAnonymous login is disabled. Login with USER and PASS commands to continue.");
     }
 
-    mftp_server_msg_write(client_cmd_fd, &msg);
+    client_ctx_reply(client_ctx, &msg);
+    client_pump(client_ctx);
+}
+
+// admits waiting connections while there are free slots, turns away the ones that waited too long
+static void admission_poll(mftp_server_ctx_t *server_ctx) {
+    admission_queue_t *queue = &server_ctx->admission;
+
+    while (queue->len > 0 && admission_slot_claim(server_ctx->clients_total, mftp_server_cfg(server_ctx)->max_clients)) {
+        client_admit(server_ctx, admission_queue_pop(queue));
+    }
+
+    int fd;
+    while ((fd = admission_queue_pop_expired(queue)) >= 0) {
+        log_warn("Connection %d waited too long for a free slot - rejecting", fd);
+        admission_reject(fd, mftp_server_cfg(server_ctx)->busy_retry_after);
+    }
+
+    if (queue->len == 0 && queue->timer_on) {
+        uev_timer_stop(&queue->timer);
+        queue->timer_on = false;
+    }
+}
+
+void admission_timer_callback(uev_t *w, void *arg, int events) {
+    if (events & UEV_ERROR) {
+        log_err("Error on admission timer");
+        return;
+    }
+
+    admission_poll((mftp_server_ctx_t *)arg);
+}
+
+// new connection gets a client slot, or waits in the admission queue for one
+static void client_accepted(mftp_server_ctx_t *server_ctx, int client_cmd_fd) {
+    admission_queue_t *queue = &server_ctx->admission;
+
+    // waiting connections go first
+    if (queue->len == 0 && admission_slot_claim(server_ctx->clients_total, mftp_server_cfg(server_ctx)->max_clients)) {
+        client_admit(server_ctx, client_cmd_fd);
+        return;
+    }
+
+    if (!admission_queue_push(queue, client_cmd_fd, mftp_server_cfg(server_ctx)->admission_timeout_ms)) {
+        log_warn("Max clients reached and admission queue is full - rejecting connection");
+        admission_reject(client_cmd_fd, mftp_server_cfg(server_ctx)->busy_retry_after);
+        return;
+    }
+
+    log_info("Max clients reached - connection %d waits for a free slot", client_cmd_fd);
+
+    if (!queue->timer_on) {
+        if (uev_timer_init(server_ctx->loop, &queue->timer, admission_timer_callback, server_ctx, ADMISSION_POLL_MS, ADMISSION_POLL_MS) == 0) {
+            queue->timer_on = true;
+        } else {
+            log_syserr("Failed to start admission timer");
+        }
+    }
+}
+
+// Drains up to cfg.accept_budget pending connections per wakeup - always accepts, connection left in the backlog
+// keeps the listener readable. Whatever is left over waits for the next loop iteration, after other clients' events.
+void server_accept_callback(uev_t *w, void *arg, int events) {
+    if (events & UEV_ERROR) {
+        log_err("Error on server socket");
+        return;
+    }
+
+    mftp_server_ctx_t *server_ctx = (mftp_server_ctx_t *)arg;
+    server_ctx->accept_stats.wakeups++;
+
+    uint32_t budget = mftp_server_cfg(server_ctx)->accept_budget > 0 ? mftp_server_cfg(server_ctx)->accept_budget : 1;
+    for (uint32_t i = 0; i < budget; i++) {
+        int client_cmd_fd = accept4(server_ctx->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_cmd_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) log_syserr("Failed to accept client connection");
+            return;
+        }
+
+        server_ctx->accept_stats.accepted++;
+        client_accepted(server_ctx, client_cmd_fd);
+    }
+
+    // budget ran out - connection storm, see how deep the accept queue got
+    server_ctx->accept_stats.budget_spent++;
+
+    uint32_t queued, capacity;
+    if (socket_accept_queue(server_ctx->fd, &queued, &capacity) && queued > server_ctx->accept_stats.queue_peak) {
+        server_ctx->accept_stats.queue_peak = queued;
+    }
 }
 
 const ini_t get_default_config_ini() {
-    ini_t config = { list_new(ini_section_t) };
+    ini_t config = { vector_new(ini_section_t) };
     
     ini_set(&config, "server", "port", 5555);
     ini_set(&config, "server", "root_dir", "/srv/mftp/fs");
     ini_set(&config, "server", "max_clients", 10);
+    ini_set(&config, "server", "max_transfers", 0);
+    ini_set(&config, "server", "admission_queue_size", 16);
+    ini_set(&config, "server", "admission_timeout", 10000);
+    ini_set(&config, "server", "busy_retry_after", 5);
+    ini_set(&config, "server", "accept_budget", 64);
     ini_set(&config, "server", "max_command_size", 256);
     ini_set(&config, "server", "timeout", 5000);
+    ini_set(&config, "server", "workers", 4);
+    ini_set(&config, "server", "work_queue_size", 256);
+    ini_set(&config, "server", "reactors", 0);
+    ini_set(&config, "server", "pasv_port_min", 0);
+    ini_set(&config, "server", "pasv_port_max", 0);
+    ini_set(&config, "server", "io_uring_rings", 0);
+    ini_set(&config, "server", "rate_limit", 0);
+    ini_set(&config, "server", "rate_burst", 0);
+    ini_set(&config, "server", "session_rate_limit", 0);
+    ini_set(&config, "server", "session_rate_burst", 0);
     ini_set(&config, "server.flags", "allow_anonymous", 1);
+    ini_set(&config, "server.flags", "event_transfers", 1);
+    ini_set(&config, "server.flags", "fair_share", 1);
 
     return config;
 }
 
+// bytes per second (or bytes), negative values mean no limit
+static uint64_t ini_get_rate(ini_t* ini, const char* name) {
+    int value = ini_get_int(ini, "server", name, 0);
+    return value > 0 ? (uint64_t)value : 0;
+}
+
 mftp_server_cfg_t parse_ini_to_cfg(ini_t* ini) {
     mftp_server_cfg_t cfg = {
         .port = ini_get_int(ini, "server", "port", 5555),
         .root_dir = ini_get(ini, "server", "root_dir", "/srv/mftp"),
         .max_clients = ini_get_int(ini, "server", "max_clients", 10),
+        .max_transfers = ini_get_int(ini, "server", "max_transfers", 0),
+        .admission_queue_size = ini_get_int(ini, "server", "admission_queue_size", 16),
+        .admission_timeout_ms = ini_get_int(ini, "server", "admission_timeout", 10000),
+        .busy_retry_after = ini_get_int(ini, "server", "busy_retry_after", 5),
+        .accept_budget = ini_get_int(ini, "server", "accept_budget", 64),
         .max_cmd_size = ini_get_int(ini, "server", "max_command_size", 256),
         .timeout_ms = ini_get_int(ini, "server", "timeout", 5000),
+        .workers = ini_get_int(ini, "server", "workers", 4),
+        .work_queue_size = ini_get_int(ini, "server", "work_queue_size", 256),
+        .reactors = ini_get_int(ini, "server", "reactors", 0),
+        .pasv_port_min = ini_get_int(ini, "server", "pasv_port_min", 0),
+        .pasv_port_max = ini_get_int(ini, "server", "pasv_port_max", 0),
+        .uring_rings = ini_get_int(ini, "server", "io_uring_rings", 0),
+        .rate_limit = ini_get_rate(ini, "rate_limit"),
+        .rate_burst = ini_get_rate(ini, "rate_burst"),
+        .session_rate_limit = ini_get_rate(ini, "session_rate_limit"),
+        .session_rate_burst = ini_get_rate(ini, "session_rate_burst"),
         .flags = {
             .allow_anonymous = ini_get_int(ini, "server.flags", "allow_anonymous", 1),
+            .event_transfers = ini_get_int(ini, "server.flags", "event_transfers", 1),
+            .fair_share = ini_get_int(ini, "server.flags", "fair_share", 1),
         },
     };
 
     return cfg;
 }
 
+// reactor's loop - every tunable changes at once, between two events
+void reactor_reload_callback(uev_t *w, void *arg, int events) {
+    reactor_t *reactor = (reactor_t *)arg;
+    mftp_server_t *server = reactor->server;
+    mftp_server_ctx_t *server_ctx = &reactor->server_ctx;
+
+    const mftp_server_cfg_t *cfg = __atomic_load_n(&server->cfg, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&server_ctx->cfg, cfg, __ATOMIC_RELEASE);
+
+    server_ctx->rate_global = cfg->rate_limit > 0 ? server->rate_global : NULL;
+    server_ctx->fair = cfg->flags.fair_share ? server->fair : NULL;
+
+    // sessions' own buckets take the new limit even if their transfers are already running
+    for (size_t i = 0; i < server_ctx->sessions.count; i++) {
+        mftp_client_ctx_t *client_ctx = (mftp_client_ctx_t *)session_table_at(&server_ctx->sessions, i)->arg;
+        rate_bucket_set(&client_ctx->rate_session, cfg->session_rate_limit, cfg->session_rate_burst);
+    }
+}
+
+// changed tunable - logged and applied
+#define CFG_RELOAD(field, name) \
+    if (cfg.field != old->field) log_info("Config reload: %s %" PRIu64 " -> %" PRIu64, name, (uint64_t)old->field, (uint64_t)cfg.field)
+// changed setting that's only read on startup - logged and kept as it was
+#define CFG_RESTART(field, name) \
+    if (cfg.field != old->field) { log_warn("Config reload: %s changed - restart to apply", name); cfg.field = old->field; }
+
+// main thread - parses config file again and hands changed tunables to the reactors
+void config_reload(mftp_server_t *server) {
+    const char* config_path = get_config_path();
+
+    ini_t config_ini = { vector_new(ini_section_t) };
+    if (!ini_parse(&config_ini, config_path)) {
+        log_err("Failed to reload config from %s, keeping current one", config_path);
+        ini_cleanup(&config_ini);
+        return;
+    }
+
+    const mftp_server_cfg_t *old = server->cfg;
+    mftp_server_cfg_t cfg = parse_ini_to_cfg(&config_ini);
+
+    if (strcmp(cfg.root_dir, old->root_dir) != 0) {
+        log_warn("Config reload: root_dir changed - restart to apply");
+    }
+    cfg.root_dir = old->root_dir; // points into config loaded on startup, this one is freed below
+
+    CFG_RESTART(port, "port");
+    CFG_RESTART(max_cmd_size, "max_command_size");
+    CFG_RESTART(admission_queue_size, "admission_queue_size");
+    CFG_RESTART(workers, "workers");
+    CFG_RESTART(work_queue_size, "work_queue_size");
+    CFG_RESTART(reactors, "reactors");
+    CFG_RESTART(pasv_port_min, "pasv_port_min");
+    CFG_RESTART(pasv_port_max, "pasv_port_max");
+    CFG_RESTART(uring_rings, "io_uring_rings");
+
+    CFG_RELOAD(max_clients, "max_clients");
+    CFG_RELOAD(max_transfers, "max_transfers");
+    CFG_RELOAD(admission_timeout_ms, "admission_timeout");
+    CFG_RELOAD(busy_retry_after, "busy_retry_after");
+    CFG_RELOAD(accept_budget, "accept_budget");
+    CFG_RELOAD(timeout_ms, "timeout");
+    CFG_RELOAD(rate_limit, "rate_limit");
+    CFG_RELOAD(rate_burst, "rate_burst");
+    CFG_RELOAD(session_rate_limit, "session_rate_limit");
+    CFG_RELOAD(session_rate_burst, "session_rate_burst");
+
+    // same as on startup - without any accounts nobody could log in (passwd is reloaded after this, send SIGHUP again)
+    if (!cfg.flags.allow_anonymous && old->flags.allow_anonymous && cred_store_size(server->creds) == 0) {
+        log_warn("Config reload: no user accounts loaded - keeping anonymous login enabled");
+        cfg.flags.allow_anonymous = 1;
+    }
+    CFG_RELOAD(flags.allow_anonymous, "allow_anonymous");
+    CFG_RELOAD(flags.event_transfers, "event_transfers");
+    CFG_RELOAD(flags.fair_share, "fair_share");
+
+    ini_cleanup(&config_ini);
+
+    mftp_server_cfg_t *snapshot = malloc(sizeof(mftp_server_cfg_t));
+    if (snapshot == NULL || vector_push(&server->cfg_snapshots, &snapshot) == NULL) {
+        log_syserr("Failed to allocate memory for reloaded config, keeping current one");
+        free(snapshot);
+        return;
+    }
+    *snapshot = cfg;
+
+    if (cfg.rate_limit != old->rate_limit || cfg.rate_burst != old->rate_burst) {
+        rate_bucket_set(server->rate_global, cfg.rate_limit, cfg.rate_burst);
+    }
+
+    __atomic_store_n(&server->cfg, snapshot, __ATOMIC_RELEASE);
+
+    reactor_reload_callback(&server->reactors[0].reload_watcher, &server->reactors[0], 0);
+    for (size_t i = 1; i < server->reactors_count; i++) {
+        uev_event_post(&server->reactors[i].reload_watcher);
+    }
+}
+
+void hup_callback(uev_t *w, void *arg, int events) {
+    log_info("%s (signo %d). Reloading config and user accounts...", strsignal(w->siginfo.ssi_signo), w->siginfo.ssi_signo);
+
+    mftp_server_t *server = (mftp_server_t *)arg;
+    config_reload(server);
+
+    // parsed off the loop - logins keep using current accounts until new ones are published
+    cred_store_reload(server->creds);
+}
+
+// shared - cfg, creds and pointers to state common to all reactors, copied into reactor's own server_ctx
+bool reactor_init(reactor_t* reactor, int id, const mftp_server_ctx_t* shared) {
+    const mftp_server_cfg_t* cfg = shared->cfg;
+
+    if (uev_init(&reactor->loop) < 0) {
+        log_syserr("Failed to create event loop for reactor %d", id);
+        return false;
+    }
+
+    socket_t server_socket = { 0 };
+    if (!socket_bind_tcp_ex(&server_socket, INADDR_ANY, cfg->port, SOCKET_REUSEPORT)) {
+        log_err("Failed to bind server socket for reactor %d", id);
+        uev_exit(&reactor->loop);
+        return false;
+    }
+
+    if (listen(server_socket.fd, cfg->max_clients) < 0) {
+        log_syserr("Failed to listen on server socket");
+        socket_cleanup(&server_socket);
+        uev_exit(&reactor->loop);
+        return false;
+    }
+
+    reactor->server_ctx = *shared;
+    reactor->server_ctx.id = id;
+    reactor->server_ctx.loop = &reactor->loop;
+    reactor->server_ctx.fd = server_socket.fd;
+    if (!session_table_init(&reactor->server_ctx.sessions, cfg->max_clients)) {
+        socket_cleanup(&server_socket);
+        uev_exit(&reactor->loop);
+        return false;
+    }
+
+    if (!admission_queue_init(&reactor->server_ctx.admission, cfg->admission_queue_size)) {
+        session_table_cleanup(&reactor->server_ctx.sessions);
+        socket_cleanup(&server_socket);
+        uev_exit(&reactor->loop);
+        return false;
+    }
+
+    pthread_mutex_init(&reactor->server_ctx.notify_lock, NULL);
+
+    uev_io_init(&reactor->loop, &reactor->accept_watcher, server_accept_callback, &reactor->server_ctx, server_socket.fd, UEV_READ);
+    uev_event_init(&reactor->loop, &reactor->stop_watcher, reactor_stop_callback, &reactor->server_ctx);
+    uev_event_init(&reactor->loop, &reactor->reload_watcher, reactor_reload_callback, reactor);
+    uev_event_init(&reactor->loop, &reactor->server_ctx.notify_watcher, client_notify_callback, &reactor->server_ctx);
+
+    return true;
+}
+
+void* reactor_thread(void* arg) {
+    reactor_t* reactor = (reactor_t*)arg;
+
+    uev_run(&reactor->loop, 0);
+
+    return NULL;
+}
+
 int main(int argc, char* argv[]) {
     log_cfg.level = LOG_TRACE;
 
+    // peer closing its data connection mid-transfer must fail that transfer, not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    if (!mftp_cmd_selfcheck()) {
+        return 1;
+    }
+
     const char* config_path = get_config_path();
 
     // load config
 
     log_trace("Loading config from %s", config_path);
     
-    ini_t config_ini = { list_new(ini_section_t) };
+    ini_t config_ini = { vector_new(ini_section_t) };
     if (!ini_parse(&config_ini, config_path)) {
         ini_cleanup(&config_ini);
         config_ini = get_default_config_ini();
@@ -286,9 +849,24 @@ int main(int argc, char* argv[]) {
     log_trace("  Port: %d", s_cfg.port);
     log_trace("  Root directory: %s", s_cfg.root_dir);
     log_trace("  Max clients: %d", s_cfg.max_clients);
+    log_trace("  Max transfers: %d", s_cfg.max_transfers);
+    log_trace("  Accept budget: %d per wakeup", s_cfg.accept_budget);
+    log_trace("  Admission queue: %d per reactor, %d ms (retry after %d s)", s_cfg.admission_queue_size, s_cfg.admission_timeout_ms, s_cfg.busy_retry_after);
     log_trace("  Max command size: %d", s_cfg.max_cmd_size);
     log_trace("  Timeout: %d ms", s_cfg.timeout_ms);
+    log_trace("  Workers: %d (queue size %d)", s_cfg.workers, s_cfg.work_queue_size);
+    log_trace("  Reactors: %d", s_cfg.reactors);
+    if (s_cfg.pasv_port_min > 0) {
+        log_trace("  Passive ports: %d-%d", s_cfg.pasv_port_min, s_cfg.pasv_port_max);
+    } else {
+        log_trace("  Passive ports: ephemeral");
+    }
+    log_trace("  io_uring rings: %d", s_cfg.uring_rings);
+    log_trace("  Rate limit: %" PRIu64 " B/s (burst %" PRIu64 "), per session %" PRIu64 " B/s (burst %" PRIu64 ")",
+        s_cfg.rate_limit, s_cfg.rate_burst, s_cfg.session_rate_limit, s_cfg.session_rate_burst);
     log_trace("  Allow anonymous: %s", s_cfg.flags.allow_anonymous ? "yes" : "no");
+    log_trace("  Event-driven transfers: %s", s_cfg.flags.event_transfers ? "yes" : "no");
+    log_trace("  Fair share scheduling: %s", s_cfg.flags.fair_share ? "yes" : "no");
 
     // verify root directory
 
@@ -304,55 +882,183 @@ int main(int argc, char* argv[]) {
 
     log_trace("Loading user accounts from %s", db_path);
 
-    passwd_t s_creds = { .entries = list_new(passwd_entry_t) };
-    if (!passwd_parse(&s_creds, db_path)) {
+    cred_store_t creds;
+    bool creds_loaded;
+    if (!cred_store_init(&creds, db_path, &creds_loaded)) {
+        ini_cleanup(&config_ini);
+        return 1;
+    }
+    if (!creds_loaded) {
         log_err("Failed to parse passwd file, enabling anonymous login");
         s_cfg.flags.allow_anonymous = 1;
     }
 
-    log_trace("Loaded %zu users from passwd file", s_creds.entries.size);
+    log_trace("Loaded %zu users from passwd file", cred_store_size(&creds));
 
-    struct uev_ctx loop;
-    uev_init(&loop);
+    // sessions and their watchers come from preallocated slabs - connection churn doesn't hit malloc
+    slab_reserve(sizeof(mftp_client_ctx_t), s_cfg.max_clients);
+    slab_reserve(s_cfg.max_cmd_size + 1, s_cfg.max_clients);
+    slab_reserve(sizeof(uev_t), 3 * (size_t)s_cfg.max_clients); // command watcher, data listener and its timeout
 
-    socket_t server_socket = { 0 };
-    if (!socket_bind_tcp(&server_socket, INADDR_ANY, s_cfg.port)) {
-        log_err("Failed to bind server socket");
+    worker_pool_t workers;
+    if (!worker_pool_init(&workers, s_cfg.workers, s_cfg.work_queue_size)) {
+        log_err("Failed to start worker pool");
+        cred_store_cleanup(&creds);
+        ini_cleanup(&config_ini);
         return 1;
     }
 
-    if (listen(server_socket.fd, s_cfg.max_clients) < 0) {
-        log_syserr("Failed to listen on server socket");
-        socket_cleanup(&server_socket);
+    data_port_pool_t data_ports = { 0 };
+    if (s_cfg.pasv_port_min > 0 && !data_port_pool_init(&data_ports, s_cfg.pasv_port_min, s_cfg.pasv_port_max)) {
+        log_err("Failed to bind passive port range");
+        worker_pool_cleanup(&workers);
+        cred_store_cleanup(&creds);
+        ini_cleanup(&config_ini);
         return 1;
     }
 
-    mftp_server_ctx_t server_ctx = {
-        .loop = &loop,
-        .cfg = s_cfg,
-        .fd = server_socket.fd,
-        .creds = s_creds,
-        .client_data_watchers = list_new(uev_t),
+    size_t reactors_count = s_cfg.reactors;
+    if (reactors_count == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        reactors_count = cpus > 0 ? (size_t)cpus : 1;
+    }
+
+    log_trace("Starting %zu reactor(s)", reactors_count);
+
+    uint64_t listen_overflows = 0;
+    bool listen_overflows_known = socket_listen_overflows(&listen_overflows);
+
+    size_t clients_total = 0;
+    size_t transfers_total = 0;
+
+    upload_registry_t uploads;
+    upload_registry_init(&uploads);
+
+    uring_engine_t uring = { 0 };
+    if (s_cfg.uring_rings > 0 && !uring_engine_init(&uring, s_cfg.uring_rings)) {
+        log_warn("io_uring transfer engine unavailable - running transfers on threads");
+    }
+
+    // set up even if unlimited, so that config reload can turn it on
+    rate_bucket_t rate_global;
+    rate_bucket_init(&rate_global, s_cfg.rate_limit, s_cfg.rate_burst);
+
+    rate_user_registry_t rate_users;
+    rate_user_registry_init(&rate_users);
+
+    fair_sched_t fair;
+    fair_sched_init(&fair);
+
+    const mftp_server_ctx_t shared = {
+        .cfg = &s_cfg,
+        .creds = &creds,
+        .workers = &workers,
+        .data_ports = data_ports.ports != NULL ? &data_ports : NULL,
+        .uploads = &uploads,
+        .uring = uring.rings != NULL ? &uring : NULL,
+        .rate_global = s_cfg.rate_limit > 0 ? &rate_global : NULL,
+        .rate_users = &rate_users,
+        .fair = s_cfg.flags.fair_share ? &fair : NULL,
+        .clients_total = &clients_total,
+        .transfers_total = &transfers_total,
     };
 
-    uev_t server_watcher;
-    uev_io_init(&loop, &server_watcher, server_accept_callback, &server_ctx, server_socket.fd, UEV_READ);
+    mftp_server_t server = {
+        .reactors = calloc(reactors_count, sizeof(reactor_t)),
+        .reactors_count = 0,
+        .workers = &workers,
+        .creds = &creds,
+        .cfg = &s_cfg,
+        .cfg_snapshots = vector_new(mftp_server_cfg_t*),
+        .rate_global = &rate_global,
+        .fair = &fair,
+    };
+    if (server.reactors == NULL) {
+        log_syserr("Failed to allocate memory for reactors");
+        return 1;
+    }
+
+    for (size_t i = 0; i < reactors_count; i++) {
+        if (!reactor_init(&server.reactors[i], (int)i, &shared)) {
+            return 1;
+        }
+        server.reactors[i].server = &server;
+        server.reactors_count++;
+    }
 
-    uev_t sigint_watcher, sigterm_watcher;
-    uev_signal_init(&loop, &sigint_watcher, term_callback, &server_ctx, SIGINT);
-    uev_signal_init(&loop, &sigterm_watcher, term_callback, &server_ctx, SIGTERM);
+    reactor_t* main_reactor = &server.reactors[0];
+
+    uev_t sigint_watcher, sigterm_watcher, sighup_watcher;
+    uev_signal_init(&main_reactor->loop, &sigint_watcher, term_callback, &server, SIGINT);
+    uev_signal_init(&main_reactor->loop, &sigterm_watcher, term_callback, &server, SIGTERM);
+    uev_signal_init(&main_reactor->loop, &sighup_watcher, hup_callback, &server, SIGHUP);
+
+    // reactor threads must not receive SIGINT/SIGTERM/SIGHUP - those are handled by main loop's signalfd
+    sigset_t all_signals, old_mask;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &old_mask);
+
+    for (size_t i = 1; i < server.reactors_count; i++) {
+        if (pthread_create(&server.reactors[i].tid, NULL, reactor_thread, &server.reactors[i]) != 0) {
+            log_syserr("Failed to start reactor %zu", i);
+            return 1;
+        }
+    }
 
-    log_info("Server started on port %d", s_cfg.port);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
 
-    uev_run(&loop, 0);
+    log_info("Server started on port %d (%zu reactors)", s_cfg.port, server.reactors_count);
+
+    uev_run(&main_reactor->loop, 0);
 
     uev_signal_stop(&sigint_watcher);
     uev_signal_stop(&sigterm_watcher);
-    uev_io_stop(&server_watcher);
+    uev_signal_stop(&sighup_watcher);
+
+    for (size_t i = 0; i < server.reactors_count; i++) {
+        mftp_server_ctx_t* server_ctx = &server.reactors[i].server_ctx;
+        log_info("Reactor %zu: %zu connection(s) accepted in %zu wakeup(s), accept budget ran out %zu time(s), accept queue peak %u",
+            i, server_ctx->accept_stats.accepted, server_ctx->accept_stats.wakeups, server_ctx->accept_stats.budget_spent, server_ctx->accept_stats.queue_peak);
+
+        uev_io_stop(&server.reactors[i].accept_watcher);
+        admission_queue_cleanup(&server.reactors[i].server_ctx.admission);
+        uev_exit(&server.reactors[i].loop);
+        pthread_mutex_destroy(&server.reactors[i].server_ctx.notify_lock);
+    }
+    free(server.reactors);
+
+    vector_iter_t snapshots = vector_iter(&server.cfg_snapshots);
+    mftp_server_cfg_t** snapshot;
+    while ((snapshot = vector_next(&snapshots)) != NULL) free(*snapshot);
+    vector_clear(&server.cfg_snapshots);
+
+    // every client has detached its transfer by now
+    uring_engine_cleanup(&uring);
+    upload_registry_cleanup(&uploads);
+    rate_user_registry_cleanup(&rate_users);
+    fair_sched_cleanup(&fair);
+    rate_bucket_cleanup(&rate_global);
+
+    uint64_t listen_overflows_now;
+    if (listen_overflows_known && socket_listen_overflows(&listen_overflows_now)) {
+        log_info("Accept queue overflows while running: %" PRIu64 " (system-wide)", listen_overflows_now - listen_overflows);
+    }
+
+    if (data_ports.ports != NULL) {
+        log_info("Passive ports: %zu lease(s) refused - range exhausted", data_ports.exhausted);
+        data_port_pool_cleanup(&data_ports);
+    }
+
+    slab_class_stats_t slab_stats_buf[SLAB_MAX_CLASSES];
+    size_t slab_classes = slab_stats(slab_stats_buf, SLAB_MAX_CLASSES);
+    for (size_t i = 0; i < slab_classes; i++) {
+        slab_class_stats_t* st = &slab_stats_buf[i];
+        log_info("Slab %zu B: peak %zu of %zu object(s) in %zu slab(s), %zu still in use",
+            st->size, st->peak, st->capacity, st->slabs, st->in_use);
+    }
+    slab_cleanup();
 
-    passwd_cleanup(&s_creds);
-cleanup:
-    uev_exit(&loop);
+    cred_store_cleanup(&creds);
     ini_cleanup(&config_ini);
     log_info("Server stopped");
     return 0;
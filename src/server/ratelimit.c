@@ -0,0 +1,170 @@
+#include "ratelimit.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "shared/utils.h"
+
+#define NS_PER_SEC 1000000000ull
+// smallest grant worth a syscall - smaller asks wait until this much is there (unless burst itself is smaller)
+#define RATE_QUANTUM (16 * 1024)
+
+uint64_t rate_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+void rate_bucket_init(rate_bucket_t* bucket, uint64_t rate, uint64_t burst) {
+    bucket->rate = rate;
+    bucket->burst = burst > 0 ? burst : rate;
+    bucket->tokens = bucket->burst;
+    bucket->stamp_ns = rate_now_ns();
+    pthread_mutex_init(&bucket->lock, NULL);
+}
+
+void rate_bucket_cleanup(rate_bucket_t* bucket) {
+    pthread_mutex_destroy(&bucket->lock);
+}
+
+// lock must be held
+static void bucket_refill(rate_bucket_t* bucket, uint64_t now) {
+    uint64_t elapsed = now - bucket->stamp_ns;
+    bucket->stamp_ns = now;
+
+    unsigned __int128 earned = (unsigned __int128)elapsed * bucket->rate / NS_PER_SEC;
+    unsigned __int128 tokens = bucket->tokens + earned;
+    bucket->tokens = tokens > bucket->burst ? bucket->burst : (uint64_t)tokens;
+}
+
+void rate_bucket_set(rate_bucket_t* bucket, uint64_t rate, uint64_t burst) {
+    pthread_mutex_lock(&bucket->lock);
+    bucket_refill(bucket, rate_now_ns());
+    bucket->rate = rate;
+    bucket->burst = burst > 0 ? burst : rate;
+    if (bucket->tokens > bucket->burst) bucket->tokens = bucket->burst;
+    pthread_mutex_unlock(&bucket->lock);
+}
+
+static size_t bucket_take(rate_bucket_t* bucket, size_t want, uint64_t now, uint64_t* wait_ns) {
+    pthread_mutex_lock(&bucket->lock);
+    bucket_refill(bucket, now);
+
+    // limit was lifted while a transfer held on to the bucket
+    if (bucket->rate == 0) {
+        pthread_mutex_unlock(&bucket->lock);
+        return want;
+    }
+
+    uint64_t need = want;
+    if (need > RATE_QUANTUM) need = RATE_QUANTUM;
+    if (need > bucket->burst) need = bucket->burst;
+
+    size_t granted = 0;
+    if (bucket->tokens >= need) {
+        granted = bucket->tokens < want ? (size_t)bucket->tokens : want;
+        bucket->tokens -= granted;
+    } else {
+        *wait_ns = (need - bucket->tokens) * NS_PER_SEC / bucket->rate + 1;
+    }
+
+    pthread_mutex_unlock(&bucket->lock);
+    return granted;
+}
+
+static void bucket_refund(rate_bucket_t* bucket, size_t unused) {
+    pthread_mutex_lock(&bucket->lock);
+    bucket->tokens = bucket->tokens + unused > bucket->burst ? bucket->burst : bucket->tokens + unused;
+    pthread_mutex_unlock(&bucket->lock);
+}
+
+void rate_chain_add(rate_chain_t* chain, rate_bucket_t* bucket) {
+    if (bucket == NULL || chain->count == RATE_CHAIN_MAX) return;
+    chain->buckets[chain->count++] = bucket;
+}
+
+bool rate_chain_empty(const rate_chain_t* chain) {
+    return chain->count == 0 && chain->flow == NULL;
+}
+
+size_t rate_chain_take(rate_chain_t* chain, size_t want, uint64_t* wait_ns) {
+    uint64_t now = rate_now_ns();
+    size_t granted = want;
+
+    if (chain->flow != NULL && !fair_flow_ready(chain->flow, now, wait_ns)) return 0;
+
+    for (size_t i = 0; i < chain->count; i++) {
+        size_t got = bucket_take(chain->buckets[i], granted, now, wait_ns);
+
+        // buckets before this one gave more than this one allows - return the difference
+        for (size_t j = 0; j < i; j++) {
+            if (got < granted) bucket_refund(chain->buckets[j], granted - got);
+        }
+
+        granted = got;
+        if (granted == 0) return 0;
+    }
+
+    if (chain->flow != NULL) fair_flow_charge(chain->flow, granted, now);
+    return granted;
+}
+
+void rate_chain_refund(rate_chain_t* chain, size_t unused) {
+    if (unused == 0) return;
+
+    for (size_t i = 0; i < chain->count; i++) {
+        bucket_refund(chain->buckets[i], unused);
+    }
+
+    if (chain->flow != NULL) fair_flow_refund(chain->flow, unused);
+}
+
+void rate_user_registry_init(rate_user_registry_t* reg) {
+    reg->head = NULL;
+    pthread_mutex_init(&reg->lock, NULL);
+}
+
+void rate_user_registry_cleanup(rate_user_registry_t* reg) {
+    rate_user_t* user = reg->head;
+    while (user != NULL) {
+        rate_user_t* next = user->next;
+        rate_bucket_cleanup(&user->bucket);
+        free(user);
+        user = next;
+    }
+    reg->head = NULL;
+
+    pthread_mutex_destroy(&reg->lock);
+}
+
+rate_bucket_t* rate_user_bucket(rate_user_registry_t* reg, const passwd_entry_t* creds) {
+    pthread_mutex_lock(&reg->lock);
+
+    rate_user_t* user;
+    for (user = reg->head; user != NULL; user = user->next) {
+        if (strcmp(user->username, creds->username) == 0) break;
+    }
+
+    if (user == NULL) {
+        user = calloc(1, sizeof(rate_user_t));
+        if (user == NULL) {
+            log_syserr("Failed to allocate memory for user rate limit");
+            pthread_mutex_unlock(&reg->lock);
+            return NULL;
+        }
+
+        strcpy(user->username, creds->username);
+        user->generation = creds->generation;
+        rate_bucket_init(&user->bucket, creds->rate_limit, creds->rate_burst);
+        user->next = reg->head;
+        reg->head = user;
+    } else if (creds->generation > user->generation) {
+        // passwd file was reloaded - transfers already running get the new limits too
+        user->generation = creds->generation;
+        rate_bucket_set(&user->bucket, creds->rate_limit, creds->rate_burst);
+    }
+
+    pthread_mutex_unlock(&reg->lock);
+    return &user->bucket;
+}
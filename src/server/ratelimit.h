@@ -0,0 +1,71 @@
+#ifndef _MFTP_SERVER_RATELIMIT_H_
+#define _MFTP_SERVER_RATELIMIT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "shared/passwd.h"
+#include "server/fairshare.h"
+
+// Token bucket bandwidth shaping. Buckets refill at `rate` bytes per second up to `burst` bytes, every chunk of file
+// data a transfer moves is paid for first. A transfer is shaped by a chain of buckets - global, its user's (shared by
+// all of that user's sessions) and its session's own - and moves only as fast as the emptiest of them allows.
+// Chain can also carry transfer's fair share flow, which has to be ready before any bucket is asked.
+
+typedef struct rate_bucket {
+    uint64_t rate;      // bytes per second
+    uint64_t burst;     // bucket capacity - how much can go out at once after a quiet period
+    uint64_t tokens;
+    uint64_t stamp_ns;  // last refill, CLOCK_MONOTONIC
+    pthread_mutex_t lock;
+} rate_bucket_t;
+
+// burst 0 - one second worth of rate
+void rate_bucket_init(rate_bucket_t* bucket, uint64_t rate, uint64_t burst);
+void rate_bucket_cleanup(rate_bucket_t* bucket);
+// changes limits of a bucket transfers may be using, rate 0 - bucket stops limiting them
+void rate_bucket_set(rate_bucket_t* bucket, uint64_t rate, uint64_t burst);
+
+// CLOCK_MONOTONIC in nanoseconds - time base of buckets and fair share flows
+uint64_t rate_now_ns(void);
+
+#define RATE_CHAIN_MAX 3
+
+typedef struct {
+    rate_bucket_t* buckets[RATE_CHAIN_MAX];
+    size_t count;
+    fair_flow_t* flow;  // NULL - transfer isn't fair share scheduled
+} rate_chain_t;
+
+void rate_chain_add(rate_chain_t* chain, rate_bucket_t* bucket);
+// true if transfer moves data without asking - no buckets and no fair share flow
+bool rate_chain_empty(const rate_chain_t* chain);
+// grants up to want bytes. 0 if flow isn't ready or some bucket is short - *wait_ns says when to ask again.
+size_t rate_chain_take(rate_chain_t* chain, size_t want, uint64_t* wait_ns);
+// gives back part of a grant that wasn't used (short read, EOF, error)
+void rate_chain_refund(rate_chain_t* chain, size_t unused);
+
+// Per-user buckets, created on first transfer of a limited user and shared by all of their sessions. They live
+// as long as the registry - a user can't get a fresh burst by reconnecting.
+typedef struct rate_user {
+    char username[PASSWD_STRING_SIZE];
+    uint32_t generation;    // of passwd entry bucket's limits came from
+    rate_bucket_t bucket;
+    struct rate_user* next;
+} rate_user_t;
+
+typedef struct rate_user_registry {
+    rate_user_t* head;
+    pthread_mutex_t lock;
+} rate_user_registry_t;
+
+void rate_user_registry_init(rate_user_registry_t* reg);
+void rate_user_registry_cleanup(rate_user_registry_t* reg);
+
+// bucket of user from creds (creds->rate_limit must be set), NULL if out of memory. Existing bucket takes limits
+// from creds if they come from a newer passwd reload - sessions that logged in earlier don't bring old ones back.
+rate_bucket_t* rate_user_bucket(rate_user_registry_t* reg, const passwd_entry_t* creds);
+
+#endif
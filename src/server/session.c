@@ -0,0 +1,95 @@
+#include "session.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "shared/utils.h"
+
+bool session_table_init(session_table_t* table, size_t capacity) {
+    *table = (session_table_t) { 0 };
+    if (capacity == 0) capacity = 16;
+
+    table->slots = calloc(capacity, sizeof(session_slot_t));
+    table->live = malloc(capacity * sizeof(uev_t*));
+    if (table->slots == NULL || table->live == NULL) {
+        log_syserr("Failed to allocate memory for session table");
+        free(table->slots);
+        free(table->live);
+        return false;
+    }
+
+    table->slots_cap = table->live_cap = capacity;
+    return true;
+}
+
+void session_table_cleanup(session_table_t* table) {
+    free(table->slots);
+    free(table->live);
+    *table = (session_table_t) { 0 };
+}
+
+// makes fd a valid slot index
+static bool slots_fit(session_table_t* table, int fd) {
+    if ((size_t)fd < table->slots_cap) return true;
+
+    size_t cap = table->slots_cap * 2;
+    while (cap <= (size_t)fd) cap *= 2;
+
+    session_slot_t* slots = realloc(table->slots, cap * sizeof(session_slot_t));
+    if (slots == NULL) {
+        log_syserr("Failed to grow session table");
+        return false;
+    }
+
+    memset(slots + table->slots_cap, 0, (cap - table->slots_cap) * sizeof(session_slot_t));
+    table->slots = slots;
+    table->slots_cap = cap;
+    return true;
+}
+
+bool session_table_insert(session_table_t* table, uev_t* watcher) {
+    int fd = watcher->fd;
+    if (fd < 0 || !slots_fit(table, fd) || table->slots[fd].watcher != NULL) return false;
+
+    if (table->count == table->live_cap) {
+        uev_t** live = realloc(table->live, table->live_cap * 2 * sizeof(uev_t*));
+        if (live == NULL) {
+            log_syserr("Failed to grow session table");
+            return false;
+        }
+        table->live = live;
+        table->live_cap *= 2;
+    }
+
+    session_slot_t* slot = &table->slots[fd];
+    slot->watcher = watcher;
+    slot->index = (uint32_t)table->count;
+
+    table->live[table->count++] = watcher;
+    return true;
+}
+
+uev_t* session_table_remove(session_table_t* table, int fd) {
+    uev_t* watcher = session_table_get(table, fd);
+    if (watcher == NULL) return NULL;
+
+    session_slot_t* slot = &table->slots[fd];
+
+    // last live session takes the freed place
+    uev_t* last = table->live[--table->count];
+    table->live[slot->index] = last;
+    table->slots[last->fd].index = slot->index;
+
+    slot->watcher = NULL;
+
+    return watcher;
+}
+
+uev_t* session_table_get(const session_table_t* table, int fd) {
+    if (fd < 0 || (size_t)fd >= table->slots_cap) return NULL;
+    return table->slots[fd].watcher;
+}
+
+uev_t* session_table_at(const session_table_t* table, size_t i) {
+    return table->live[i];
+}
@@ -0,0 +1,38 @@
+#ifndef _MFTP_SERVER_SESSION_H_
+#define _MFTP_SERVER_SESSION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <uev.h>
+
+// Sessions of one reactor - command watchers indexed by their connection's fd, so lookup, insert and removal are
+// O(1). Live sessions are also kept packed in one array for iteration (shutdown, broadcasts).
+
+typedef struct {
+    uev_t* watcher;     // NULL - no session on this fd
+    uint32_t index;     // position in table->live
+} session_slot_t;
+
+typedef struct session_table {
+    session_slot_t* slots;  // indexed by fd
+    size_t slots_cap;
+    uev_t** live;           // watchers of all sessions, packed
+    size_t count, live_cap;
+} session_table_t;
+
+// capacity - sessions (and fds) expected, table grows past it if needed
+bool session_table_init(session_table_t* table, size_t capacity);
+void session_table_cleanup(session_table_t* table);
+
+// adds session keyed by watcher->fd, false if out of memory or fd is taken
+bool session_table_insert(session_table_t* table, uev_t* watcher);
+// removes session on fd and returns its watcher, NULL if there's none
+uev_t* session_table_remove(session_table_t* table, int fd);
+uev_t* session_table_get(const session_table_t* table, int fd);
+
+// i-th live session, i < table->count. Removing a session moves the last one into its place.
+uev_t* session_table_at(const session_table_t* table, size_t i);
+
+#endif
@@ -0,0 +1,389 @@
+#define _GNU_SOURCE // splice(2), F_SETPIPE_SZ
+
+#include "transfer.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <arpa/inet.h>
+
+#include "shared/utils.h"
+
+// blocks until fd is ready for `events` - used when data socket happens to be non-blocking
+static bool wait_fd(int fd, short events) {
+    struct pollfd pfd = { .fd = fd, .events = events };
+
+    while (poll(&pfd, 1, -1) < 0) {
+        if (errno != EINTR) return false;
+    }
+
+    return !(pfd.revents & (POLLERR | POLLNVAL));
+}
+
+// writes whole buffer to socket, handling short writes
+static bool send_all(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t sent = send(fd, buf, len, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && wait_fd(fd, POLLOUT)) continue;
+            return false;
+        }
+        buf += sent;
+        len -= sent;
+    }
+    return true;
+}
+
+// appends one block header - length in network byte order. Zero-length block ends a transfer.
+static bool send_block_header(int fd, uint32_t len) {
+    uint32_t header = htonl(len);
+    const char* buf = (const char*)&header;
+    size_t left = sizeof(header);
+
+    while (left > 0) {
+        // MSG_MORE - header shares a segment with data that follows
+        ssize_t sent = send(fd, buf, left, MSG_NOSIGNAL | (len > 0 ? MSG_MORE : 0));
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && wait_fd(fd, POLLOUT)) continue;
+            return false;
+        }
+        buf += sent;
+        left -= sent;
+    }
+    return true;
+}
+
+// receives exactly len bytes, false on error or if peer closed before that
+static bool recv_all(int fd, char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t got = recv(fd, buf, len, 0);
+        if (got == 0) return false;
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && wait_fd(fd, POLLIN)) continue;
+            return false;
+        }
+        buf += got;
+        len -= got;
+    }
+    return true;
+}
+
+bool transfer_send_data(mftp_client_ctx_t* ctx, const char* buf, size_t len) {
+    if (ctx->t_block_mode && !send_block_header(ctx->t_fd_out, (uint32_t)len)) return false;
+    return send_all(ctx->t_fd_out, buf, len);
+}
+
+bool transfer_finish(mftp_client_ctx_t* ctx) {
+    if (!ctx->t_block_mode) return true;
+    return send_block_header(ctx->t_fd_out, 0);
+}
+
+size_t transfer_format_entry(char* buf, size_t size, const struct dirent* entry) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) return 0;
+
+    const char* entry_type;
+    switch (entry->d_type) {
+    case DT_DIR:
+        entry_type = "DIRECTORY";
+        break;
+    case DT_REG:
+        entry_type = "FILE";
+        break;
+    default:
+        entry_type = "OTHER";
+        break;
+    }
+
+    int len = snprintf(buf, size, "%s\t%s\r\n", entry_type, entry->d_name);
+    return len > 0 && (size_t)len < size ? (size_t)len : 0;
+}
+
+// longest sleep while waiting for bandwidth - abort shouldn't wait much longer than that
+#define SHAPE_MAX_SLEEP_NS (100 * 1000000ull)
+
+// waits until rate limits and fair share allow moving some of want bytes, returns how many. 0 - transfer was aborted meanwhile.
+static size_t shape_take(mftp_client_ctx_t* ctx, size_t want) {
+    if (rate_chain_empty(&ctx->t_rate)) return want;
+
+    while (ctx->t_active) {
+        uint64_t wait_ns;
+        size_t granted = rate_chain_take(&ctx->t_rate, want, &wait_ns);
+        if (granted > 0) return granted;
+
+        if (wait_ns > SHAPE_MAX_SLEEP_NS) wait_ns = SHAPE_MAX_SLEEP_NS;
+        struct timespec ts = { .tv_sec = wait_ns / 1000000000ull, .tv_nsec = wait_ns % 1000000000ull };
+        nanosleep(&ts, NULL);
+    }
+
+    return 0;
+}
+
+// returns what wasn't used of a grant (used < 0 - nothing was)
+static void shape_refund(mftp_client_ctx_t* ctx, size_t granted, ssize_t used) {
+    if (used < 0) used = 0;
+    if ((size_t)used < granted) rate_chain_refund(&ctx->t_rate, granted - used);
+}
+
+// sends up to limit bytes of file (less only at EOF), *moved says how many
+static bool send_file_buffered(mftp_client_ctx_t* ctx, uint64_t limit, uint64_t* moved) {
+    char buffer[TRANSFER_BUFFER_SIZE];
+
+    while (ctx->t_active && *moved < limit) {
+        size_t want = sizeof(buffer);
+        if (limit - *moved < want) want = limit - *moved;
+        if ((want = shape_take(ctx, want)) == 0) break;
+
+        ssize_t bytes_read = read(ctx->t_fd_in, buffer, want);
+        shape_refund(ctx, want, bytes_read);
+        if (bytes_read == 0) return true;
+        if (bytes_read < 0) {
+            if (errno == EINTR) continue;
+            log_syserr("Failed to read from file");
+            return false;
+        }
+
+        if (!send_all(ctx->t_fd_out, buffer, bytes_read)) {
+            log_syserr("Failed to send file data");
+            return false;
+        }
+        *moved += bytes_read;
+    }
+
+    return true;
+}
+
+// sendfile(2) variant of send_file_buffered
+static bool send_file_range(mftp_client_ctx_t* ctx, uint64_t limit, uint64_t* moved) {
+    while (ctx->t_active && *moved < limit) {
+        size_t want = TRANSFER_CHUNK_SIZE;
+        if (limit - *moved < want) want = limit - *moved;
+        if ((want = shape_take(ctx, want)) == 0) break;
+
+        // NULL offset - kernel advances file position, so buffered fallback can pick up where we stopped
+        ssize_t sent = sendfile(ctx->t_fd_out, ctx->t_fd_in, NULL, want);
+        shape_refund(ctx, want, sent);
+
+        if (sent == 0) return true;
+        if (sent > 0) {
+            *moved += sent;
+            continue;
+        }
+
+        switch (errno) {
+        case EINTR:
+            continue;
+        case EAGAIN:
+            if (wait_fd(ctx->t_fd_out, POLLOUT)) continue;
+            break;
+        case EINVAL:
+        case ENOSYS:
+            // fd type doesn't support sendfile (some special filesystems) - file position is still valid, so fall back
+            return send_file_buffered(ctx, limit, moved);
+        default:
+            break;
+        }
+
+        log_syserr("Failed to send file");
+        return false;
+    }
+
+    return true;
+}
+
+// block mode - file size is taken up front, so every block header is exact
+static bool send_file_blocks(mftp_client_ctx_t* ctx) {
+    struct stat st;
+    if (fstat(ctx->t_fd_in, &st) < 0) {
+        log_syserr("Failed to stat file");
+        return false;
+    }
+
+    off_t start = lseek(ctx->t_fd_in, 0, SEEK_CUR); // REST offset
+    if (start < 0) {
+        log_syserr("Failed to get file position");
+        return false;
+    }
+
+    uint64_t left = start < st.st_size ? (uint64_t)(st.st_size - start) : 0;
+    if (left > ctx->t_limit) left = ctx->t_limit;
+
+    while (ctx->t_active && left > 0) {
+        uint64_t block = left < TRANSFER_CHUNK_SIZE ? left : TRANSFER_CHUNK_SIZE;
+        uint64_t moved = 0;
+
+        if (!send_block_header(ctx->t_fd_out, (uint32_t)block)) {
+            log_syserr("Failed to send block header");
+            return false;
+        }
+        if (!send_file_range(ctx, block, &moved)) return false;
+        if (moved != block) {
+            log_err("File shrunk during transfer");
+            return false;
+        }
+
+        left -= block;
+    }
+
+    return ctx->t_active && transfer_finish(ctx);
+}
+
+bool transfer_send_file(mftp_client_ctx_t* ctx) {
+    if (ctx->t_block_mode) return send_file_blocks(ctx);
+
+    uint64_t moved = 0;
+    return send_file_range(ctx, ctx->t_limit, &moved);
+}
+
+// writes whole buffer to file, handling short writes
+static bool write_all(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        buf += written;
+        len -= written;
+    }
+    return true;
+}
+
+// receives up to limit bytes into file (less only if peer closes), *moved says how many
+static bool recv_file_buffered(mftp_client_ctx_t* ctx, uint64_t limit, uint64_t* moved) {
+    char buffer[TRANSFER_BUFFER_SIZE];
+
+    while (ctx->t_active && *moved < limit) {
+        size_t want = sizeof(buffer);
+        if (limit - *moved < want) want = limit - *moved;
+        if ((want = shape_take(ctx, want)) == 0) break;
+
+        ssize_t bytes_read = recv(ctx->t_fd_in, buffer, want, 0);
+        shape_refund(ctx, want, bytes_read);
+        if (bytes_read == 0) return true;
+        if (bytes_read < 0) {
+            if (errno == EINTR) continue;
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && wait_fd(ctx->t_fd_in, POLLIN)) continue;
+            log_syserr("Failed to read from data channel");
+            return false;
+        }
+
+        if (!write_all(ctx->t_fd_out, buffer, bytes_read)) {
+            log_syserr("Failed to write to file");
+            return false;
+        }
+        *moved += bytes_read;
+    }
+
+    return true;
+}
+
+// splice(2) variant of recv_file_buffered. pipe_fds[0] < 0 - splice isn't usable for this transfer.
+static bool recv_file_range(mftp_client_ctx_t* ctx, int pipe_fds[2], uint64_t limit, uint64_t* moved) {
+    if (pipe_fds[0] < 0) return recv_file_buffered(ctx, limit, moved);
+
+    while (ctx->t_active && *moved < limit) {
+        size_t want = TRANSFER_CHUNK_SIZE;
+        if (limit - *moved < want) want = limit - *moved;
+        if ((want = shape_take(ctx, want)) == 0) break;
+
+        // socket -> pipe
+        ssize_t in_pipe = splice(ctx->t_fd_in, NULL, pipe_fds[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+        shape_refund(ctx, want, in_pipe);
+
+        if (in_pipe == 0) return true;
+        if (in_pipe < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN && wait_fd(ctx->t_fd_in, POLLIN)) continue;
+            if ((errno == EINVAL || errno == ENOSYS) && *moved == 0) {
+                // file or socket type doesn't support splice - nothing consumed yet, so fall back for good
+                close(pipe_fds[0]);
+                close(pipe_fds[1]);
+                pipe_fds[0] = pipe_fds[1] = -1;
+                return recv_file_buffered(ctx, limit, moved);
+            }
+            log_syserr("Failed to splice from data channel");
+            return false;
+        }
+
+        *moved += in_pipe;
+
+        // pipe -> file, data already sitting in the pipe must be drained completely
+        while (in_pipe > 0) {
+            ssize_t out_pipe = splice(pipe_fds[0], NULL, ctx->t_fd_out, NULL, in_pipe, SPLICE_F_MOVE);
+            if (out_pipe < 0) {
+                if (errno == EINTR) continue;
+                log_syserr("Failed to splice to file");
+                return false;
+            }
+            in_pipe -= out_pipe;
+        }
+    }
+
+    return true;
+}
+
+static bool recv_file_blocks(mftp_client_ctx_t* ctx, int pipe_fds[2], uint64_t* total) {
+    while (ctx->t_active) {
+        uint32_t header;
+        if (!recv_all(ctx->t_fd_in, (char*)&header, sizeof(header))) {
+            log_err("Data channel closed inside block transfer");
+            return false;
+        }
+
+        uint64_t block = ntohl(header), moved = 0;
+        if (block == 0) return true; // end marker
+
+        if (block > ctx->t_limit - *total) {
+            log_err("Block goes past end of segment");
+            return false;
+        }
+
+        if (!recv_file_range(ctx, pipe_fds, block, &moved)) return false;
+        if (moved != block) {
+            log_err("Data channel closed inside block");
+            return false;
+        }
+        *total += moved;
+    }
+
+    return true;
+}
+
+bool transfer_recv_file(mftp_client_ctx_t* ctx) {
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) < 0) {
+        log_syserr("Failed to create splice pipe");
+        pipe_fds[0] = pipe_fds[1] = -1;
+    } else {
+        // default pipe holds 64 KiB - try to grow it, so one splice moves a whole chunk. Failure here is harmless.
+        fcntl(pipe_fds[1], F_SETPIPE_SZ, TRANSFER_CHUNK_SIZE);
+    }
+
+    uint64_t moved = 0;
+    bool ok = ctx->t_block_mode ? recv_file_blocks(ctx, pipe_fds, &moved) : recv_file_range(ctx, pipe_fds, ctx->t_limit, &moved);
+
+    // limited receive (SEGM) has to fill its range exactly
+    if (ok && ctx->t_active && ctx->t_limit != UINT64_MAX && moved != ctx->t_limit) {
+        log_err("Data channel closed after %llu of %llu bytes", (unsigned long long)moved, (unsigned long long)ctx->t_limit);
+        ok = false;
+    }
+
+    if (pipe_fds[0] >= 0) {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+    }
+
+    return ok;
+}
@@ -0,0 +1,33 @@
+#ifndef _MFTP_SERVER_TRANSFER_H_
+#define _MFTP_SERVER_TRANSFER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <dirent.h>
+
+#include "server/ctx.h"
+
+// Data channel transfer engine - moves bytes between file descriptors of a client's transfer context.
+
+// max bytes moved by a single sendfile/splice call
+#define TRANSFER_CHUNK_SIZE (1 << 20)
+// size of user-space buffer used when zero-copy path is not available
+#define TRANSFER_BUFFER_SIZE (64 * 1024)
+
+// In block mode (ctx->t_block_mode) every transfer is a sequence of blocks - 4 byte big-endian length followed by
+// that many bytes - ended by a zero-length block, so data connection can carry the next transfer too.
+// File data is shaped by ctx->t_rate - every chunk waits for its bandwidth first.
+// send ctx->t_fd_in (file) to ctx->t_fd_out (socket) - from current file position, at most ctx->t_limit bytes. Uses sendfile(2), falls back to read/send if fd types don't allow it.
+bool transfer_send_file(mftp_client_ctx_t* ctx);
+// receive ctx->t_fd_in (socket) into ctx->t_fd_out (file) - exactly ctx->t_limit bytes, unless it's UINT64_MAX. Uses splice(2) through a pipe, falls back to recv/write.
+bool transfer_recv_file(mftp_client_ctx_t* ctx);
+
+// send buf to ctx->t_fd_out - as one block in block mode
+bool transfer_send_data(mftp_client_ctx_t* ctx, const char* buf, size_t len);
+// send end of transfer marker (block mode only, no-op otherwise)
+bool transfer_finish(mftp_client_ctx_t* ctx);
+
+// LIST line for entry - 0 if it's skipped ("." and "..") or doesn't fit in size
+size_t transfer_format_entry(char* buf, size_t size, const struct dirent* entry);
+
+#endif
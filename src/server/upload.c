@@ -0,0 +1,222 @@
+#include "upload.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "shared/utils.h"
+
+void upload_registry_init(upload_registry_t* reg) {
+    reg->head = NULL;
+    pthread_mutex_init(&reg->lock, NULL);
+}
+
+static void upload_free(upload_t* upload) {
+    free(upload->ranges);
+    free(upload);
+}
+
+void upload_registry_cleanup(upload_registry_t* reg) {
+    upload_t* upload = reg->head;
+    while (upload != NULL) {
+        upload_t* next = upload->next;
+        upload_free(upload);
+        upload = next;
+    }
+    reg->head = NULL;
+
+    pthread_mutex_destroy(&reg->lock);
+}
+
+// lock must be held
+static void upload_unlink(upload_registry_t* reg, upload_t* upload) {
+    for (upload_t** link = &reg->head; *link != NULL; link = &(*link)->next) {
+        if (*link == upload) {
+            *link = upload->next;
+            upload->next = NULL;
+            return;
+        }
+    }
+}
+
+// creates part file with its final size, so segments never extend it (and never fail halfway on ENOSPC)
+static bool part_file_prepare(const char* part_path, uint64_t size) {
+    int fd = open(part_path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+
+    bool ok = ftruncate(fd, (off_t)size) == 0;
+    if (ok && size > 0) {
+        int err = posix_fallocate(fd, 0, (off_t)size);
+        // some filesystems can't preallocate - sparse file from ftruncate will do
+        if (err != 0 && err != EOPNOTSUPP && err != EINVAL) {
+            errno = err;
+            ok = false;
+        }
+    }
+
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+
+    return ok;
+}
+
+upload_t* upload_begin(upload_registry_t* reg, const char* path, uint64_t size) {
+    pthread_mutex_lock(&reg->lock);
+
+    for (upload_t* upload = reg->head; upload != NULL; upload = upload->next) {
+        if (strcmp(upload->path, path) != 0) continue;
+
+        if (upload->size != size) {
+            pthread_mutex_unlock(&reg->lock);
+            errno = EEXIST;
+            return NULL;
+        }
+
+        upload->refs++;
+        pthread_mutex_unlock(&reg->lock);
+        return upload;
+    }
+
+    upload_t* upload = calloc(1, sizeof(upload_t));
+    if (upload == NULL) {
+        pthread_mutex_unlock(&reg->lock);
+        return NULL;
+    }
+
+    // part file lives next to final one - rename on commit stays within one filesystem
+    char dir[PATH_MAX], base[PATH_MAX];
+    strcpy(dir, path);
+    strcpy(base, path);
+    int len = snprintf(upload->part_path, sizeof(upload->part_path), "%s/.%s.part", dirname(dir), basename(base));
+
+    if (len < 0 || (size_t)len >= sizeof(upload->part_path)) {
+        pthread_mutex_unlock(&reg->lock);
+        upload_free(upload);
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    if (!part_file_prepare(upload->part_path, size)) {
+        int saved_errno = errno;
+        pthread_mutex_unlock(&reg->lock);
+        upload_free(upload);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    strcpy(upload->path, path);
+    upload->size = size;
+    upload->refs = 2; // registry + caller
+    upload->next = reg->head;
+    reg->head = upload;
+
+    pthread_mutex_unlock(&reg->lock);
+    return upload;
+}
+
+upload_t* upload_acquire(upload_registry_t* reg, const char* path) {
+    pthread_mutex_lock(&reg->lock);
+
+    upload_t* upload = reg->head;
+    while (upload != NULL && strcmp(upload->path, path) != 0) {
+        upload = upload->next;
+    }
+    if (upload != NULL) upload->refs++;
+
+    pthread_mutex_unlock(&reg->lock);
+    return upload;
+}
+
+void upload_release(upload_registry_t* reg, upload_t* upload) {
+    pthread_mutex_lock(&reg->lock);
+    bool last = --upload->refs == 0;
+    pthread_mutex_unlock(&reg->lock);
+
+    if (last) upload_free(upload);
+}
+
+// merges [start, end) into sorted, non-overlapping ranges. Lock must be held.
+static bool ranges_add(upload_t* upload, uint64_t start, uint64_t end) {
+    size_t i = 0;
+    while (i < upload->ranges_count && upload->ranges[i].end < start) i++;
+
+    // first range that doesn't overlap or touch new one from the right
+    size_t j = i;
+    while (j < upload->ranges_count && upload->ranges[j].start <= end) {
+        if (upload->ranges[j].start < start) start = upload->ranges[j].start;
+        if (upload->ranges[j].end > end) end = upload->ranges[j].end;
+        j++;
+    }
+
+    if (i == j) {
+        // nothing to merge with - insert at i
+        if (upload->ranges_count == upload->ranges_cap) {
+            size_t cap = upload->ranges_cap ? upload->ranges_cap * 2 : 8;
+            upload_range_t* ranges = realloc(upload->ranges, cap * sizeof(upload_range_t));
+            if (ranges == NULL) return false;
+            upload->ranges = ranges;
+            upload->ranges_cap = cap;
+        }
+        memmove(&upload->ranges[i + 1], &upload->ranges[i], (upload->ranges_count - i) * sizeof(upload_range_t));
+        upload->ranges_count++;
+    } else if (j - i > 1) {
+        // [i, j) collapse into i
+        memmove(&upload->ranges[i + 1], &upload->ranges[j], (upload->ranges_count - j) * sizeof(upload_range_t));
+        upload->ranges_count -= j - i - 1;
+    }
+
+    upload->ranges[i] = (upload_range_t) { start, end };
+    return true;
+}
+
+upload_status_t upload_segment_done(upload_registry_t* reg, upload_t* upload, uint64_t offset, uint64_t length) {
+    pthread_mutex_lock(&reg->lock);
+
+    if (upload->committed) {
+        pthread_mutex_unlock(&reg->lock);
+        return UPLOAD_COMMITTED;
+    }
+
+    if (!ranges_add(upload, offset, offset + length)) {
+        log_syserr("Failed to record upload segment");
+        pthread_mutex_unlock(&reg->lock);
+        return UPLOAD_FAILED;
+    }
+
+    if (upload->ranges_count != 1 || upload->ranges[0].start != 0 || upload->ranges[0].end != upload->size) {
+        pthread_mutex_unlock(&reg->lock);
+        return UPLOAD_INCOMPLETE;
+    }
+
+    // whole file is here - done under lock, so exactly one segment commits it
+    if (rename(upload->part_path, upload->path) < 0) {
+        log_syserr("Failed to commit upload %s", upload->path);
+        pthread_mutex_unlock(&reg->lock);
+        return UPLOAD_FAILED;
+    }
+
+    upload->committed = true;
+    upload_unlink(reg, upload);
+    bool last = --upload->refs == 0; // registry's reference
+    pthread_mutex_unlock(&reg->lock);
+
+    if (last) upload_free(upload);
+    return UPLOAD_COMMITTED;
+}
+
+uint64_t upload_received(upload_registry_t* reg, upload_t* upload) {
+    pthread_mutex_lock(&reg->lock);
+
+    uint64_t total = 0;
+    for (size_t i = 0; i < upload->ranges_count; i++) {
+        total += upload->ranges[i].end - upload->ranges[i].start;
+    }
+
+    pthread_mutex_unlock(&reg->lock);
+    return total;
+}
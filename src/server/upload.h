@@ -0,0 +1,58 @@
+#ifndef _MFTP_SERVER_UPLOAD_H_
+#define _MFTP_SERVER_UPLOAD_H_
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+// Segmented uploads. ALLO declares final size - file is preallocated under a temporary name and registered here.
+// SEGM transfers (any session, any reactor) write their own byte ranges; once received ranges cover the whole
+// file, it's renamed to its final name.
+
+typedef struct {
+    uint64_t start, end; // [start, end)
+} upload_range_t;
+
+typedef struct upload {
+    char path[PATH_MAX];        // final name
+    char part_path[PATH_MAX];   // where segments are written until upload is complete
+    uint64_t size;
+
+    upload_range_t* ranges;     // received so far - sorted, merged
+    size_t ranges_count, ranges_cap;
+
+    size_t refs;                // registry + every session writing a segment
+    bool committed;
+    struct upload* next;
+} upload_t;
+
+typedef struct upload_registry {
+    upload_t* head;
+    pthread_mutex_t lock;
+} upload_registry_t;
+
+typedef enum {
+    UPLOAD_INCOMPLETE,
+    UPLOAD_COMMITTED,
+    UPLOAD_FAILED,
+} upload_status_t;
+
+void upload_registry_init(upload_registry_t* reg);
+// drops bookkeeping only - unfinished part files stay on disk, ALLO with the same size picks them up again
+void upload_registry_cleanup(upload_registry_t* reg);
+
+// ALLO - registers (or joins, if size matches) upload of path. NULL on failure, errno describes it
+// (EEXIST - same path is being uploaded with a different size).
+upload_t* upload_begin(upload_registry_t* reg, const char* path, uint64_t size);
+// SEGM - takes a reference to registered upload of path, NULL if there is none
+upload_t* upload_acquire(upload_registry_t* reg, const char* path);
+void upload_release(upload_registry_t* reg, upload_t* upload);
+
+// records [offset, offset + length) as written, commits file when whole of it has arrived
+upload_status_t upload_segment_done(upload_registry_t* reg, upload_t* upload, uint64_t offset, uint64_t length);
+// bytes received so far
+uint64_t upload_received(upload_registry_t* reg, upload_t* upload);
+
+#endif
@@ -0,0 +1,976 @@
+#define _GNU_SOURCE
+
+#include "uring.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <arpa/inet.h>
+#include <linux/io_uring.h>
+
+#include "shared/utils.h"
+#include "shared/vector.h"
+#include "server/ratelimit.h"
+
+#define URING_ENTRIES 256
+// registered buffers per ring - also the most transfers a ring runs at once
+#define URING_BUFFERS 64
+#define URING_BUFFER_SIZE (128 * 1024)
+#define BLOCK_HEADER_SIZE 4
+
+// user_data is xfer pointer with operation tag in low bits, 0 is ring's wake-up read
+enum {
+    OP_WAKE = 0,
+    OP_READ = 1,
+    OP_SEND = 2,
+    OP_RECV = 3,
+    OP_WRITE = 4,
+    OP_TIMER = 5,       // rate limited - waiting for tokens
+    OP_CANCEL = 6,
+    OP_MASK = 7,
+};
+
+// SQEs that can wait for room in the ring - a transfer has at most one operation per tag and a cancel for each
+// outstanding, plus ring's own wake-up read
+#define URING_BACKLOG (URING_BUFFERS * OP_CANCEL + 1)
+
+enum {
+    XFER_READ_SEND,     // linked file read + socket send in flight
+    XFER_SEND_REST,     // rest of a short send
+    XFER_SEND_END,      // block mode end marker
+    XFER_RECV_HEADER,   // block mode header
+    XFER_RECV_DATA,
+    XFER_WRITE,
+};
+
+typedef struct uring_xfer {
+    struct uring* ring;
+    mftp_client_ctx_t* ctx;     // NULL once detached, guarded by ring->lock
+    bool detached;              // guarded by ring->lock
+    bool finished;              // result is in ok, guarded by ring->lock
+    bool ok;
+    bool cancel_sent;
+
+    bool sending;               // RETR/RANG, otherwise STOR/SEGM
+    bool block_mode;
+    bool exact;                 // receive has to fill `left` exactly (SEGM)
+    int file_fd, sock_fd;       // own dups - ctx may close its descriptors at any time
+    int buf_index;
+    char* buf;
+
+    uint64_t file_off;
+    uint64_t left;              // bytes still to move, UINT64_MAX - until EOF
+
+    int state;
+    int inflight;               // submitted operations (including cancels) not completed yet
+    unsigned ops;               // bit per OP_* tag in flight - cancel targets
+    int read_res, send_res;
+    size_t chunk;               // bytes asked from current read
+    size_t granted;             // bandwidth paid for current receive
+    struct __kernel_timespec timeout;
+    size_t data_len, done;      // current send/write and how much of it went through
+
+    unsigned char header[BLOCK_HEADER_SIZE];
+    size_t header_have;
+    uint64_t block_left;
+
+    struct uring_xfer* next;    // ring->xfers or ring->pending
+} uring_xfer_t;
+
+typedef struct uring {
+    int fd;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned sq_entries;
+    unsigned sq_local_tail;     // prepared, not yet published SQEs end here
+    struct io_uring_sqe* sqes;
+    vector_t backlog;           // prepared SQEs that didn't fit in the ring yet, submitted in order
+    bool defer;                 // linked SQEs didn't fit - following ones go to backlog too
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;              // same as sq_ring with IORING_FEAT_SINGLE_MMAP
+    size_t cq_ring_size;
+    size_t sqes_size;
+
+    int wake_fd;
+    uint64_t wake_value;
+
+    char* buffers;
+    int free_buffers[URING_BUFFERS];
+    int free_count;             // guarded by lock
+
+    pthread_mutex_t lock;
+    uring_xfer_t* pending;      // handed over by reactors, guarded by lock
+    bool stopping;              // guarded by lock
+    uring_xfer_t* xfers;        // ring thread only
+
+    pthread_t tid;
+    bool running;
+} uring_t;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* RING SETUP */
+
+static bool ring_probe(int fd) {
+    static const int needed[] = { IORING_OP_READ, IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED, IORING_OP_SEND, IORING_OP_RECV, IORING_OP_TIMEOUT, IORING_OP_ASYNC_CANCEL };
+
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = calloc(1, size);
+    if (probe == NULL) return false;
+
+    bool ok = sys_io_uring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+
+    for (size_t i = 0; ok && i < sizeof(needed) / sizeof(needed[0]); i++) {
+        ok = needed[i] <= probe->last_op && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+
+    free(probe);
+    return ok;
+}
+
+static void ring_cleanup(uring_t* r) {
+    if (r->sqes) munmap(r->sqes, r->sqes_size);
+    if (r->cq_ring && r->cq_ring != r->sq_ring) munmap(r->cq_ring, r->cq_ring_size);
+    if (r->sq_ring) munmap(r->sq_ring, r->sq_ring_size);
+    if (r->fd >= 0) close(r->fd);
+    if (r->wake_fd >= 0) close(r->wake_fd);
+    free(r->buffers);
+    vector_clear(&r->backlog);
+
+    pthread_mutex_destroy(&r->lock);
+    memset(r, 0, sizeof(*r));
+    r->fd = r->wake_fd = -1;
+}
+
+static bool ring_init(uring_t* r) {
+    memset(r, 0, sizeof(*r));
+    r->fd = r->wake_fd = -1;
+    r->backlog = vector_new(struct io_uring_sqe);
+    pthread_mutex_init(&r->lock, NULL);
+
+    // reserved up front - deferring an SQE must not fail
+    if (!vector_reserve(&r->backlog, URING_BACKLOG)) {
+        log_err("Failed to allocate io_uring submission backlog");
+        goto fail;
+    }
+
+    struct io_uring_params params = { 0 };
+    r->fd = sys_io_uring_setup(URING_ENTRIES, &params);
+    if (r->fd < 0) {
+        log_syserr("io_uring_setup failed");
+        goto fail;
+    }
+
+    if (!(params.features & IORING_FEAT_NODROP) || !ring_probe(r->fd)) {
+        log_warn("io_uring lacks features needed by transfer engine");
+        goto fail;
+    }
+
+    r->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_ring_size > r->sq_ring_size) r->sq_ring_size = r->cq_ring_size;
+        r->cq_ring_size = r->sq_ring_size;
+    }
+
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED) {
+        r->sq_ring = NULL;
+        log_syserr("Failed to map io_uring submission ring");
+        goto fail;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ring = r->sq_ring;
+    } else {
+        r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED) {
+            r->cq_ring = NULL;
+            log_syserr("Failed to map io_uring completion ring");
+            goto fail;
+        }
+    }
+
+    r->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        log_syserr("Failed to map io_uring submission entries");
+        goto fail;
+    }
+
+    char* sq = r->sq_ring;
+    char* cq = r->cq_ring;
+    r->sq_head = (unsigned*)(sq + params.sq_off.head);
+    r->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    r->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    r->sq_array = (unsigned*)(sq + params.sq_off.array);
+    r->sq_entries = params.sq_entries;
+    r->sq_local_tail = *r->sq_tail;
+    r->cq_head = (unsigned*)(cq + params.cq_off.head);
+    r->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    r->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // registered once - kernel doesn't have to pin/map user pages for every read and write
+    if (posix_memalign((void**)&r->buffers, 4096, (size_t)URING_BUFFERS * URING_BUFFER_SIZE) != 0) {
+        r->buffers = NULL;
+        log_err("Failed to allocate io_uring buffers");
+        goto fail;
+    }
+
+    struct iovec iov[URING_BUFFERS];
+    for (int i = 0; i < URING_BUFFERS; i++) {
+        iov[i] = (struct iovec) { .iov_base = r->buffers + (size_t)i * URING_BUFFER_SIZE, .iov_len = URING_BUFFER_SIZE };
+        r->free_buffers[i] = i;
+    }
+    r->free_count = URING_BUFFERS;
+
+    if (sys_io_uring_register(r->fd, IORING_REGISTER_BUFFERS, iov, URING_BUFFERS) < 0) {
+        log_syserr("Failed to register io_uring buffers");
+        goto fail;
+    }
+
+    r->wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (r->wake_fd < 0) {
+        log_syserr("Failed to create io_uring wake-up event");
+        goto fail;
+    }
+
+    return true;
+
+fail:
+    ring_cleanup(r);
+    return false;
+}
+
+/* SUBMISSION */
+
+static unsigned ring_space(uring_t* r) {
+    return r->sq_entries - (r->sq_local_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE));
+}
+
+// moves deferred SQEs into free ring slots, whole link chains at a time
+static void ring_drain_backlog(uring_t* r) {
+    struct io_uring_sqe* entries = r->backlog.data;
+    size_t moved = 0;
+
+    while (moved < r->backlog.size) {
+        size_t chain = 1;
+        while (moved + chain < r->backlog.size && (entries[moved + chain - 1].flags & IOSQE_IO_LINK)) chain++;
+        if (chain > ring_space(r)) break;
+
+        for (size_t i = 0; i < chain; i++) {
+            unsigned index = r->sq_local_tail & *r->sq_mask;
+            r->sqes[index] = entries[moved + i];
+            r->sq_array[index] = index;
+            r->sq_local_tail++;
+        }
+        moved += chain;
+    }
+
+    vector_remove_range(&r->backlog, 0, moved);
+    if (r->backlog.size == 0) r->defer = false;
+}
+
+static void ring_flush(uring_t* r, unsigned wait) {
+    while (true) {
+        ring_drain_backlog(r);
+        __atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+
+        unsigned to_submit = r->sq_local_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        // don't sleep while backlog waits for room this submission frees
+        unsigned min_complete = r->backlog.size > 0 ? 0 : wait;
+        if (to_submit == 0 && min_complete == 0) return;
+
+        int ret = sys_io_uring_enter(r->fd, to_submit, min_complete, min_complete ? IORING_ENTER_GETEVENTS : 0);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EBUSY) {
+                // completion queue needs draining first - unsubmitted SQEs stay put, caller reaps and comes back
+                return;
+            }
+
+            log_syserr("io_uring_enter failed");
+            return;
+        }
+
+        if (r->backlog.size == 0 || (unsigned)ret < to_submit) return;
+    }
+}
+
+// makes sure `count` SQEs can be prepared back to back (linked ones must go in one submission). If the ring stays
+// full, they go to backlog instead - so does everything after them, until it's drained.
+static void ring_reserve(uring_t* r, unsigned count) {
+    if (r->defer || r->backlog.size > 0) return;
+    if (ring_space(r) >= count) return;
+
+    ring_flush(r, 0);
+    if (ring_space(r) < count) r->defer = true;
+}
+
+static struct io_uring_sqe* ring_sqe(uring_t* r, int opcode, int fd, const void* addr, unsigned len, uint64_t off, uint64_t user_data) {
+    ring_reserve(r, 1);
+
+    struct io_uring_sqe* sqe;
+    if (r->defer || r->backlog.size > 0) {
+        // never an SQE slot the kernel hasn't consumed yet
+        assert(r->backlog.size < r->backlog.capacity);
+        struct io_uring_sqe blank = { 0 };
+        sqe = vector_push(&r->backlog, &blank);
+    } else {
+        unsigned index = r->sq_local_tail & *r->sq_mask;
+        sqe = &r->sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        r->sq_array[index] = index;
+        r->sq_local_tail++;
+    }
+
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)addr;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->user_data = user_data;
+
+    return sqe;
+}
+
+static void ring_arm_wake(uring_t* r) {
+    ring_sqe(r, IORING_OP_READ, r->wake_fd, &r->wake_value, sizeof(r->wake_value), 0, OP_WAKE);
+}
+
+static void ring_wake(uring_t* r) {
+    uint64_t one = 1;
+    while (write(r->wake_fd, &one, sizeof(one)) < 0 && errno == EINTR);
+}
+
+// returns prepared SQE - valid until the next one is prepared
+static struct io_uring_sqe* xfer_submit(uring_xfer_t* x, int opcode, int fd, const void* addr, unsigned len, uint64_t off, int tag) {
+    struct io_uring_sqe* sqe = ring_sqe(x->ring, opcode, fd, addr, len, off, (uint64_t)(uintptr_t)x | tag);
+
+    switch (opcode) {
+    case IORING_OP_READ_FIXED:
+    case IORING_OP_WRITE_FIXED:
+        sqe->buf_index = x->buf_index;
+        break;
+    case IORING_OP_SEND:
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        break;
+    default:
+        break;
+    }
+
+    x->inflight++;
+    if (tag != OP_CANCEL) x->ops |= 1u << tag;
+
+    return sqe;
+}
+
+/* TRANSFER STATE MACHINE (ring thread only) */
+
+static void xfer_free(uring_xfer_t* x) {
+    uring_t* r = x->ring;
+
+    for (uring_xfer_t** link = &r->xfers; *link != NULL; link = &(*link)->next) {
+        if (*link == x) {
+            *link = x->next;
+            break;
+        }
+    }
+
+    if (x->file_fd >= 0) close(x->file_fd);
+    if (x->sock_fd >= 0) close(x->sock_fd);
+
+    pthread_mutex_lock(&r->lock);
+    r->free_buffers[r->free_count++] = x->buf_index;
+    pthread_mutex_unlock(&r->lock);
+
+    free(x);
+}
+
+static bool xfer_detached(uring_xfer_t* x) {
+    pthread_mutex_lock(&x->ring->lock);
+    bool detached = x->detached;
+    pthread_mutex_unlock(&x->ring->lock);
+    return detached;
+}
+
+// no operation in flight - hands result to client's loop, which detaches the transfer once it's done with it.
+// Frees x, if it's already detached.
+static void xfer_finish(uring_xfer_t* x, bool ok) {
+    close(x->file_fd);
+    close(x->sock_fd);
+    x->file_fd = x->sock_fd = -1;
+
+    // ctx can't go away while lock is held - its cleanup has to detach first
+    pthread_mutex_lock(&x->ring->lock);
+    x->finished = true;
+    x->ok = ok;
+    bool detached = x->detached;
+    if (!detached) client_ctx_notify(x->ctx, CLIENT_NOTIFY_TRANSFER);
+    pthread_mutex_unlock(&x->ring->lock);
+
+    if (detached) xfer_free(x);
+}
+
+static void xfer_fail(uring_xfer_t* x, const char* what, int res) {
+    errno = -res;
+    if (res < 0) log_syserr("%s", what);
+    else log_err("%s", what);
+    xfer_finish(x, false);
+}
+
+// bandwidth for up to want bytes of file data. 0 - rate limit or fair share holds it back, current step is retried when the timeout
+// submitted here completes.
+static size_t xfer_shape(uring_xfer_t* x, size_t want) {
+    uint64_t wait_ns = 0;
+    size_t granted = want;
+
+    // ctx (and its session bucket) is only valid until detach
+    pthread_mutex_lock(&x->ring->lock);
+    if (!x->detached && !rate_chain_empty(&x->ctx->t_rate)) granted = rate_chain_take(&x->ctx->t_rate, want, &wait_ns);
+    pthread_mutex_unlock(&x->ring->lock);
+
+    if (granted == 0) {
+        x->timeout = (struct __kernel_timespec) { .tv_sec = wait_ns / 1000000000ull, .tv_nsec = wait_ns % 1000000000ull };
+        xfer_submit(x, IORING_OP_TIMEOUT, -1, &x->timeout, 1, 0, OP_TIMER);
+    }
+
+    return granted;
+}
+
+static void xfer_refund(uring_xfer_t* x, size_t granted, int used) {
+    if (used < 0) used = 0;
+    if ((size_t)used >= granted) return;
+
+    pthread_mutex_lock(&x->ring->lock);
+    if (!x->detached && !rate_chain_empty(&x->ctx->t_rate)) rate_chain_refund(&x->ctx->t_rate, granted - used);
+    pthread_mutex_unlock(&x->ring->lock);
+}
+
+static void send_step(uring_xfer_t* x) {
+    if (x->left == 0) {
+        if (!x->block_mode) {
+            xfer_finish(x, true);
+            return;
+        }
+
+        memset(x->buf, 0, BLOCK_HEADER_SIZE);
+        x->state = XFER_SEND_END;
+        x->data_len = BLOCK_HEADER_SIZE;
+        x->done = 0;
+        xfer_submit(x, IORING_OP_SEND, x->sock_fd, x->buf, BLOCK_HEADER_SIZE, 0, OP_SEND);
+        return;
+    }
+
+    size_t header = x->block_mode ? BLOCK_HEADER_SIZE : 0;
+    size_t chunk = URING_BUFFER_SIZE - header;
+    if (x->left < chunk) chunk = x->left;
+    if ((chunk = xfer_shape(x, chunk)) == 0) return;
+
+    if (x->block_mode) {
+        uint32_t len = htonl((uint32_t)chunk);
+        memcpy(x->buf, &len, sizeof(len));
+    }
+
+    x->state = XFER_READ_SEND;
+    x->chunk = chunk;
+    x->read_res = x->send_res = 0;
+
+    // short read breaks the link - send comes back -ECANCELED and is redone with what was read
+    ring_reserve(x->ring, 2);
+    struct io_uring_sqe* read = xfer_submit(x, IORING_OP_READ_FIXED, x->file_fd, x->buf + header, chunk, x->file_off, OP_READ);
+    read->flags |= IOSQE_IO_LINK;
+    xfer_submit(x, IORING_OP_SEND, x->sock_fd, x->buf, chunk + header, 0, OP_SEND);
+}
+
+static void send_advance(uring_xfer_t* x) {
+    size_t header = x->block_mode ? BLOCK_HEADER_SIZE : 0;
+
+    switch (x->state) {
+    case XFER_READ_SEND: {
+        xfer_refund(x, x->chunk, x->read_res);
+        if (x->read_res < 0) {
+            xfer_fail(x, "Failed to read from file", x->read_res);
+            return;
+        }
+        if (x->send_res < 0 && x->send_res != -ECANCELED) {
+            xfer_fail(x, "Failed to send file data", x->send_res);
+            return;
+        }
+
+        if (x->read_res == 0) {
+            // end of file - fine when sending up to EOF, but block headers promised more
+            if (x->block_mode) xfer_fail(x, "File shrunk during transfer", 0);
+            else xfer_finish(x, true);
+            return;
+        }
+
+        if ((size_t)x->read_res < x->chunk && x->block_mode) {
+            uint32_t len = htonl((uint32_t)x->read_res);
+            memcpy(x->buf, &len, sizeof(len));
+        }
+
+        x->data_len = x->read_res + header;
+        x->done = x->send_res > 0 ? (size_t)x->send_res : 0;
+        x->file_off += x->read_res;
+        x->left -= x->read_res;
+    } break;
+    case XFER_SEND_REST:
+    case XFER_SEND_END:
+        if (x->send_res <= 0) {
+            xfer_fail(x, "Failed to send file data", x->send_res);
+            return;
+        }
+        x->done += x->send_res;
+        break;
+    }
+
+    if (x->done < x->data_len) {
+        if (x->state != XFER_SEND_END) x->state = XFER_SEND_REST;
+        xfer_submit(x, IORING_OP_SEND, x->sock_fd, x->buf + x->done, x->data_len - x->done, 0, OP_SEND);
+        return;
+    }
+
+    if (x->state == XFER_SEND_END) {
+        xfer_finish(x, true);
+        return;
+    }
+
+    send_step(x);
+}
+
+static void recv_step(uring_xfer_t* x) {
+    if (x->block_mode && x->header_have < BLOCK_HEADER_SIZE) {
+        // exact size - bytes after end marker belong to the next transfer
+        x->state = XFER_RECV_HEADER;
+        xfer_submit(x, IORING_OP_RECV, x->sock_fd, x->buf, BLOCK_HEADER_SIZE - x->header_have, 0, OP_RECV);
+        return;
+    }
+
+    uint64_t want = x->block_mode ? x->block_left : x->left;
+    if (want == 0) {
+        xfer_finish(x, true); // stream mode segment is complete
+        return;
+    }
+    if (want > URING_BUFFER_SIZE) want = URING_BUFFER_SIZE;
+    if ((want = xfer_shape(x, want)) == 0) return;
+
+    x->granted = want;
+    x->state = XFER_RECV_DATA;
+    xfer_submit(x, IORING_OP_RECV, x->sock_fd, x->buf, (unsigned)want, 0, OP_RECV);
+}
+
+static void recv_advance(uring_xfer_t* x, int res) {
+    if (x->state == XFER_RECV_DATA) xfer_refund(x, x->granted, res);
+
+    switch (x->state) {
+    case XFER_RECV_HEADER:
+    case XFER_RECV_DATA:
+        if (res < 0) {
+            xfer_fail(x, "Failed to read from data channel", res);
+            return;
+        }
+        if (res == 0) {
+            if (x->block_mode) xfer_fail(x, "Data channel closed inside block transfer", 0);
+            else if (x->exact && x->left > 0) xfer_fail(x, "Data channel closed before end of segment", 0);
+            else xfer_finish(x, true);
+            return;
+        }
+        break;
+    case XFER_WRITE:
+        if (res <= 0) {
+            xfer_fail(x, "Failed to write to file", res);
+            return;
+        }
+        break;
+    }
+
+    switch (x->state) {
+    case XFER_RECV_HEADER: {
+        memcpy(x->header + x->header_have, x->buf, res);
+        x->header_have += res;
+        if (x->header_have < BLOCK_HEADER_SIZE) break;
+
+        uint32_t len;
+        memcpy(&len, x->header, sizeof(len));
+        x->block_left = ntohl(len);
+
+        if (x->block_left == 0) {
+            if (x->exact && x->left > 0) xfer_fail(x, "End of transfer before end of segment", 0);
+            else xfer_finish(x, true);
+            return;
+        }
+        if (x->block_left > x->left) {
+            xfer_fail(x, "Block goes past end of segment", 0);
+            return;
+        }
+    } break;
+    case XFER_RECV_DATA:
+        x->state = XFER_WRITE;
+        x->data_len = res;
+        x->done = 0;
+        xfer_submit(x, IORING_OP_WRITE_FIXED, x->file_fd, x->buf, res, x->file_off, OP_WRITE);
+        return;
+    case XFER_WRITE:
+        x->done += res;
+        x->file_off += res;
+        if (x->done < x->data_len) {
+            xfer_submit(x, IORING_OP_WRITE_FIXED, x->file_fd, x->buf + x->done, x->data_len - x->done, x->file_off, OP_WRITE);
+            return;
+        }
+
+        x->left -= x->data_len;
+        if (x->block_mode) {
+            x->block_left -= x->data_len;
+            if (x->block_left == 0) x->header_have = 0;
+        }
+        break;
+    }
+
+    recv_step(x);
+}
+
+static void xfer_cancel(uring_xfer_t* x) {
+    x->cancel_sent = true;
+
+    for (int tag = OP_READ; tag < OP_CANCEL; tag++) {
+        if (!(x->ops & (1u << tag))) continue;
+        xfer_submit(x, IORING_OP_ASYNC_CANCEL, -1, (void*)((uintptr_t)x | tag), 0, 0, OP_CANCEL);
+    }
+}
+
+static void xfer_complete_op(uring_xfer_t* x, int tag, int res) {
+    x->inflight--;
+    if (tag == OP_CANCEL) {
+        // cancels only go out for detached transfers
+        if (x->inflight == 0) xfer_free(x);
+        return;
+    }
+
+    x->ops &= ~(1u << tag);
+
+    if (xfer_detached(x)) {
+        // nobody waits for the result - stop as soon as everything in flight is back
+        if (x->inflight == 0) {
+            xfer_free(x);
+        } else if (!x->cancel_sent) {
+            xfer_cancel(x);
+        }
+        return;
+    }
+
+    if (tag == OP_TIMER) {
+        if (x->sending) send_step(x);
+        else recv_step(x);
+        return;
+    }
+
+    if (x->sending) {
+        if (tag == OP_READ) x->read_res = res;
+        else x->send_res = res;
+
+        if (x->inflight == 0) send_advance(x);
+    } else {
+        recv_advance(x, res);
+    }
+}
+
+static void ring_start_pending(uring_t* r, bool* stopping) {
+    pthread_mutex_lock(&r->lock);
+    uring_xfer_t* pending = r->pending;
+    r->pending = NULL;
+    *stopping = r->stopping;
+    pthread_mutex_unlock(&r->lock);
+
+    while (pending != NULL) {
+        uring_xfer_t* x = pending;
+        pending = x->next;
+
+        x->next = r->xfers;
+        r->xfers = x;
+
+        if (x->sending) send_step(x);
+        else recv_step(x);
+    }
+
+    // detach wakes us up - finished transfers are freed, running ones may be stuck on a quiet socket
+    uring_xfer_t* x = r->xfers;
+    while (x != NULL) {
+        uring_xfer_t* next = x->next;
+
+        pthread_mutex_lock(&r->lock);
+        bool detached = x->detached, finished = x->finished;
+        pthread_mutex_unlock(&r->lock);
+
+        if (detached && finished) xfer_free(x);
+        else if (detached && !x->cancel_sent) xfer_cancel(x);
+
+        x = next;
+    }
+}
+
+static void* ring_thread(void* arg) {
+    uring_t* r = (uring_t*)arg;
+    bool stopping = false;
+
+    ring_arm_wake(r);
+
+    // clients are gone by the time engine stops - whatever still runs is dropped in cleanup
+    while (!stopping) {
+        ring_flush(r, 1);
+
+        unsigned head = *r->cq_head;
+        unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        bool woken = false;
+
+        while (head != tail) {
+            struct io_uring_cqe* cqe = &r->cqes[head & *r->cq_mask];
+            uint64_t user_data = cqe->user_data;
+            int res = cqe->res;
+            head++;
+
+            // free slot before handling - handlers may submit and flush
+            __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+
+            if (user_data == OP_WAKE) {
+                woken = true;
+                continue;
+            }
+
+            xfer_complete_op((uring_xfer_t*)(uintptr_t)(user_data & ~(uint64_t)OP_MASK), (int)(user_data & OP_MASK), res);
+        }
+
+        if (woken) {
+            ring_start_pending(r, &stopping);
+            ring_arm_wake(r);
+        }
+    }
+
+    return NULL;
+}
+
+/* PUBLIC API */
+
+bool uring_engine_init(uring_engine_t* engine, size_t rings_count) {
+    *engine = (uring_engine_t) { 0 };
+    if (rings_count == 0) return false;
+
+    engine->rings = calloc(rings_count, sizeof(uring_t));
+    if (engine->rings == NULL) {
+        log_syserr("Failed to allocate memory for io_uring engine");
+        return false;
+    }
+
+    for (size_t i = 0; i < rings_count; i++) {
+        if (!ring_init(&engine->rings[i])) {
+            uring_engine_cleanup(engine);
+            return false;
+        }
+        engine->rings_count++;
+    }
+
+    // ring threads must not take SIGINT/SIGTERM from the main loop
+    sigset_t all_signals, old_mask;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &old_mask);
+
+    bool ok = true;
+    for (size_t i = 0; i < engine->rings_count; i++) {
+        if (pthread_create(&engine->rings[i].tid, NULL, ring_thread, &engine->rings[i]) != 0) {
+            log_syserr("Failed to start io_uring thread");
+            ok = false;
+            break;
+        }
+        engine->rings[i].running = true;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+    if (!ok) uring_engine_cleanup(engine);
+    return ok;
+}
+
+void uring_engine_cleanup(uring_engine_t* engine) {
+    if (engine->rings == NULL) return;
+
+    for (size_t i = 0; i < engine->rings_count; i++) {
+        uring_t* r = &engine->rings[i];
+        if (!r->running) continue;
+
+        pthread_mutex_lock(&r->lock);
+        r->stopping = true;
+        pthread_mutex_unlock(&r->lock);
+
+        ring_wake(r);
+        pthread_join(r->tid, NULL);
+    }
+
+    for (size_t i = 0; i < engine->rings_count; i++) {
+        uring_t* r = &engine->rings[i];
+
+        // handed over, but never started, or still waiting for cancelled operations
+        while (r->pending != NULL) {
+            uring_xfer_t* x = r->pending;
+            r->pending = x->next;
+            x->next = r->xfers;
+            r->xfers = x;
+        }
+        while (r->xfers != NULL) {
+            uring_xfer_t* x = r->xfers;
+            r->xfers = x->next;
+            if (x->file_fd >= 0) close(x->file_fd);
+            if (x->sock_fd >= 0) close(x->sock_fd);
+            free(x);
+        }
+
+        ring_cleanup(r);
+    }
+
+    free(engine->rings);
+    *engine = (uring_engine_t) { 0 };
+}
+
+bool uring_transfer_start(uring_engine_t* engine, mftp_client_ctx_t* ctx) {
+    bool sending;
+    int file_fd, sock_fd;
+
+    switch (ctx->t_kind) {
+    case MFTP_CMD_RETR:
+        sending = true;
+        file_fd = ctx->t_fd_in;
+        sock_fd = ctx->t_fd_out;
+        break;
+    case MFTP_CMD_STOR:
+    case MFTP_CMD_SEGM:
+        sending = false;
+        file_fd = ctx->t_fd_out;
+        sock_fd = ctx->t_fd_in;
+        break;
+    default:
+        return false;
+    }
+
+    // REST/RANG/SEGM already positioned the file - ring uses explicit offsets from here on
+    off_t file_off = lseek(file_fd, 0, SEEK_CUR);
+    if (file_off < 0) return false;
+
+    uint64_t left = ctx->t_limit;
+    if (sending && ctx->t_block_mode) {
+        // every block header must be exact, so the amount is fixed up front
+        struct stat st;
+        if (fstat(file_fd, &st) < 0) return false;
+        uint64_t in_file = file_off < st.st_size ? (uint64_t)(st.st_size - file_off) : 0;
+        if (in_file < left) left = in_file;
+    }
+
+    uring_xfer_t* x = calloc(1, sizeof(uring_xfer_t));
+    if (x == NULL) return false;
+
+    // pick first ring with a free buffer, starting at the next one in turn
+    size_t start = __atomic_fetch_add(&engine->next, 1, __ATOMIC_RELAXED);
+    uring_t* r = NULL;
+
+    for (size_t i = 0; i < engine->rings_count && r == NULL; i++) {
+        uring_t* candidate = &engine->rings[(start + i) % engine->rings_count];
+
+        pthread_mutex_lock(&candidate->lock);
+        if (candidate->free_count > 0 && !candidate->stopping) {
+            x->buf_index = candidate->free_buffers[--candidate->free_count];
+            r = candidate;
+        }
+        pthread_mutex_unlock(&candidate->lock);
+    }
+
+    if (r == NULL) {
+        free(x);
+        return false;
+    }
+
+    x->ring = r;
+    x->ctx = ctx;
+    x->sending = sending;
+    x->block_mode = ctx->t_block_mode;
+    x->exact = !sending && ctx->t_limit != UINT64_MAX;
+    x->file_fd = dup(file_fd);
+    x->sock_fd = dup(sock_fd);
+    x->buf = r->buffers + (size_t)x->buf_index * URING_BUFFER_SIZE;
+    x->file_off = (uint64_t)file_off;
+    x->left = left;
+
+    if (x->file_fd < 0 || x->sock_fd < 0) {
+        log_syserr("Failed to duplicate transfer descriptors");
+        if (x->file_fd >= 0) close(x->file_fd);
+        if (x->sock_fd >= 0) close(x->sock_fd);
+
+        pthread_mutex_lock(&r->lock);
+        r->free_buffers[r->free_count++] = x->buf_index;
+        pthread_mutex_unlock(&r->lock);
+
+        free(x);
+        return false;
+    }
+
+    ctx->t_active = true;
+    ctx->t_uring = x;
+
+    pthread_mutex_lock(&r->lock);
+    x->next = r->pending;
+    r->pending = x;
+    pthread_mutex_unlock(&r->lock);
+
+    ring_wake(r);
+    return true;
+}
+
+bool uring_transfer_finished(uring_xfer_t* x, bool* ok) {
+    pthread_mutex_lock(&x->ring->lock);
+    bool finished = x->finished;
+    *ok = x->ok;
+    pthread_mutex_unlock(&x->ring->lock);
+    return finished;
+}
+
+void uring_transfer_detach(uring_xfer_t* x) {
+    uring_t* r = x->ring;
+
+    pthread_mutex_lock(&r->lock);
+    x->detached = true;
+    x->ctx = NULL;
+    pthread_mutex_unlock(&r->lock);
+
+    // ring thread sends cancels for whatever is still waiting
+    ring_wake(r);
+}
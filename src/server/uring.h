@@ -0,0 +1,37 @@
+#ifndef _MFTP_SERVER_URING_H_
+#define _MFTP_SERVER_URING_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "server/ctx.h"
+
+// io_uring transfer engine. RETR/RANG/STOR/SEGM data channels are driven by a few ring threads instead of one
+// blocking thread per transfer: file -> socket is a linked READ_FIXED -> SEND pair, socket -> file is RECV followed
+// by WRITE_FIXED, both through buffers registered with the ring. Support is probed at startup - without it (old
+// kernel, seccomp) or when every registered buffer is taken, transfers run on the thread path (transfer.c).
+
+struct uring;
+struct uring_xfer;
+
+typedef struct uring_engine {
+    struct uring* rings;
+    size_t rings_count;
+    size_t next;        // ring that gets next transfer, guarded by atomics
+} uring_engine_t;
+
+// false if io_uring (or one of needed opcodes) isn't available - engine is unusable then
+bool uring_engine_init(uring_engine_t* engine, size_t rings_count);
+// every transfer must be detached (client contexts cleaned up) before this
+void uring_engine_cleanup(uring_engine_t* engine);
+
+// client's loop - hands data channel prepared in ctx (t_kind, t_fd_in, t_fd_out, t_limit) to a ring.
+// False if no ring can take it - caller runs the transfer on a thread instead.
+bool uring_transfer_start(uring_engine_t* engine, mftp_client_ctx_t* ctx);
+// client's loop, on CLIENT_NOTIFY_TRANSFER - false if transfer is still running, otherwise *ok is its result
+bool uring_transfer_finished(struct uring_xfer* xfer, bool* ok);
+// any thread - ctx is going away (or transfer was aborted). Ring cancels outstanding operations and will never
+// touch ctx again.
+void uring_transfer_detach(struct uring_xfer* xfer);
+
+#endif
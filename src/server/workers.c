@@ -0,0 +1,140 @@
+#include "workers.h"
+
+#include <stdlib.h>
+#include <signal.h>
+
+#include "shared/utils.h"
+
+static void* worker_thread(void* arg) {
+    worker_pool_t* pool = (worker_pool_t*)arg;
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (true) {
+        while (pool->queue_len == 0 && !pool->stopping) {
+            pthread_cond_wait(&pool->not_empty, &pool->lock);
+        }
+        if (pool->stopping) break;
+
+        worker_task_t task = pool->queue[pool->queue_head];
+        pool->queue_head = (pool->queue_head + 1) % pool->queue_size;
+        pool->queue_len--;
+        pool->busy++;
+
+        pthread_mutex_unlock(&pool->lock);
+        task.handler(&task.arg);
+        client_ctx_notify(task.arg.client_ctx, CLIENT_NOTIFY_DONE);
+        pthread_mutex_lock(&pool->lock);
+
+        pool->busy--;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+bool worker_pool_init(worker_pool_t* pool, size_t threads_count, size_t queue_size) {
+    *pool = (worker_pool_t) { 0 };
+
+    if (threads_count == 0 || queue_size == 0) {
+        log_err("Worker pool needs at least one thread and one queue slot");
+        return false;
+    }
+
+    pool->queue = calloc(queue_size, sizeof(worker_task_t));
+    pool->threads = calloc(threads_count, sizeof(pthread_t));
+    if (pool->queue == NULL || pool->threads == NULL) {
+        log_syserr("Failed to allocate memory for worker pool");
+        free(pool->queue);
+        free(pool->threads);
+        return false;
+    }
+
+    pool->queue_size = queue_size;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->not_empty, NULL);
+
+    // workers inherit signal mask - keep them from stealing SIGINT/SIGTERM meant for the loop's signalfd
+    sigset_t all_signals, old_mask;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &old_mask);
+
+    bool ok = true;
+
+    for (size_t i = 0; i < threads_count; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker_thread, pool) != 0) {
+            log_syserr("Failed to create worker thread");
+            ok = false;
+            break;
+        }
+        pool->threads_count++;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+    if (!ok) worker_pool_cleanup(pool);
+
+    return ok;
+}
+
+void worker_pool_cleanup(worker_pool_t* pool) {
+    if (pool->threads == NULL) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->not_empty);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->threads_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->not_empty);
+    pthread_mutex_destroy(&pool->lock);
+
+    free(pool->threads);
+    free(pool->queue);
+    pool->threads = NULL;
+    pool->queue = NULL;
+    pool->threads_count = 0;
+}
+
+bool worker_pool_submit(worker_pool_t* pool, command_handler_fn handler, const command_handler_arg_t* arg) {
+    pthread_mutex_lock(&pool->lock);
+
+    if (pool->stopping || pool->queue_len == pool->queue_size) {
+        pool->rejected++;
+        pthread_mutex_unlock(&pool->lock);
+        return false;
+    }
+
+    worker_task_t* slot = &pool->queue[(pool->queue_head + pool->queue_len) % pool->queue_size];
+    slot->handler = handler;
+    slot->arg = *arg;
+
+    pool->queue_len++;
+    pool->submitted++;
+    if (pool->queue_len > pool->peak_queued) pool->peak_queued = pool->queue_len;
+
+    pthread_cond_signal(&pool->not_empty);
+    pthread_mutex_unlock(&pool->lock);
+
+    return true;
+}
+
+worker_pool_stats_t worker_pool_stats(worker_pool_t* pool) {
+    pthread_mutex_lock(&pool->lock);
+
+    worker_pool_stats_t stats = {
+        .threads_count = pool->threads_count,
+        .queue_size = pool->queue_size,
+        .busy = pool->busy,
+        .queued = pool->queue_len,
+        .peak_queued = pool->peak_queued,
+        .submitted = pool->submitted,
+        .rejected = pool->rejected,
+    };
+
+    pthread_mutex_unlock(&pool->lock);
+    return stats;
+}
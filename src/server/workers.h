@@ -0,0 +1,55 @@
+#ifndef _MFTP_SERVER_WORKERS_H_
+#define _MFTP_SERVER_WORKERS_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "server/handlers.h"
+
+// Fixed-size pool of threads running command handlers, fed from a bounded FIFO queue.
+
+typedef struct {
+    command_handler_fn handler;
+    command_handler_arg_t arg;  // stored by value - handlers don't own their argument
+} worker_task_t;
+
+typedef struct {
+    size_t threads_count;
+    size_t queue_size;
+    size_t busy;        // workers currently running a handler
+    size_t queued;      // tasks waiting in queue
+    size_t peak_queued; // high-water mark of queued
+    size_t submitted;
+    size_t rejected;    // tasks refused because queue was full
+} worker_pool_stats_t;
+
+typedef struct worker_pool {
+    pthread_t* threads;
+    size_t threads_count;
+
+    worker_task_t* queue; // ring buffer, queue_size slots
+    size_t queue_size;
+    size_t queue_head;
+    size_t queue_len;
+
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    bool stopping;
+
+    // saturation metrics, guarded by lock
+    size_t busy;
+    size_t peak_queued;
+    size_t submitted;
+    size_t rejected;
+} worker_pool_t;
+
+bool worker_pool_init(worker_pool_t* pool, size_t threads_count, size_t queue_size);
+// stops accepting tasks, waits for running handlers to finish and joins all threads. Tasks still queued are dropped.
+void worker_pool_cleanup(worker_pool_t* pool);
+
+// returns false if queue is full - caller should tell client to back off
+bool worker_pool_submit(worker_pool_t* pool, command_handler_fn handler, const command_handler_arg_t* arg);
+worker_pool_stats_t worker_pool_stats(worker_pool_t* pool);
+
+#endif
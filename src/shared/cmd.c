@@ -28,25 +28,102 @@ const char* mftp_cmd_strings[] = {
     "ABOR",
     "MDTM",
     "FEAT",
-    "PWDR"
+    "PWDR",
+    "MODE",
+    "REST",
+    "RANG",
+    "ALLO",
+    "SEGM",
+    "STAT",
+};
+
+// Perfect hash over packed verbs: slot = (verb * MUL) >> (32 - BITS). MUL was picked so that no two verbs share
+// a slot - if you add a command and mftp_cmd_selfcheck starts failing, search for a new multiplier.
+#define VERB_HASH_BITS 6
+#define VERB_HASH_MUL 0xc89da11bu
+#define VERB_SLOT(verb) ((uint32_t)((uint32_t)(verb) * VERB_HASH_MUL) >> (32 - VERB_HASH_BITS))
+
+#define VERB_ENTRY(a, b, c, d, command) [VERB_SLOT(MFTP_VERB(a, b, c, d))] = { MFTP_VERB(a, b, c, d), command }
+
+// empty slots have verb 0, which never matches a packed verb
+static const struct {
+    uint32_t verb;
+    mftp_cmd_t cmd;
+} verb_table[1 << VERB_HASH_BITS] = {
+    VERB_ENTRY('L', 'I', 'S', 'T', MFTP_CMD_LIST),
+    VERB_ENTRY('R', 'E', 'T', 'R', MFTP_CMD_RETR),
+    VERB_ENTRY('S', 'T', 'O', 'R', MFTP_CMD_STOR),
+    VERB_ENTRY('D', 'E', 'L', 'E', MFTP_CMD_DELE),
+    VERB_ENTRY('R', 'M', 'D', 'R', MFTP_CMD_RMDR),
+    VERB_ENTRY('M', 'K', 'D', 'R', MFTP_CMD_MKDR),
+    VERB_ENTRY('C', 'H', 'W', 'D', MFTP_CMD_CHWD),
+    VERB_ENTRY('S', 'I', 'Z', 'E', MFTP_CMD_SIZE),
+    VERB_ENTRY('U', 'S', 'E', 'R', MFTP_CMD_USER),
+    VERB_ENTRY('P', 'A', 'S', 'S', MFTP_CMD_PASS),
+    VERB_ENTRY('W', 'A', 'M', 'I', MFTP_CMD_WAMI),
+    VERB_ENTRY('Q', 'U', 'I', 'T', MFTP_CMD_QUIT),
+    VERB_ENTRY('R', 'N', 'M', 'E', MFTP_CMD_RNME),
+    VERB_ENTRY('N', 'O', 'O', 'P', MFTP_CMD_NOOP),
+    VERB_ENTRY('A', 'B', 'O', 'R', MFTP_CMD_ABOR),
+    VERB_ENTRY('M', 'D', 'T', 'M', MFTP_CMD_MDTM),
+    VERB_ENTRY('F', 'E', 'A', 'T', MFTP_CMD_FEAT),
+    VERB_ENTRY('P', 'W', 'D', 'R', MFTP_CMD_PWDR),
+    VERB_ENTRY('M', 'O', 'D', 'E', MFTP_CMD_MODE),
+    VERB_ENTRY('R', 'E', 'S', 'T', MFTP_CMD_REST),
+    VERB_ENTRY('R', 'A', 'N', 'G', MFTP_CMD_RANG),
+    VERB_ENTRY('A', 'L', 'L', 'O', MFTP_CMD_ALLO),
+    VERB_ENTRY('S', 'E', 'G', 'M', MFTP_CMD_SEGM),
+    VERB_ENTRY('S', 'T', 'A', 'T', MFTP_CMD_STAT),
 };
 
 const char* mftp_ctoa(mftp_cmd_t cmd) {
     return mftp_cmd_strings[cmd];
 }
 
+mftp_cmd_t mftp_verb_to_cmd(uint32_t verb) {
+    uint32_t slot = VERB_SLOT(verb);
+    return verb_table[slot].verb == verb ? verb_table[slot].cmd : MFTP_CMD_INVALID;
+}
+
+// packs (and upper-cases) 4 letters starting at str. Returns 0 if any of them is not a letter.
+static uint32_t verb_pack(const char* str) {
+    uint32_t verb = 0;
+
+    for (int i = 0; i < 4; i++) {
+        unsigned char c = (unsigned char)str[i] & ~0x20; // ASCII upper-case
+        if (c < 'A' || c > 'Z') return 0;
+        verb |= (uint32_t)c << (8 * i);
+    }
+
+    return verb;
+}
+
 mftp_cmd_t mftp_atoc(const char* cmd) {
-    for (int i = 0; i < sizeof(mftp_cmd_strings) / sizeof(mftp_cmd_strings[0]); i++) {
-        if (strcmp(mftp_cmd_strings[i], cmd) == 0) {
-            return i;
+    if (strlen(cmd) != 4) return MFTP_CMD_INVALID;
+
+    uint32_t verb = verb_pack(cmd);
+    return verb ? mftp_verb_to_cmd(verb) : MFTP_CMD_INVALID;
+}
+
+bool mftp_cmd_selfcheck(void) {
+    for (int i = 0; i < MFTP_CMD_INVALID; i++) {
+        if (mftp_atoc(mftp_cmd_strings[i]) != (mftp_cmd_t)i) {
+            log_err("Command verb %s collides in verb hash table", mftp_cmd_strings[i]);
+            return false;
         }
     }
-    return MFTP_CMD_INVALID;
+    return true;
+}
+
+int mftp_server_msg_format(char* buf, size_t size, const mftp_server_msg_t* msg) {
+    int len = snprintf(buf, size, "%s %d %s\r\n", msg->kind == MFTP_MSG_OK ? "OK" : "ERROR", msg->code, msg->data);
+    if (len >= 0 && (size_t)len >= size) len = (int)size - 1;
+    return len;
 }
 
 bool mftp_server_msg_write(int fd, mftp_server_msg_t* msg) {
     char buf[512];
-    int len = snprintf(buf, sizeof(buf), "%s %d %s\r\n", msg->kind == MFTP_MSG_OK ? "OK" : "ERROR", msg->code, msg->data);
+    int len = mftp_server_msg_format(buf, sizeof(buf), msg);
     if (len < 0) {
         log_syserr("Failed to format server message");
         return false;
@@ -62,40 +139,35 @@ bool mftp_client_msg_parse(const char* buffer, mftp_client_msg_t* msg) {
     assert(buffer != NULL);
     assert(msg != NULL);
 
-    char* buffer_clone = malloc(strlen(buffer) + 1);
-    if (buffer_clone == NULL) {
-        log_syserr("Failed to allocate memory for buffer clone");
-        return false;
-    }
-    memcpy(buffer_clone, buffer, strlen(buffer) + 1);
+    const char* whitespace = " \t\n\r\f\v";
 
-    strip(&buffer_clone);
+    const char* c = buffer;
+    while (*c && strchr(whitespace, *c)) c++;
 
-    char* token = strtok(buffer_clone, " ");
-    if (!token) {
-        free(buffer_clone);
-        return false;
-    }
+    // verb - exactly four letters, followed by end of line or a space
+    if (c[0] == '\0' || c[1] == '\0' || c[2] == '\0' || c[3] == '\0') return false;
 
-    to_upper(token);
+    uint32_t verb = verb_pack(c);
+    if (verb == 0) return false;
 
-    mftp_cmd_t cmd = mftp_atoc(token);
-    if (cmd == MFTP_CMD_INVALID) {
-        free(buffer_clone);
-        return false;
-    }
+    c += 4;
+    if (*c != '\0' && !strchr(whitespace, *c)) return false;
 
-    token = strtok(NULL, "\0");
-    if (token && strlen(token) > sizeof(msg->data) - 1) {
-        free(buffer_clone);
-        return false;
-    }
+    mftp_cmd_t cmd = mftp_verb_to_cmd(verb);
+    if (cmd == MFTP_CMD_INVALID) return false;
+
+    // argument - everything after separating spaces, without trailing whitespace
+    while (*c == ' ') c++;
+
+    const char* end = c + strlen(c);
+    while (end > c && strchr(whitespace, end[-1])) end--;
+
+    size_t data_len = end - c;
+    if (data_len > sizeof(msg->data) - 1) return false;
 
     msg->cmd = cmd;
-    if (token) {
-        strcpy(msg->data, token);
-    }
+    memcpy(msg->data, c, data_len);
+    msg->data[data_len] = '\0';
 
-    free(buffer_clone);
     return true;
 }
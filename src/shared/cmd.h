@@ -2,6 +2,8 @@
 #define _MFTP_SHARED_CMD_H_
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
 
 typedef enum {
     MFTP_CMD_LIST,       // list contents of served directory. WARNING: This command opens data channel;
@@ -22,6 +24,12 @@ typedef enum {
     MFTP_CMD_MDTM,       // get last modification time;
     MFTP_CMD_FEAT,       // list commands available on the server. WARNING: This command opens data channel;;
     MFTP_CMD_PWDR,       // get current working directory;
+    MFTP_CMD_MODE,       // select transfer mode - STREAM (default) or BLOCK (persistent, framed data channel);
+    MFTP_CMD_REST,       // set byte offset the next RETR/STOR starts at;
+    MFTP_CMD_RANG,       // retrieve byte range of file. WARNING: This command opens data channel;
+    MFTP_CMD_ALLO,       // begin segmented upload - declare final file size;
+    MFTP_CMD_SEGM,       // store byte range of segmented upload. WARNING: This command opens data channel;
+    MFTP_CMD_STAT,       // get bandwidth shares of users with transfers in progress;
 
     MFTP_CMD_INVALID
 } mftp_cmd_t;
@@ -31,6 +39,14 @@ extern const char* mftp_cmd_strings[];
 const char* mftp_ctoa(mftp_cmd_t cmd);
 mftp_cmd_t mftp_atoc(const char* cmd);
 
+// Every command verb is exactly four ASCII letters - packed into uint32 (in memory order) they can be
+// looked up with one multiply and shift (see verb_table in cmd.c).
+#define MFTP_VERB(a, b, c, d) ((uint32_t)(a) | (uint32_t)(b) << 8 | (uint32_t)(c) << 16 | (uint32_t)(d) << 24)
+
+mftp_cmd_t mftp_verb_to_cmd(uint32_t verb);
+// checks that every verb in mftp_cmd_strings resolves to its own command - fails if hash multiplier needs changing
+bool mftp_cmd_selfcheck(void);
+
 typedef enum {
     MFTP_CODE_OPENING_DATA_CHANNEL = 120,
     MFTP_CODE_GENERAL_SUCCESS = 200,
@@ -76,6 +92,8 @@ typedef struct {
     char data[256];
 } mftp_server_msg_t;
 
+// formats msg as a CRLF terminated line, returns its length (may be truncated to size - 1) or -1 on error
+int mftp_server_msg_format(char* buf, size_t size, const mftp_server_msg_t* msg);
 bool mftp_server_msg_write(int fd, mftp_server_msg_t* msg);
 
 #endif
@@ -12,10 +12,10 @@
 
 // Helper function to trim whitespace
 static ini_section_t* find_section(ini_t* ini, const char* section) {
-    list_iter_t iter = list_iter(&ini->sections);
+    vector_iter_t iter = vector_iter(&ini->sections);
     ini_section_t* current;
-    
-    while ((current = list_next(&iter)) != NULL) {
+
+    while ((current = vector_next(&iter)) != NULL) {
         if (strcmp(current->name, section) == 0) {
             return current;
         }
@@ -37,21 +37,17 @@ static bool parse_line(ini_t* ini, char* line, ini_section_t** current_section)
         }
         *end = '\0';
 
-        ini_section_t* new_section = malloc(sizeof(ini_section_t));
-        if (!new_section) {
-            log_syserr("Failed to allocate memory for new section");
-            return false;
-        }
-        strncpy(new_section->name, trimmed + 1, INI_BLOB_SIZE - 1);
-        new_section->entries = list_new(ini_entry_t);
+        ini_section_t new_section = { .entries = vector_new(ini_entry_t) };
+        strncpy(new_section.name, trimmed + 1, INI_BLOB_SIZE - 1);
 
-        if (!list_insert(&ini->sections, new_section, LIST_BACK)) {
-            log_err("Failed to insert new section into list");
-            free(new_section);
+        // may move sections that came before - only the newest one is kept by the caller
+        ini_section_t* section = vector_push(&ini->sections, &new_section);
+        if (!section) {
+            log_syserr("Failed to allocate memory for new section");
             return false;
         }
 
-        *current_section = new_section;
+        *current_section = section;
         return true;
     }
 
@@ -88,19 +84,12 @@ static bool parse_line(ini_t* ini, char* line, ini_section_t** current_section)
         *end = '\0';
     }
 
-    ini_entry_t* entry = malloc(sizeof(ini_entry_t));
-    if (!entry) {
-        log_syserr("Failed to allocate memory for new entry");
-        return false;
-    }
+    ini_entry_t entry = { .type = INI_STRING };
+    strncpy(entry.name, key, INI_BLOB_SIZE - 1);
+    strncpy(entry.value.s, value, INI_BLOB_SIZE - 1);
 
-    strncpy(entry->name, key, INI_BLOB_SIZE - 1);
-    entry->type = INI_STRING;
-    strncpy(entry->value.s, value, INI_BLOB_SIZE - 1);
-
-    if (!list_insert(&(*current_section)->entries, entry, LIST_BACK)) {
-        log_err("Failed to insert new entry into list");
-        free(entry);
+    if (!vector_push(&(*current_section)->entries, &entry)) {
+        log_syserr("Failed to allocate memory for new entry");
         return false;
     }
 
@@ -134,13 +123,13 @@ bool ini_parse(ini_t* ini, const char* filename) {
 void ini_cleanup(ini_t* ini) {
     if (!ini) return;
 
-    list_iter_t iter = list_iter(&ini->sections);
+    vector_iter_t iter = vector_iter(&ini->sections);
     ini_section_t* section;
-    
-    while ((section = list_next(&iter)) != NULL) {
-        if (section->entries.size > 0) list_clear(&section->entries);
+
+    while ((section = vector_next(&iter)) != NULL) {
+        vector_clear(&section->entries);
     }
-    list_clear(&ini->sections);
+    vector_clear(&ini->sections);
 }
 
 const char* ini_get_blob(ini_t* ini, const char* section, const char* name, const char* def) {
@@ -149,10 +138,10 @@ const char* ini_get_blob(ini_t* ini, const char* section, const char* name, cons
     ini_section_t* sec = find_section(ini, section);
     if (!sec) return def;
 
-    list_iter_t iter = list_iter(&sec->entries);
+    vector_iter_t iter = vector_iter(&sec->entries);
     ini_entry_t* entry;
 
-    while ((entry = list_next(&iter)) != NULL) {
+    while ((entry = vector_next(&iter)) != NULL) {
         if (strcmp(entry->name, name) == 0) {
             return entry->value.s;
         }
@@ -188,34 +177,22 @@ bool ini_set_blob(ini_t* ini, const char* section, const char* name, const char*
 
     ini_section_t* sec = find_section(ini, section);
     if (!sec) {
-        sec = malloc(sizeof(ini_section_t));
+        ini_section_t new_section = { .entries = vector_new(ini_entry_t) };
+        strncpy(new_section.name, section, INI_BLOB_SIZE - 1);
+
+        sec = vector_push(&ini->sections, &new_section);
         if (!sec) {
             log_syserr("Failed to allocate memory for new section");
             return false;
         }
-        strncpy(sec->name, section, INI_BLOB_SIZE - 1);
-        sec->entries = list_new(ini_entry_t);
-
-        if (!list_insert(&ini->sections, sec, LIST_BACK)) {
-            log_err("Failed to insert new section into list");
-            free(sec);
-            return false;
-        }
     }
 
-    ini_entry_t* entry = malloc(sizeof(ini_entry_t));
-    if (!entry) {
-        log_syserr("Failed to allocate memory for new entry");
-        return false;
-    }
+    ini_entry_t entry = { .type = INI_STRING };
+    strncpy(entry.name, name, INI_BLOB_SIZE - 1);
+    strncpy(entry.value.s, value, INI_BLOB_SIZE - 1);
 
-    strncpy(entry->name, name, INI_BLOB_SIZE - 1);
-    entry->type = INI_STRING;
-    strncpy(entry->value.s, value, INI_BLOB_SIZE - 1);
-
-    if (!list_insert(&sec->entries, entry, LIST_BACK)) {
-        log_err("Failed to insert new entry into list");
-        free(entry);
+    if (!vector_push(&sec->entries, &entry)) {
+        log_syserr("Failed to allocate memory for new entry");
         return false;
     }
 
@@ -235,18 +212,18 @@ bool ini_save(ini_t* ini, const char* filename) {
         return false;
     }
 
-    list_iter_t iter = list_iter(&ini->sections);
+    vector_iter_t iter = vector_iter(&ini->sections);
     ini_section_t* section;
 
     fprintf(file, "; WARNING: File auto-generated by mftp-server\n");
 
-    while ((section = list_next(&iter)) != NULL) {
+    while ((section = vector_next(&iter)) != NULL) {
         fprintf(file, "[%s]\n", section->name);
 
-        list_iter_t entry_iter = list_iter(&section->entries);
+        vector_iter_t entry_iter = vector_iter(&section->entries);
         ini_entry_t* entry;
 
-        while ((entry = list_next(&entry_iter)) != NULL) {
+        while ((entry = vector_next(&entry_iter)) != NULL) {
             fprintf(file, "%s = %s\n", entry->name, entry->value.s);
         }
     }
@@ -1,7 +1,7 @@
 #ifndef _MFTP_SHARED_INI_H_
 #define _MFTP_SHARED_INI_H_
 
-#include "list.h"
+#include "vector.h"
 #include <stdbool.h>
 
 // simple INI file parser
@@ -22,11 +22,11 @@ typedef struct {
 
 typedef struct _ini_section_s {
     char name[INI_BLOB_SIZE];
-    list_t entries;
+    vector_t entries;
 } ini_section_t;
 
 typedef struct {
-    list_t sections;
+    vector_t sections;
 } ini_t;
 
 bool ini_parse(ini_t* ini, const char* filename);
@@ -1,13 +1,96 @@
 #include "passwd.h"
 
 #include "utils.h"
-#include "list.h"
+#include "vector.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
 
+#define PASSWD_INDEX_EMPTY UINT32_MAX
+
+// FNV-1a
+static uint32_t username_hash(const char* username) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char* c = (const unsigned char*)username; *c; c++) {
+        hash ^= *c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool index_build(passwd_t* passwd) {
+    free(passwd->index);
+    passwd->index = NULL;
+    passwd->index_mask = 0;
+
+    if (passwd->entries.size >= PASSWD_INDEX_EMPTY / 2) {
+        log_err("Too many passwd entries: %zu", passwd->entries.size);
+        return false;
+    }
+
+    // at most half full - probe sequences stay short
+    size_t size = 16;
+    while (size < passwd->entries.size * 2) size *= 2;
+
+    passwd->index = malloc(size * sizeof(uint32_t));
+    if (passwd->index == NULL) {
+        log_syserr("Failed to allocate memory for passwd index");
+        return false;
+    }
+    memset(passwd->index, 0xff, size * sizeof(uint32_t));
+    passwd->index_mask = size - 1;
+
+    for (size_t i = 0; i < passwd->entries.size; i++) {
+        const passwd_entry_t* entry = vector_at(&passwd->entries, i);
+        size_t slot = username_hash(entry->username) & passwd->index_mask;
+
+        for (;;) {
+            uint32_t taken = passwd->index[slot];
+            if (taken == PASSWD_INDEX_EMPTY) {
+                passwd->index[slot] = (uint32_t)i;
+                break;
+            }
+            if (strcmp(((passwd_entry_t*)vector_at(&passwd->entries, taken))->username, entry->username) == 0) {
+                log_warn("Duplicate passwd entry for user %s - only the first one is used", entry->username);
+                break;
+            }
+            slot = (slot + 1) & passwd->index_mask;
+        }
+    }
+
+    return true;
+}
+
+static const passwd_entry_t* index_lookup(const passwd_t* passwd, const char* username) {
+    if (passwd->index == NULL) return NULL;
+
+    size_t slot = username_hash(username) & passwd->index_mask;
+    uint32_t i;
+
+    while ((i = passwd->index[slot]) != PASSWD_INDEX_EMPTY) {
+        const passwd_entry_t* entry = vector_at(&passwd->entries, i);
+        if (strcmp(entry->username, username) == 0) return entry;
+        slot = (slot + 1) & passwd->index_mask;
+    }
+
+    return NULL;
+}
+
+// stored password is NUL padded to PASSWD_STRING_SIZE - all of it is compared, no matter where the first difference is
+static bool password_equal(const char* stored, const char* given) {
+    size_t given_len = strnlen(given, PASSWD_STRING_SIZE);
+    unsigned char diff = given_len == PASSWD_STRING_SIZE; // too long to ever match
+
+    for (size_t i = 0; i < PASSWD_STRING_SIZE; i++) {
+        unsigned char c = i < given_len ? (unsigned char)given[i] : 0;
+        diff |= (unsigned char)stored[i] ^ c;
+    }
+
+    return diff == 0;
+}
+
 bool passwd_parse(passwd_t* passwd, const char* filename) {
     FILE* file = fopen(filename, "r");
     if (!file) {
@@ -15,7 +98,7 @@ bool passwd_parse(passwd_t* passwd, const char* filename) {
         return false;
     }
 
-    char line[PASSWD_STRING_SIZE * 3];
+    char line[PASSWD_STRING_SIZE * 4];
     size_t line_num = 1;
 
     while (fgets(line, sizeof(line), file)) {
@@ -29,6 +112,9 @@ bool passwd_parse(passwd_t* passwd, const char* filename) {
         char* username = NULL;
         char* password = NULL;
         char* perms = NULL;
+        char* rate_limit = NULL;
+        char* rate_burst = NULL;
+        char* weight = NULL;
 
         char* p = line;
         char* colon;
@@ -57,53 +143,79 @@ bool passwd_parse(passwd_t* passwd, const char* filename) {
             }
         }
 
-        // Extract permissions
+        if (p) {
+            size_t len = strlen(p);
+            if (len > 0 && p[len - 1] == '\n') {
+                p[len - 1] = '\0';
+            }
+        }
+
+        // Extract permissions and optional rate limit fields
         if (p) {
             perms = p;
-            size_t len = strlen(perms);
-            if (len > 0 && perms[len - 1] == '\n') {
-                perms[len - 1] = '\0';
+            colon = strchr(p, ':');
+            if (colon) {
+                *colon = '\0';
+                rate_limit = colon + 1;
+                colon = strchr(rate_limit, ':');
+                if (colon) {
+                    *colon = '\0';
+                    rate_burst = colon + 1;
+                    colon = strchr(rate_burst, ':');
+                    if (colon) {
+                        *colon = '\0';
+                        weight = colon + 1;
+                    }
+                }
             }
         }
 
         // password can be empty - meaning no password
 
-        passwd_entry_t* entry = malloc(sizeof(passwd_entry_t));
-        if (entry == NULL) {
+        passwd_entry_t entry = { 0 };
+
+        strncpy(entry.username, username, PASSWD_STRING_SIZE - 1);
+        if (password) strncpy(entry.password, password, PASSWD_STRING_SIZE - 1);
+        entry.perms = perms ? str_to_perm(perms) : 0;
+        entry.rate_limit = rate_limit ? strtoull(rate_limit, NULL, 10) : 0;
+        entry.rate_burst = rate_burst ? strtoull(rate_burst, NULL, 10) : 0;
+        entry.weight = weight ? (uint32_t)strtoul(weight, NULL, 10) : 0;
+
+        if (vector_push(&passwd->entries, &entry) == NULL) {
             log_syserr("Failed to allocate memory for passwd entry");
             fclose(file);
             return false;
         }
-
-        strncpy(entry->username, username, PASSWD_STRING_SIZE);
-        entry->password ? strncpy(entry->password, password, PASSWD_STRING_SIZE) : strcpy(entry->password, "");
-        entry->perms = str_to_perm(perms);
-
-        list_insert(&passwd->entries, entry, LIST_BACK);
         line_num++;
     }
 
     fclose(file);
 
-    return true;
+    return index_build(passwd);
 }
 
 void passwd_cleanup(passwd_t* passwd) {
     if (!passwd) return;
-    list_clear(&passwd->entries);
+    vector_clear(&passwd->entries);
+    free(passwd->index);
+    passwd->index = NULL;
+    passwd->index_mask = 0;
 }
 
-uint8_t passwd_check(const passwd_t* passwd, const char* username, const char* password) {
-    list_iter_t iter = list_iter(&passwd->entries);
-    passwd_entry_t* entry;
+const passwd_entry_t* passwd_find(const passwd_t* passwd, const char* username, const char* password) {
+    static const char no_password[PASSWD_STRING_SIZE] = { 0 };
 
-    while ((entry = list_next(&iter)) != NULL) {
-        if (strcmp(entry->username, username) == 0 && strcmp(entry->password, password) == 0) {
-            return entry->perms;
-        }
-    }
+    const passwd_entry_t* entry = index_lookup(passwd, username);
+
+    // unknown users pay for the comparison too, so response time doesn't tell which usernames exist
+    bool match = password_equal(entry ? entry->password : no_password, password);
 
-    return 0;
+    return entry && match ? entry : NULL;
+}
+
+uint8_t passwd_check(const passwd_t* passwd, const char* username, const char* password) {
+    const passwd_entry_t* entry = passwd_find(passwd, username, password);
+    return entry ? entry->perms : 0;
 }
 
 const char* perm_to_str(uint8_t perms) {
@@ -143,13 +255,16 @@ bool passwd_save(passwd_t* passwd, const char* filename) {
         return false;
     }
 
-    list_iter_t iter = list_iter(&passwd->entries);
+    vector_iter_t iter = vector_iter(&passwd->entries);
     passwd_entry_t* entry;
 
     fprintf(file, "; WARNING: file autogenerated by mftp-server\n");
 
-    while ((entry = list_next(&iter)) != NULL) {
-        fprintf(file, "%s:%s:%s\n", entry->username, entry->password, perm_to_str(entry->perms));
+    while ((entry = vector_next(&iter)) != NULL) {
+        fprintf(file, "%s:%s:%s", entry->username, entry->password, perm_to_str(entry->perms));
+        if (entry->rate_limit > 0 || entry->weight > 0) fprintf(file, ":%llu:%llu", (unsigned long long)entry->rate_limit, (unsigned long long)entry->rate_burst);
+        if (entry->weight > 0) fprintf(file, ":%u", (unsigned)entry->weight);
+        fputc('\n', file);
     }
 
     fclose(file);
@@ -2,8 +2,10 @@
 #define _MFTP_SHARED_PASSWD_H_
 
 // simple parser for custom, /etc/paswswd-like files
+// line format: username:password:perms[:rate_limit[:rate_burst[:weight]]] - optional limits in bytes per second / bytes
+// and fair share weight
 
-#include "list.h"
+#include "vector.h"
 
 #include <stdint.h>
 #include <stdbool.h>
@@ -18,16 +20,25 @@ typedef struct {
     char username[PASSWD_STRING_SIZE];
     char password[PASSWD_STRING_SIZE];
     uint8_t perms;
+    uint64_t rate_limit;    // bandwidth shared by all of user's sessions, 0 - unlimited
+    uint64_t rate_burst;    // 0 - one second worth of rate_limit
+    uint32_t weight;        // share of bandwidth when users compete for it, 0 - default
+    uint32_t generation;    // reload the entry came from - newer entries override limits taken from older ones
 } passwd_entry_t;
 
 typedef struct {
-    list_t entries;
+    vector_t entries;
+    uint32_t* index;    // open addressing table of positions in entries, by username hash - built by passwd_parse
+    size_t index_mask;  // table size - 1, size is a power of two
 } passwd_t;
 
 bool passwd_parse(passwd_t* passwd, const char* filename);
 void passwd_cleanup(passwd_t* passwd);
 
 uint8_t passwd_check(const passwd_t* passwd, const char* username, const char* password);
+// entry matching both username and password, NULL if there is none. Username is looked up in the index, password
+// comparison takes the same time wherever it differs - and whether the user exists or not
+const passwd_entry_t* passwd_find(const passwd_t* passwd, const char* username, const char* password);
 
 bool passwd_save(passwd_t* passwd, const char* filename);
 
@@ -0,0 +1,124 @@
+#include "ringbuf.h"
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "utils.h"
+
+bool ringbuf_init(ringbuf_t* rb, size_t cap) {
+    assert(rb != NULL);
+    assert(cap > 0);
+
+    rb->data = malloc(cap);
+    if (rb->data == NULL) {
+        log_syserr("Failed to allocate memory for ring buffer");
+        return false;
+    }
+
+    rb->cap = cap;
+    rb->head = 0;
+    rb->len = 0;
+
+    return true;
+}
+
+void ringbuf_cleanup(ringbuf_t* rb) {
+    if (!rb) return;
+
+    free(rb->data);
+    rb->data = NULL;
+    rb->cap = rb->head = rb->len = 0;
+}
+
+char* ringbuf_tail(ringbuf_t* rb, size_t* avail) {
+    size_t tail = (rb->head + rb->len) % rb->cap;
+
+    if (rb->len == rb->cap) {
+        *avail = 0;
+    } else if (tail >= rb->head) {
+        *avail = rb->cap - tail; // up to end of storage, wrapped part is picked up by next call
+    } else {
+        *avail = rb->head - tail;
+    }
+
+    return rb->data + tail;
+}
+
+void ringbuf_commit(ringbuf_t* rb, size_t n) {
+    assert(rb->len + n <= rb->cap);
+    rb->len += n;
+}
+
+bool ringbuf_write(ringbuf_t* rb, const char* data, size_t n) {
+    if (rb->cap - rb->len < n) return false;
+
+    while (n > 0) {
+        size_t avail;
+        char* tail = ringbuf_tail(rb, &avail);
+        if (avail > n) avail = n;
+
+        memcpy(tail, data, avail);
+        ringbuf_commit(rb, avail);
+
+        data += avail;
+        n -= avail;
+    }
+
+    return true;
+}
+
+int ringbuf_iov(const ringbuf_t* rb, struct iovec iov[2]) {
+    if (rb->len == 0) return 0;
+
+    size_t first = rb->cap - rb->head;
+    if (first >= rb->len) {
+        iov[0] = (struct iovec) { .iov_base = rb->data + rb->head, .iov_len = rb->len };
+        return 1;
+    }
+
+    iov[0] = (struct iovec) { .iov_base = rb->data + rb->head, .iov_len = first };
+    iov[1] = (struct iovec) { .iov_base = rb->data, .iov_len = rb->len - first };
+    return 2;
+}
+
+ssize_t ringbuf_find(const ringbuf_t* rb, const char* seq, size_t seq_len) {
+    if (seq_len == 0 || rb->len < seq_len) return -1;
+
+    for (size_t i = 0; i + seq_len <= rb->len; i++) {
+        size_t j = 0;
+        while (j < seq_len && rb->data[(rb->head + i + j) % rb->cap] == seq[j]) {
+            j++;
+        }
+        if (j == seq_len) return (ssize_t)i;
+    }
+
+    return -1;
+}
+
+size_t ringbuf_peek(const ringbuf_t* rb, char* out, size_t n) {
+    if (n > rb->len) n = rb->len;
+
+    size_t first = rb->cap - rb->head;
+    if (first > n) first = n;
+
+    memcpy(out, rb->data + rb->head, first);
+    memcpy(out + first, rb->data, n - first);
+
+    return n;
+}
+
+void ringbuf_discard(ringbuf_t* rb, size_t n) {
+    if (n > rb->len) n = rb->len;
+
+    rb->head = (rb->head + n) % rb->cap;
+    rb->len -= n;
+
+    if (rb->len == 0) rb->head = 0; // keeps next recv contiguous
+}
+
+size_t ringbuf_read(ringbuf_t* rb, char* out, size_t n) {
+    n = ringbuf_peek(rb, out, n);
+    ringbuf_discard(rb, n);
+    return n;
+}
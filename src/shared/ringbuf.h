@@ -0,0 +1,40 @@
+#ifndef _MFTP_SHARED_RINGBUF_H_
+#define _MFTP_SHARED_RINGBUF_H_
+
+/* Fixed capacity byte ring buffer - used for per-connection I/O queues */
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+typedef struct {
+    char* data;
+    size_t cap;
+    size_t head;    // offset of first readable byte
+    size_t len;     // readable bytes
+} ringbuf_t;
+
+bool ringbuf_init(ringbuf_t* rb, size_t cap);
+void ringbuf_cleanup(ringbuf_t* rb);
+
+// contiguous free space after last readable byte - fill it directly (ex. with recv) and call ringbuf_commit
+char* ringbuf_tail(ringbuf_t* rb, size_t* avail);
+void ringbuf_commit(ringbuf_t* rb, size_t n);
+
+// appends all n bytes, or nothing if they don't fit
+bool ringbuf_write(ringbuf_t* rb, const char* data, size_t n);
+
+// describes readable bytes as up to two iovecs (for writev), returns number of iovecs used
+int ringbuf_iov(const ringbuf_t* rb, struct iovec iov[2]);
+
+// offset (from head) of first occurence of seq, or -1 if not found
+ssize_t ringbuf_find(const ringbuf_t* rb, const char* seq, size_t seq_len);
+
+// copies up to n bytes into out without consuming them, returns number of bytes copied
+size_t ringbuf_peek(const ringbuf_t* rb, char* out, size_t n);
+void ringbuf_discard(ringbuf_t* rb, size_t n);
+// peek + discard
+size_t ringbuf_read(ringbuf_t* rb, char* out, size_t n);
+
+#endif
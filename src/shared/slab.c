@@ -0,0 +1,219 @@
+#include "slab.h"
+#include "utils.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+// every object is preceded by a header saying which class it came from
+typedef struct {
+    uint32_t class;
+    uint32_t _pad[SLAB_ALIGN / sizeof(uint32_t) - 1];
+} slab_header_t;
+
+#define SLAB_CLASS_MALLOC UINT32_MAX
+
+typedef struct slab_free_obj {
+    struct slab_free_obj* next;
+} slab_free_obj_t;
+
+typedef struct slab_chunk {
+    struct slab_chunk* next;
+} slab_chunk_t;
+
+typedef struct {
+    size_t size;            // object size, without header
+    size_t per_slab;
+    slab_free_obj_t* free;  // headers of free objects
+    slab_chunk_t* chunks;
+    size_t slabs, in_use, peak;
+    pthread_mutex_t lock;
+} slab_class_t;
+
+static slab_class_t classes[SLAB_MAX_CLASSES];
+static size_t classes_count; // classes[0..classes_count) are set up, sizes never change - read with __atomic
+static pthread_mutex_t classes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// class for objects of size, NULL if size isn't pooled
+static slab_class_t* class_for(size_t size, bool create) {
+#ifdef MFTP_SLAB_MALLOC
+    // every object gets its own malloc block, so AddressSanitizer can track it
+    (void)size;
+    (void)create;
+    return NULL;
+#else
+    if (size == 0) size = 1;
+    size = (size + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1);
+    if (size > SLAB_MAX_OBJECT) return NULL;
+
+    size_t count = __atomic_load_n(&classes_count, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i < count; i++) {
+        if (classes[i].size == size) return &classes[i];
+    }
+    if (!create) return NULL;
+
+    pthread_mutex_lock(&classes_lock);
+
+    // someone may have added it meanwhile
+    slab_class_t* class = NULL;
+    for (size_t i = 0; i < classes_count; i++) {
+        if (classes[i].size == size) class = &classes[i];
+    }
+
+    if (class == NULL && classes_count < SLAB_MAX_CLASSES) {
+        class = &classes[classes_count];
+        *class = (slab_class_t) {
+            .size = size,
+            .per_slab = (SLAB_SIZE - sizeof(slab_chunk_t)) / (sizeof(slab_header_t) + size),
+        };
+        if (class->per_slab == 0) class->per_slab = 1;
+        pthread_mutex_init(&class->lock, NULL);
+
+        __atomic_store_n(&classes_count, classes_count + 1, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&classes_lock);
+    return class;
+#endif
+}
+
+// class lock must be held
+static bool class_grow(slab_class_t* class, size_t objects) {
+    size_t stride = sizeof(slab_header_t) + class->size;
+    // chunk header is padded to SLAB_ALIGN as well, so objects stay aligned
+    slab_chunk_t* chunk = malloc(SLAB_ALIGN + objects * stride);
+    if (chunk == NULL) return false;
+
+    chunk->next = class->chunks;
+    class->chunks = chunk;
+    class->slabs++;
+
+    char* base = (char*)chunk + SLAB_ALIGN;
+    uint32_t index = (uint32_t)(class - classes);
+
+    for (size_t i = objects; i-- > 0;) {
+        slab_header_t* header = (slab_header_t*)(base + i * stride);
+        header->class = index;
+
+        slab_free_obj_t* obj = (slab_free_obj_t*)(header + 1);
+        obj->next = class->free;
+        class->free = obj;
+    }
+
+    return true;
+}
+
+void* slab_alloc(size_t size) {
+    slab_class_t* class = class_for(size, true);
+
+    if (class == NULL) {
+        slab_header_t* header = malloc(sizeof(slab_header_t) + size);
+        if (header == NULL) return NULL;
+        header->class = SLAB_CLASS_MALLOC;
+        return header + 1;
+    }
+
+    pthread_mutex_lock(&class->lock);
+
+    if (class->free == NULL && !class_grow(class, class->per_slab)) {
+        pthread_mutex_unlock(&class->lock);
+        return NULL;
+    }
+
+    slab_free_obj_t* obj = class->free;
+    class->free = obj->next;
+    if (++class->in_use > class->peak) class->peak = class->in_use;
+
+    pthread_mutex_unlock(&class->lock);
+    return obj;
+}
+
+void slab_free(void* ptr) {
+    if (ptr == NULL) return;
+
+    slab_header_t* header = (slab_header_t*)ptr - 1;
+    if (header->class == SLAB_CLASS_MALLOC) {
+        free(header);
+        return;
+    }
+
+    slab_class_t* class = &classes[header->class];
+    slab_free_obj_t* obj = ptr;
+
+    pthread_mutex_lock(&class->lock);
+    obj->next = class->free;
+    class->free = obj;
+    class->in_use--;
+    pthread_mutex_unlock(&class->lock);
+}
+
+bool slab_reserve(size_t size, size_t count) {
+    slab_class_t* class = class_for(size, true);
+    if (class == NULL) return false;
+
+    pthread_mutex_lock(&class->lock);
+
+    size_t capacity = class->in_use;
+    for (slab_free_obj_t* obj = class->free; obj != NULL; obj = obj->next) capacity++;
+
+    bool ok = true;
+    while (ok && capacity < count) {
+        size_t objects = count - capacity;
+        if (objects > class->per_slab) objects = class->per_slab;
+
+        ok = class_grow(class, objects);
+        capacity += objects;
+    }
+
+    pthread_mutex_unlock(&class->lock);
+
+    if (!ok) log_syserr("Failed to preallocate %zu objects of %zu bytes", count, size);
+    return ok;
+}
+
+size_t slab_stats(slab_class_stats_t* out, size_t max) {
+    size_t count = __atomic_load_n(&classes_count, __ATOMIC_ACQUIRE);
+    if (count > max) count = max;
+
+    for (size_t i = 0; i < count; i++) {
+        slab_class_t* class = &classes[i];
+        pthread_mutex_lock(&class->lock);
+
+        size_t free_count = 0;
+        for (slab_free_obj_t* obj = class->free; obj != NULL; obj = obj->next) free_count++;
+
+        out[i] = (slab_class_stats_t) {
+            .size = class->size,
+            .slabs = class->slabs,
+            .capacity = class->in_use + free_count,
+            .in_use = class->in_use,
+            .peak = class->peak,
+        };
+
+        pthread_mutex_unlock(&class->lock);
+    }
+
+    return count;
+}
+
+void slab_cleanup(void) {
+    pthread_mutex_lock(&classes_lock);
+
+    for (size_t i = 0; i < classes_count; i++) {
+        slab_class_t* class = &classes[i];
+
+        slab_chunk_t* chunk = class->chunks;
+        while (chunk != NULL) {
+            slab_chunk_t* next = chunk->next;
+            free(chunk);
+            chunk = next;
+        }
+
+        pthread_mutex_destroy(&class->lock);
+        class->chunks = NULL;
+        class->free = NULL;
+    }
+    __atomic_store_n(&classes_count, 0, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&classes_lock);
+}
@@ -0,0 +1,40 @@
+#ifndef _MFTP_SHARED_SLAB_H_
+#define _MFTP_SHARED_SLAB_H_
+
+/* Slab allocator - fixed size objects carved out of preallocated slabs and recycled through per-size free lists */
+/* Meant for objects that come and go all the time (sessions, watchers, buffers): churn doesn't hit malloc and     */
+/* memory taken is kept for reuse, never returned to the system. Thread safe.                                     */
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// every distinct size (rounded up to SLAB_ALIGN) gets its own class on first use - sizes above SLAB_MAX_OBJECT,
+// or beyond SLAB_MAX_CLASSES different ones, are passed to malloc
+#define SLAB_ALIGN 16
+#define SLAB_MAX_CLASSES 16
+#define SLAB_MAX_OBJECT (16 * 1024)
+// memory taken from malloc at once when a class runs out
+#define SLAB_SIZE (64 * 1024)
+// MFTP_SLAB_MALLOC (set by MFTP_ASAN build option) turns pooling off - every object is passed to malloc
+
+void* slab_alloc(size_t size);
+void slab_free(void* ptr);
+
+// preallocates room for count objects of size (ex. max_clients sessions), false if out of memory
+bool slab_reserve(size_t size, size_t count);
+
+typedef struct {
+    size_t size;        // object size of the class
+    size_t slabs;
+    size_t capacity;    // objects slabs have room for
+    size_t in_use;
+    size_t peak;
+} slab_class_stats_t;
+
+// stats of up to max classes, returns how many were written
+size_t slab_stats(slab_class_stats_t* out, size_t max);
+
+// frees all slabs - nothing allocated from them may be used anymore
+void slab_cleanup(void);
+
+#endif
@@ -1,6 +1,13 @@
+#define _GNU_SOURCE // getline(3)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include <unistd.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 
@@ -29,12 +36,30 @@ bool socket_set_nonblocking(socket_t* sock, bool to) {
 }
 
 bool socket_bind_tcp(socket_t* out_socket, uint32_t haddr, uint16_t hport) {
+    return socket_bind_tcp_ex(out_socket, haddr, hport, 0);
+}
+
+bool socket_bind_tcp_ex(socket_t* out_socket, uint32_t haddr, uint16_t hport, int flags) {
     out_socket->fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
     if (out_socket->fd < 0) {
         log_syserr("Failed to create socket");
         return false;
     }
 
+    // socket options only affect bind() if set before it
+    int optval = 1;
+    if (setsockopt(out_socket->fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) < 0) {
+        log_syserr("Failed to set socket options");
+        close(out_socket->fd);
+        return false;
+    }
+
+    if ((flags & SOCKET_REUSEPORT) && setsockopt(out_socket->fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) < 0) {
+        log_syserr("Failed to set SO_REUSEPORT");
+        close(out_socket->fd);
+        return false;
+    }
+
     struct sockaddr_in bind_addr = {
         .sin_family = AF_INET,
         .sin_addr.s_addr = htonl(haddr),
@@ -54,13 +79,6 @@ bool socket_bind_tcp(socket_t* out_socket, uint32_t haddr, uint16_t hport) {
         return false;
     }
 
-    int optval = 1;
-    if (setsockopt(out_socket->fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) < 0) {
-        log_syserr("Failed to set socket options");
-        close(out_socket->fd);
-        return false;
-    }
-
     struct sockaddr_in bound_addr = { 0 };
     socklen_t bound_addr_len = sizeof(bound_addr);
     if (getsockname(out_socket->fd, (struct sockaddr*)&bound_addr, &bound_addr_len) < 0) {
@@ -80,3 +98,67 @@ void socket_cleanup(socket_t* sock) {
     close(sock->fd);
     sock->fd = -1;
 }
+
+bool socket_same_peer(int fd_a, int fd_b) {
+    struct sockaddr_in addr_a = { 0 }, addr_b = { 0 };
+    socklen_t len_a = sizeof(addr_a), len_b = sizeof(addr_b);
+
+    if (getpeername(fd_a, (struct sockaddr*)&addr_a, &len_a) < 0 || getpeername(fd_b, (struct sockaddr*)&addr_b, &len_b) < 0) {
+        log_syserr("Failed to get peer address");
+        return false;
+    }
+
+    return addr_a.sin_family == addr_b.sin_family && addr_a.sin_addr.s_addr == addr_b.sin_addr.s_addr;
+}
+
+bool socket_accept_queue(int fd, uint32_t* queued, uint32_t* capacity) {
+    struct tcp_info info = { 0 };
+    socklen_t len = sizeof(info);
+
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0) {
+        log_syserr("Failed to get listening socket info");
+        return false;
+    }
+
+    // for listening sockets kernel reports accept queue length and backlog in these two
+    *queued = info.tcpi_unacked;
+    *capacity = info.tcpi_sacked;
+    return true;
+}
+
+bool socket_listen_overflows(uint64_t* overflows) {
+    FILE* file = fopen("/proc/net/netstat", "r");
+    if (file == NULL) return false;
+
+    // "TcpExt: <names...>" line is followed by "TcpExt: <values...>" line
+    char* names = NULL;
+    char* values = NULL;
+    size_t names_size = 0, values_size = 0;
+    bool found = false;
+
+    while (getline(&names, &names_size, file) > 0) {
+        if (strncmp(names, "TcpExt:", 7) != 0) continue;
+        if (getline(&values, &values_size, file) <= 0) break;
+
+        char* name_save = NULL;
+        char* value_save = NULL;
+        char* name = strtok_r(names, " \n", &name_save);
+        char* value = strtok_r(values, " \n", &value_save);
+
+        while (name != NULL && value != NULL) {
+            if (strcmp(name, "ListenOverflows") == 0) {
+                *overflows = strtoull(value, NULL, 10);
+                found = true;
+                break;
+            }
+            name = strtok_r(NULL, " \n", &name_save);
+            value = strtok_r(NULL, " \n", &value_save);
+        }
+        break;
+    }
+
+    free(names);
+    free(values);
+    fclose(file);
+    return found;
+}
@@ -10,8 +10,21 @@ typedef struct {
     uint16_t hport;
 } socket_t;
 
+enum {
+    SOCKET_REUSEPORT = 1, // allow several sockets (one per reactor thread) to listen on the same port
+};
+
 bool socket_set_nonblocking(socket_t* sock, bool to);
 bool socket_bind_tcp(socket_t* out_socket, uint32_t haddr, uint16_t hport);
+bool socket_bind_tcp_ex(socket_t* out_socket, uint32_t haddr, uint16_t hport, int flags);
 void socket_cleanup(socket_t* sock);
 
+// true if both connected sockets have the same remote address (port ignored)
+bool socket_same_peer(int fd_a, int fd_b);
+
+// connections waiting in listening socket's accept queue and its capacity (TCP_INFO), false if unavailable
+bool socket_accept_queue(int fd, uint32_t* queued, uint32_t* capacity);
+// system-wide count of connections dropped because some accept queue was full (TcpExt ListenOverflows)
+bool socket_listen_overflows(uint64_t* overflows);
+
 #endif
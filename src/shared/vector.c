@@ -0,0 +1,129 @@
+#include "vector.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+// first allocation, in elements
+#define VECTOR_MIN_CAPACITY 8
+
+vector_t vector_new_ex(size_t sizeof_element, allocator_t allocator) {
+    return (vector_t) {
+        .data = NULL,
+        .size = 0,
+        .capacity = 0,
+        .sizeof_element = sizeof_element,
+        .allocator = allocator,
+    };
+}
+
+vector_iter_t vector_iter(const vector_t* vector) {
+    assert(vector != NULL);
+
+    return (vector_iter_t) {
+        .vector = vector,
+        .index = 0,
+    };
+}
+
+void* vector_next(vector_iter_t* iter) {
+    if (iter->index >= iter->vector->size) {
+        return NULL;
+    }
+
+    return vector_at(iter->vector, iter->index++);
+}
+
+bool vector_reserve(vector_t* vector, size_t capacity) {
+    assert(vector != NULL);
+
+    if (capacity <= vector->capacity) {
+        return true;
+    }
+    if (capacity > SIZE_MAX / vector->sizeof_element) {
+        return false;
+    }
+
+    void* data = vector->allocator.realloc(vector->data, capacity * vector->sizeof_element);
+    if (data == NULL) {
+        return false;
+    }
+
+    vector->data = data;
+    vector->capacity = capacity;
+    return true;
+}
+
+void* vector_push(vector_t* vector, const void* element) {
+    assert(vector != NULL);
+    assert(element != NULL);
+
+    if (vector->size == vector->capacity) {
+        size_t capacity = vector->capacity > 0 ? vector->capacity * 2 : VECTOR_MIN_CAPACITY;
+        if (!vector_reserve(vector, capacity)) {
+            return NULL;
+        }
+    }
+
+    void* slot = (char*)vector->data + vector->size * vector->sizeof_element;
+    memcpy(slot, element, vector->sizeof_element);
+    vector->size++;
+
+    return slot;
+}
+
+void* vector_at(const vector_t* vector, size_t index) {
+    assert(vector != NULL);
+
+    if (index >= vector->size) {
+        return NULL;
+    }
+
+    return (char*)vector->data + index * vector->sizeof_element;
+}
+
+bool vector_remove(vector_t* vector, size_t index) {
+    return vector_remove_range(vector, index, 1);
+}
+
+bool vector_remove_range(vector_t* vector, size_t index, size_t count) {
+    assert(vector != NULL);
+
+    if (index >= vector->size || count > vector->size - index) {
+        return false;
+    }
+
+    char* slot = (char*)vector->data + index * vector->sizeof_element;
+    memmove(slot, slot + count * vector->sizeof_element, (vector->size - index - count) * vector->sizeof_element);
+    vector->size -= count;
+
+    return true;
+}
+
+bool vector_swap_remove(vector_t* vector, size_t index) {
+    assert(vector != NULL);
+
+    if (index >= vector->size) {
+        return false;
+    }
+
+    vector->size--;
+    if (index != vector->size) {
+        memcpy((char*)vector->data + index * vector->sizeof_element,
+            (char*)vector->data + vector->size * vector->sizeof_element, vector->sizeof_element);
+    }
+
+    return true;
+}
+
+void vector_clear(vector_t* vector) {
+    assert(vector != NULL);
+
+    if (vector->data != NULL) {
+        vector->allocator.free(vector->data);
+    }
+
+    vector->data = NULL;
+    vector->size = 0;
+    vector->capacity = 0;
+}
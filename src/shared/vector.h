@@ -0,0 +1,46 @@
+#ifndef _MFTP_SHARED_VECTOR_H_
+#define _MFTP_SHARED_VECTOR_H_
+
+/* Contiguous dynamic array - elements are stored by value, one allocation for all of them */
+/* Pointers to elements are invalidated by anything that may grow the vector (vector_push, vector_reserve) */
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "allocator.h"
+
+typedef struct vector {
+    void* data;
+    size_t size;
+    size_t capacity;
+    size_t sizeof_element;
+    allocator_t allocator;
+} vector_t;
+
+typedef struct vector_iterator {
+    const vector_t* vector;
+    size_t index;
+} vector_iter_t;
+
+vector_t vector_new_ex(size_t sizeof_element, allocator_t allocator);
+#define vector_new(type) vector_new_ex(sizeof(type), std_allocator)
+
+// visits elements in index order
+vector_iter_t vector_iter(const vector_t* vector);
+void* vector_next(vector_iter_t* iter);
+
+bool vector_reserve(vector_t* vector, size_t capacity);
+// copies element to the back, returns the stored copy - NULL if out of memory
+void* vector_push(vector_t* vector, const void* element);
+// NULL if index is out of range
+void* vector_at(const vector_t* vector, size_t index);
+// keeps order of the remaining elements - O(n)
+bool vector_remove(vector_t* vector, size_t index);
+// removes count elements starting at index, keeps order of the rest - O(n)
+bool vector_remove_range(vector_t* vector, size_t index, size_t count);
+// moves the last element into removed one's place - O(1)
+bool vector_swap_remove(vector_t* vector, size_t index);
+// drops all elements and frees storage, vector can still be used afterwards
+void vector_clear(vector_t* vector);
+
+#endif
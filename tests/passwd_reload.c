@@ -0,0 +1,150 @@
+// Limits changed in the passwd file and reloaded must reach user's shared rate bucket and fair share flow, while
+// sessions that logged in before the reload must not bring the old ones back.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "shared/utils.h"
+#include "shared/cmd.h"
+#include "shared/slab.h"
+#include "server/ctx.h"
+#include "server/handlers.h"
+#include "server/ratelimit.h"
+#include "server/fairshare.h"
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        failed = true; \
+        goto cleanup; \
+    } \
+} while (0)
+
+// how long to wait for the reloader thread, in 1 ms steps
+#define RELOAD_WAIT_MS 5000
+
+static bool passwd_write(const char* path, const char* line) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) return false;
+    fprintf(file, "%s\n", line);
+    return fclose(file) == 0;
+}
+
+static void handle(mftp_client_ctx_t* ctx, mftp_cmd_t cmd, const char* data) {
+    command_handler_arg_t arg = { .client_ctx = ctx, .cmd = { .cmd = cmd } };
+    strncpy(arg.cmd.data, data, sizeof(arg.cmd.data) - 1);
+    command_table[cmd].handler(&arg);
+}
+
+static mftp_client_ctx_t* session_login(mftp_server_ctx_t* server_ctx, int* peer_fd) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) return NULL;
+
+    mftp_client_ctx_t* ctx = slab_alloc(sizeof(mftp_client_ctx_t));
+    if (ctx == NULL || !client_ctx_init(ctx, fds[0], server_ctx)) {
+        slab_free(ctx);
+        close(fds[0]);
+        close(fds[1]);
+        return NULL;
+    }
+    *peer_fd = fds[1];
+
+    handle(ctx, MFTP_CMD_USER, "bob");
+    handle(ctx, MFTP_CMD_PASS, "secret");
+    return ctx;
+}
+
+static bool reloaded(cred_store_t* store, uint32_t generation) {
+    for (int i = 0; i < RELOAD_WAIT_MS; i++) {
+        passwd_entry_t entry;
+        if (cred_store_check(store, "bob", "secret", &entry) && entry.generation == generation) return true;
+        usleep(1000);
+    }
+    return false;
+}
+
+int main(void) {
+    bool failed = false;
+    log_cfg.level = LOG_ERROR;
+
+    char dir[] = "/tmp/mftp-test-XXXXXX";
+    if (mkdtemp(dir) == NULL) return 1;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/mftp.passwd", dir);
+
+    mftp_client_ctx_t* before = NULL;
+    mftp_client_ctx_t* after = NULL;
+    int before_fd = -1, after_fd = -1;
+    bool store_up = false;
+
+    mftp_server_cfg_t cfg = { .root_dir = dir, .max_cmd_size = 256 };
+    cred_store_t creds;
+    rate_user_registry_t rate_users;
+    rate_user_registry_init(&rate_users);
+    fair_sched_t fair;
+    fair_sched_init(&fair);
+
+    mftp_server_ctx_t server_ctx = {
+        .cfg = &cfg,
+        .creds = &creds,
+        .rate_users = &rate_users,
+        .fair = &fair,
+    };
+    pthread_mutex_init(&server_ctx.notify_lock, NULL);
+
+    bool loaded;
+    CHECK(passwd_write(path, "bob:secret:rl:1000:0:1"));
+    CHECK(cred_store_init(&creds, path, &loaded) && loaded);
+    store_up = true;
+
+    before = session_login(&server_ctx, &before_fd);
+    CHECK(before != NULL && before->authenticated);
+
+    rate_bucket_t* bucket = rate_user_bucket(&rate_users, &before->creds);
+    CHECK(bucket != NULL && bucket->rate == 1000);
+    fair_flow_t* flow = fair_flow_join(&fair, &before->creds);
+    CHECK(flow != NULL && flow->weight == 1);
+    fair_flow_leave(flow);
+
+    CHECK(passwd_write(path, "bob:secret:rl:5000:0:3"));
+    cred_store_reload(&creds);
+    CHECK(reloaded(&creds, 1));
+
+    // session logged in after the reload carries the new limits to the shared bucket and flow
+    after = session_login(&server_ctx, &after_fd);
+    CHECK(after != NULL && after->authenticated);
+    CHECK(after->creds.generation == 1);
+
+    CHECK(rate_user_bucket(&rate_users, &after->creds) == bucket);
+    CHECK(bucket->rate == 5000);
+    CHECK(fair_flow_join(&fair, &after->creds) == flow);
+    CHECK(flow->weight == 3);
+    fair_flow_leave(flow);
+
+    // and the older session doesn't turn them back
+    CHECK(rate_user_bucket(&rate_users, &before->creds) == bucket);
+    CHECK(bucket->rate == 5000);
+    CHECK(fair_flow_join(&fair, &before->creds) == flow);
+    CHECK(flow->weight == 3);
+    fair_flow_leave(flow);
+
+cleanup:
+    if (before != NULL) client_ctx_cleanup_full(before);
+    if (after != NULL) client_ctx_cleanup_full(after);
+    if (before_fd >= 0) close(before_fd);
+    if (after_fd >= 0) close(after_fd);
+    if (store_up) cred_store_cleanup(&creds);
+    fair_sched_cleanup(&fair);
+    rate_user_registry_cleanup(&rate_users);
+    pthread_mutex_destroy(&server_ctx.notify_lock);
+    slab_cleanup();
+    unlink(path);
+    rmdir(dir);
+
+    if (!failed) printf("passwd_reload: ok\n");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,212 @@
+// Session that disconnects while its SEGM transfer is set up must give back the upload reference, transfer slot and
+// data channel listener, so other sessions can still finish the upload and the upload is freed once committed.
+// Drives the real ALLO/SEGM handlers and data channel on an event loop.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "shared/utils.h"
+#include "shared/cmd.h"
+#include "shared/slab.h"
+#include "server/ctx.h"
+#include "server/handlers.h"
+#include "server/upload.h"
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        failed = true; \
+        goto cleanup; \
+    } \
+} while (0)
+
+#define UPLOAD_SIZE 8192
+// loop iterations (1 ms apart) a transfer gets to finish
+#define TRANSFER_WAIT_MS 5000
+
+// connected loopback TCP pair - data connections are only accepted from the command connection's address
+static bool tcp_pair(int fds[2]) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t len = sizeof(addr);
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    bool ok = false;
+
+    fds[0] = fds[1] = -1;
+    if (listener < 0) return false;
+    if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listener, 1) < 0) goto cleanup;
+    if (getsockname(listener, (struct sockaddr*)&addr, &len) < 0) goto cleanup;
+
+    fds[1] = socket(AF_INET, SOCK_STREAM, 0);
+    if (fds[1] < 0 || connect(fds[1], (struct sockaddr*)&addr, sizeof(addr)) < 0) goto cleanup;
+    fds[0] = accept(listener, NULL, NULL);
+    ok = fds[0] >= 0;
+
+cleanup:
+    close(listener);
+    if (!ok && fds[1] >= 0) close(fds[1]);
+    return ok;
+}
+
+static int data_connect(uint16_t port) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static mftp_client_ctx_t* session_open(mftp_server_ctx_t* server_ctx, int* peer_fd) {
+    int fds[2];
+    if (!tcp_pair(fds)) return NULL;
+
+    mftp_client_ctx_t* ctx = slab_alloc(sizeof(mftp_client_ctx_t));
+    if (ctx == NULL || !client_ctx_init(ctx, fds[0], server_ctx)) {
+        slab_free(ctx);
+        close(fds[0]);
+        close(fds[1]);
+        return NULL;
+    }
+
+    *peer_fd = fds[1];
+    return ctx;
+}
+
+static void handle(mftp_client_ctx_t* ctx, mftp_cmd_t cmd, const char* data) {
+    command_handler_arg_t arg = { .client_ctx = ctx, .cmd = { .cmd = cmd } };
+    strncpy(arg.cmd.data, data, sizeof(arg.cmd.data) - 1);
+    command_table[cmd].handler(&arg);
+}
+
+static bool replied(mftp_client_ctx_t* ctx, const char* text) {
+    return ringbuf_find(&ctx->out_buf, text, strlen(text)) >= 0;
+}
+
+// replies are flushed by the reactor - nothing to do for them here
+static void notify_callback(uev_t* w, void* arg, int events) {
+    (void)w;
+    (void)arg;
+    (void)events;
+}
+
+int main(void) {
+    bool failed = false;
+    log_cfg.level = LOG_ERROR;
+
+    char dir[] = "/tmp/mftp-test-XXXXXX";
+    if (mkdtemp(dir) == NULL) return 1;
+
+    char root[PATH_MAX], path[PATH_MAX];
+    snprintf(root, sizeof(root), "%s/", dir);
+    snprintf(path, sizeof(path), "%s/file.bin", dir);
+
+    mftp_client_ctx_t* first = NULL;
+    mftp_client_ctx_t* second = NULL;
+    int first_peer = -1, second_peer = -1, data_fd = -1;
+
+    uev_ctx_t loop;
+    uev_init(&loop);
+
+    mftp_server_cfg_t cfg = {
+        .flags = { .allow_anonymous = 1, .event_transfers = 1 },
+        .root_dir = root,
+        .max_cmd_size = 256,
+        .max_transfers = 1,
+        .timeout_ms = 5000,
+    };
+    upload_registry_t uploads;
+    upload_registry_init(&uploads);
+    size_t transfers_total = 0;
+
+    mftp_server_ctx_t server_ctx = {
+        .loop = &loop,
+        .cfg = &cfg,
+        .uploads = &uploads,
+        .transfers_total = &transfers_total,
+    };
+    pthread_mutex_init(&server_ctx.notify_lock, NULL);
+    uev_event_init(&loop, &server_ctx.notify_watcher, notify_callback, &server_ctx);
+
+    first = session_open(&server_ctx, &first_peer);
+    CHECK(first != NULL);
+
+    char segm[64];
+    snprintf(segm, sizeof(segm), "%d file.bin", UPLOAD_SIZE);
+    handle(first, MFTP_CMD_ALLO, segm);
+    CHECK(replied(first, "Allocated"));
+
+    // first session starts a segment and disconnects while its data channel waits for a connection
+    snprintf(segm, sizeof(segm), "0 %d file.bin", UPLOAD_SIZE / 2);
+    handle(first, MFTP_CMD_SEGM, segm);
+    CHECK(replied(first, "Opening data channel"));
+    CHECK(first->t_arm_pending && first->t_listen.fd >= 0);
+    data_channel_arm(first);
+
+    upload_t* upload = first->t_upload;
+    uint16_t first_port = first->t_listen.hport;
+    CHECK(upload != NULL && upload->refs == 2);
+    CHECK(transfers_total == 1);
+
+    client_ctx_cleanup_full(first);
+    first = NULL;
+
+    CHECK(upload->refs == 1); // registry's own
+    CHECK(transfers_total == 0);
+    data_fd = data_connect(first_port);
+    CHECK(data_fd < 0 && errno == ECONNREFUSED); // listener is closed too
+
+    // second session can take the only transfer slot and send the whole file
+    second = session_open(&server_ctx, &second_peer);
+    CHECK(second != NULL);
+
+    snprintf(segm, sizeof(segm), "0 %d file.bin", UPLOAD_SIZE);
+    handle(second, MFTP_CMD_SEGM, segm);
+    CHECK(replied(second, "Opening data channel"));
+    data_channel_arm(second);
+
+    data_fd = data_connect(second->t_listen.hport);
+    CHECK(data_fd >= 0);
+
+    char data[UPLOAD_SIZE];
+    memset(data, 'x', sizeof(data));
+    CHECK(send(data_fd, data, sizeof(data), 0) == sizeof(data));
+
+    for (int i = 0; i < TRANSFER_WAIT_MS && !replied(second, "upload committed"); i++) {
+        uev_run(&loop, UEV_ONCE | UEV_NONBLOCK);
+        usleep(1000);
+    }
+    CHECK(replied(second, "upload committed"));
+
+    client_ctx_cleanup_full(second);
+    second = NULL;
+
+    CHECK(transfers_total == 0);
+    CHECK(uploads.head == NULL);
+
+    struct stat st;
+    CHECK(stat(path, &st) == 0 && st.st_size == UPLOAD_SIZE);
+
+cleanup:
+    if (first != NULL) client_ctx_cleanup_full(first);
+    if (second != NULL) client_ctx_cleanup_full(second);
+    if (first_peer >= 0) close(first_peer);
+    if (second_peer >= 0) close(second_peer);
+    if (data_fd >= 0) close(data_fd);
+    uev_exit(&loop);
+    unlink(path);
+    rmdir(dir);
+    upload_registry_cleanup(&uploads);
+    pthread_mutex_destroy(&server_ctx.notify_lock);
+    slab_cleanup();
+
+    if (!failed) printf("upload_disconnect: ok\n");
+    return failed ? 1 : 0;
+}